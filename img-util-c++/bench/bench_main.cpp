@@ -0,0 +1,281 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/mpmc.h"
+#include "../src/schedule.h"
+#include "../src/util.h"
+#include "../src/webp.h"
+
+static std::vector<unsigned char> make_bytes(size_t n) {
+    std::vector<unsigned char> v(n);
+    uint32_t x = 0x12345678;
+    for (size_t i = 0; i < n; i++) {
+        x = x * 1664525u + 1013904223u;
+        v[i] = static_cast<unsigned char>(x >> 24);
+    }
+    return v;
+}
+
+static void BM_md5(benchmark::State &state) {
+    std::vector<unsigned char> data = make_bytes(static_cast<size_t>(state.range(0)));
+    unsigned char dig[16];
+    for (auto _ : state) {
+        md5(data.data(), data.size(), dig);
+        benchmark::DoNotOptimize(dig);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_md5)->RangeMultiplier(4)->Range(1 << 10, 256 << 20)->Unit(benchmark::kMicrosecond);
+
+static void BM_md5_hex(benchmark::State &state) {
+    std::vector<unsigned char> data = make_bytes(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        std::string h = md5_hex(data.data(), data.size());
+        benchmark::DoNotOptimize(h);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_md5_hex)->RangeMultiplier(16)->Range(1 << 10, 256 << 20)->Unit(benchmark::kMicrosecond);
+
+// Shapes of the documents the tool actually parses: config.json, the
+// qiniu-token reply and the upload reply.
+static const std::string CONFIG_JSON =
+    "{\n  \"user_token\": \"64c19a25-0000-4000-8000-000000000000\",\n  \"enable_webp\": false,\n"
+    "  \"webp_quality\": 95,\n  \"bucket\": \"chat68\",\n"
+    "  \"qiniu_token_url\": \"https://chat-go.jwzhd.com/v1/misc/qiniu-token\"\n}\n";
+static const std::string TOKEN_JSON =
+    "{\"code\":1,\"data\":{\"token\":\"AKAKAKAKAKAKAKAKAKAKAKAKAKAKAKAKAKAKAKAK:c2lnbmF0dXJlc2lnbmF0dXJl:"
+    "eyJzY29wZSI6ImNoYXQ2OCIsImRlYWRsaW5lIjoxNzAwMDAwMDAwfQ==\"},\"msg\":\"success\"}";
+static const std::string UPLOAD_JSON =
+    "{\"hash\":\"FlrRfDWp0JbqdHRm5M0rCAHSTAr1\",\"key\":\"9e107d9d372bb6826bd81d3542a419d6.png\","
+    "\"fsize\":183422,\"bucket\":\"chat68\",\"name\":null,\"avinfo\":{\"format\":\"png\",\"width\":640,"
+    "\"height\":480,\"tags\":[\"a\",\"b\",\"c\"]}}";
+
+static void BM_json_get_config(benchmark::State &state) {
+    for (auto _ : state) {
+        std::string tok = json_get_string(CONFIG_JSON, "user_token", "");
+        bool webp = json_get_bool(CONFIG_JSON, "enable_webp", false);
+        int q = json_get_int(CONFIG_JSON, "webp_quality", 95);
+        std::string bucket = json_get_string(CONFIG_JSON, "bucket", "");
+        std::string url = json_get_string(CONFIG_JSON, "qiniu_token_url", "");
+        benchmark::DoNotOptimize(tok);
+        benchmark::DoNotOptimize(webp);
+        benchmark::DoNotOptimize(q);
+        benchmark::DoNotOptimize(bucket);
+        benchmark::DoNotOptimize(url);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(CONFIG_JSON.size()));
+}
+BENCHMARK(BM_json_get_config);
+
+static void BM_json_get_token(benchmark::State &state) {
+    for (auto _ : state) {
+        std::string tok = json_get_string(TOKEN_JSON, "token", "");
+        benchmark::DoNotOptimize(tok);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(TOKEN_JSON.size()));
+}
+BENCHMARK(BM_json_get_token);
+
+static void BM_json_pretty_print(benchmark::State &state) {
+    std::string doc = UPLOAD_JSON;
+    while (doc.size() < static_cast<size_t>(state.range(0))) doc = "[" + doc + "," + doc + "]";
+    for (auto _ : state) {
+        std::ostringstream os;
+        json_pretty_print(doc, os);
+        benchmark::DoNotOptimize(os);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(doc.size()));
+}
+BENCHMARK(BM_json_pretty_print)->Arg(256)->Arg(64 << 10);
+
+static void BM_normalize_input(benchmark::State &state) {
+    const std::string raw = "  \"C:\\\\Users\\\\me\\\\Pictures\\\\screenshot 2024-01-01 120000.png\"  \r\n";
+    for (auto _ : state) {
+        std::string s = raw;
+        normalize_input_inplace(s);
+        benchmark::DoNotOptimize(s);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(raw.size()));
+}
+BENCHMARK(BM_normalize_input);
+
+// cwebp reads PPM, so the encode benchmark needs no image library.
+static std::vector<unsigned char> make_ppm(int w, int h) {
+    char head[64];
+    int n = snprintf(head, sizeof(head), "P6\n%d %d\n255\n", w, h);
+    std::vector<unsigned char> out(head, head + n);
+    std::vector<unsigned char> px = make_bytes(static_cast<size_t>(w) * h * 3);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            unsigned char *p = &px[(static_cast<size_t>(y) * w + x) * 3];
+            p[0] = static_cast<unsigned char>((x + (p[0] & 7)) & 0xFF);
+            p[1] = static_cast<unsigned char>((y + (p[1] & 7)) & 0xFF);
+            p[2] = static_cast<unsigned char>(((x ^ y) + (p[2] & 7)) & 0xFF);
+        }
+    }
+    out.insert(out.end(), px.begin(), px.end());
+    return out;
+}
+
+static void BM_webp_encode(benchmark::State &state) {
+    int side = static_cast<int>(state.range(0));
+    std::vector<unsigned char> in = make_ppm(side, side);
+    PoolBuffer out;
+    if (!run_cwebp(ByteView{in.data(), in.size()}, 95, out)) {
+        state.SkipWithError("cwebp not available");
+        return;
+    }
+    for (auto _ : state) {
+        run_cwebp(ByteView{in.data(), in.size()}, 95, out);
+        benchmark::DoNotOptimize(out);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(in.size()));
+    state.counters["ratio"] = static_cast<double>(out.size()) / static_cast<double>(in.size());
+}
+BENCHMARK(BM_webp_encode)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+
+// Mutex + condition variable queue with the same interface, the baseline
+// for the lock-free ring.
+template <typename T>
+struct LockedQueue {
+    explicit LockedQueue(size_t capacity) : cap(capacity) {}
+
+    bool push(T v) {
+        std::unique_lock<std::mutex> lk(mu);
+        not_full.wait(lk, [&] { return closed || q.size() < cap; });
+        if (closed) return false;
+        q.push_back(std::move(v));
+        not_empty.notify_one();
+        return true;
+    }
+    bool pop(T &out) {
+        std::unique_lock<std::mutex> lk(mu);
+        not_empty.wait(lk, [&] { return closed || !q.empty(); });
+        if (q.empty()) return false;
+        out = std::move(q.front());
+        q.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+    void close() {
+        std::lock_guard<std::mutex> lk(mu);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+    size_t cap;
+    std::mutex mu;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> q;
+    bool closed = false;
+};
+
+// `side` producers hand `per_producer` numbers each to `side` consumers;
+// every number must arrive exactly once.
+template <typename Queue>
+static bool run_handoff(size_t capacity, int side, uint64_t per_producer) {
+    Queue q(capacity);
+    uint64_t n = per_producer * static_cast<uint64_t>(side);
+    std::vector<std::atomic<uint8_t>> seen(n);
+    std::vector<std::thread> producers;
+    std::vector<std::thread> consumers;
+    for (int p = 0; p < side; p++) {
+        producers.emplace_back([&, p] {
+            for (uint64_t i = 0; i < per_producer; i++) q.push(static_cast<uint64_t>(p) * per_producer + i);
+        });
+    }
+    for (int c = 0; c < side; c++) {
+        consumers.emplace_back([&] {
+            uint64_t v;
+            while (q.pop(v)) seen[v].fetch_add(1, std::memory_order_relaxed);
+        });
+    }
+    for (std::thread &t : producers) t.join();
+    q.close();
+    for (std::thread &t : consumers) t.join();
+    for (const std::atomic<uint8_t> &s : seen) {
+        if (s.load(std::memory_order_relaxed) != 1) return false;
+    }
+    return true;
+}
+
+template <typename Queue>
+static void BM_queue_handoff(benchmark::State &state) {
+    int side = static_cast<int>(state.range(0));
+    const uint64_t per_producer = 1 << 16;
+    for (auto _ : state) {
+        if (!run_handoff<Queue>(1024, side, per_producer)) {
+            state.SkipWithError("lost or duplicated items");
+            return;
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * side * static_cast<int64_t>(per_producer));
+}
+BENCHMARK_TEMPLATE(BM_queue_handoff, MpmcQueue<uint64_t>)
+    ->Arg(1)->Arg(2)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_queue_handoff, LockedQueue<uint64_t>)
+    ->Arg(1)->Arg(2)->Arg(4)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// Stress: a ring of 4 with 8 producers and 8 consumers wraps constantly
+// and keeps both sides parking and waking.
+static void BM_mpmc_stress(benchmark::State &state) {
+    for (auto _ : state) {
+        if (!run_handoff<MpmcQueue<uint64_t>>(4, 8, 20000)) {
+            state.SkipWithError("lost or duplicated items");
+            return;
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * 8 * 20000);
+}
+BENCHMARK(BM_mpmc_stress)->Iterations(20)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// A day's backfill: 20000 files in walk order, mostly 50-500 KB with a
+// Pareto tail up to a few hundred MB, each taking 20 ms plus its size at
+// 10 MB/s. Times planning and reports both orders' simulated wall time.
+static void BM_schedule_makespan(benchmark::State &state) {
+    size_t workers = static_cast<size_t>(state.range(0));
+    std::vector<SizedItem> items(20000);
+    uint32_t x = 0x9e3779b9;
+    for (size_t i = 0; i < items.size(); i++) {
+        x = x * 1664525u + 1013904223u;
+        double u = (static_cast<double>(x >> 8) + 1) / 16777217.0;
+        items[i].id = static_cast<long>(i);
+        items[i].size = static_cast<uint64_t>(std::min(50e3 / std::pow(u, 1 / 1.2), 400e6));
+    }
+    auto ms = [](uint64_t size) { return 20 + static_cast<double>(size) / 10e3; };
+    std::vector<double> fifo;
+    for (const SizedItem &it : items) fifo.push_back(ms(it.size));
+    size_t lanes = 0;
+    double sized = 0;
+    for (auto _ : state) {
+        lanes = plan_large_lanes(items, workers);
+        SizeSchedule order(items);
+        std::vector<double> in_order;
+        SizedItem it;
+        while (order.take(true, it)) in_order.push_back(ms(it.size));
+        sized = simulate_makespan(in_order, workers, lanes);
+    }
+    double plain = simulate_makespan(fifo, workers, workers);
+    state.counters["large_lanes"] = static_cast<double>(lanes);
+    state.counters["fifo_s"] = plain / 1000;
+    state.counters["size_s"] = sized / 1000;
+    state.counters["speedup"] = plain / sized;
+}
+BENCHMARK(BM_schedule_makespan)->Arg(8)->Arg(32)->Arg(128)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,137 @@
+#include "breaker.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include "metrics.h"
+#include "util.h"
+
+struct Breaker {
+    BreakerState state = BREAKER_CLOSED;
+    int failures = 0;
+    int probes = 0;
+    uint64_t trips = 0;
+    std::chrono::steady_clock::time_point opened;
+    std::chrono::steady_clock::time_point used;
+};
+
+static BreakerPolicy g_policy;
+static std::mutex g_mu;
+// Only hosts that have failed get an entry, and a closed one is dropped once
+// it has been idle for a while, so one-off download hosts do not pile up
+// here or in the metrics.
+static std::map<std::string, Breaker> g_breakers;
+static std::chrono::steady_clock::time_point g_last_sweep;
+static constexpr auto IDLE_EVICT = std::chrono::minutes(10);
+
+static const char *state_name(BreakerState s) {
+    switch (s) {
+    case BREAKER_OPEN: return "open";
+    case BREAKER_HALF_OPEN: return "half-open";
+    default: return "closed";
+    }
+}
+
+static std::string render_breakers() {
+    std::lock_guard<std::mutex> lk(g_mu);
+    std::ostringstream os;
+    os << "# HELP imgutil_breaker_state Circuit breaker per host (0 closed, 1 open, 2 half-open).\n";
+    os << "# TYPE imgutil_breaker_state gauge\n";
+    for (const auto &kv : g_breakers) {
+        os << "imgutil_breaker_state{host=\"" << kv.first << "\"} " << static_cast<int>(kv.second.state) << "\n";
+    }
+    os << "# HELP imgutil_breaker_trips_total Times the breaker for a host opened.\n";
+    os << "# TYPE imgutil_breaker_trips_total counter\n";
+    for (const auto &kv : g_breakers) {
+        os << "imgutil_breaker_trips_total{host=\"" << kv.first << "\"} " << kv.second.trips << "\n";
+    }
+    return os.str();
+}
+
+void breaker_configure(const BreakerPolicy &p) {
+    static bool registered = false;
+    std::lock_guard<std::mutex> lk(g_mu);
+    g_policy = p;
+    if (g_policy.failure_threshold < 1) g_policy.failure_threshold = 1;
+    if (g_policy.half_open_probes < 1) g_policy.half_open_probes = 1;
+    if (!registered) {
+        metrics_add_collector(render_breakers);
+        registered = true;
+    }
+}
+
+static void sweep_idle(std::chrono::steady_clock::time_point now) {
+    if (now - g_last_sweep < std::chrono::minutes(1)) return;
+    g_last_sweep = now;
+    for (auto it = g_breakers.begin(); it != g_breakers.end();) {
+        const Breaker &b = it->second;
+        if (b.state == BREAKER_CLOSED && now - b.used >= IDLE_EVICT) it = g_breakers.erase(it);
+        else ++it;
+    }
+}
+
+static void set_state(const std::string &host, Breaker &b, BreakerState s) {
+    if (b.state == s) return;
+    log_line("breaker %s: %s -> %s", host.c_str(), state_name(b.state), state_name(s));
+    b.state = s;
+    if (s == BREAKER_OPEN) {
+        b.opened = std::chrono::steady_clock::now();
+        b.trips++;
+    }
+    b.probes = 0;
+}
+
+bool breaker_allow(const std::string &host) {
+    std::lock_guard<std::mutex> lk(g_mu);
+    auto it = g_breakers.find(host);
+    if (it == g_breakers.end()) return true;
+    Breaker &b = it->second;
+    if (b.state == BREAKER_OPEN) {
+        std::chrono::duration<double, std::milli> open_for = std::chrono::steady_clock::now() - b.opened;
+        if (open_for.count() < g_policy.open_ms) return false;
+        set_state(host, b, BREAKER_HALF_OPEN);
+    }
+    if (b.state == BREAKER_HALF_OPEN) {
+        if (b.probes >= g_policy.half_open_probes) return false;
+        b.probes++;
+    }
+    return true;
+}
+
+void breaker_record(const std::string &host, bool ok) {
+    std::lock_guard<std::mutex> lk(g_mu);
+    auto now = std::chrono::steady_clock::now();
+    sweep_idle(now);
+    auto it = g_breakers.find(host);
+    if (it == g_breakers.end()) {
+        if (ok) return;
+        it = g_breakers.emplace(host, Breaker()).first;
+    }
+    Breaker &b = it->second;
+    b.used = now;
+    if (ok) {
+        b.failures = 0;
+        if (b.state != BREAKER_CLOSED) set_state(host, b, BREAKER_CLOSED);
+        return;
+    }
+    b.failures++;
+    if (b.state == BREAKER_HALF_OPEN || (b.state == BREAKER_CLOSED && b.failures >= g_policy.failure_threshold)) {
+        set_state(host, b, BREAKER_OPEN);
+    }
+}
+
+void breaker_abandon(const std::string &host) {
+    std::lock_guard<std::mutex> lk(g_mu);
+    auto it = g_breakers.find(host);
+    if (it == g_breakers.end()) return;
+    Breaker &b = it->second;
+    if (b.state == BREAKER_HALF_OPEN && b.probes > 0) b.probes--;
+}
+
+BreakerState breaker_state(const std::string &host) {
+    std::lock_guard<std::mutex> lk(g_mu);
+    auto it = g_breakers.find(host);
+    return it == g_breakers.end() ? BREAKER_CLOSED : it->second.state;
+}
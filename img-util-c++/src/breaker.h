@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+enum BreakerState {
+    BREAKER_CLOSED,
+    BREAKER_OPEN,
+    BREAKER_HALF_OPEN
+};
+
+struct BreakerPolicy {
+    int failure_threshold = 5; // consecutive failures that open the breaker
+    int open_ms = 30000;       // how long an open breaker rejects traffic
+    int half_open_probes = 1;  // concurrent trial requests once open_ms passed
+};
+
+void breaker_configure(const BreakerPolicy &p);
+
+// Whether a request to `host` may go out now. Open breakers say no; a
+// half-open one admits up to half_open_probes requests, each of which must
+// be settled with breaker_record() or breaker_abandon().
+bool breaker_allow(const std::string &host);
+void breaker_record(const std::string &host, bool ok);
+// Settles an admitted request that was cancelled without a verdict.
+void breaker_abandon(const std::string &host);
+
+BreakerState breaker_state(const std::string &host);
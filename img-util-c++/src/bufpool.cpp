@@ -0,0 +1,197 @@
+#include "bufpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+static const int MIN_SHIFT = 12; // 4 KiB
+static const int MAX_SHIFT = 26; // 64 MiB
+static const int NCLASS = MAX_SHIFT - MIN_SHIFT + 1;
+static const size_t HUGE_PAGE = size_t(2) << 20;
+
+struct SizeClass {
+    std::mutex mu;
+    std::vector<unsigned char *> idle;
+};
+
+static SizeClass g_classes[NCLASS];
+static std::atomic<size_t> g_max_cached{size_t(256) << 20};
+static std::atomic<uint64_t> g_acquires{0};
+static std::atomic<uint64_t> g_hits{0};
+static std::atomic<size_t> g_in_use{0};
+static std::atomic<size_t> g_peak{0};
+static std::atomic<size_t> g_cached{0};
+static std::atomic<uint64_t> g_copies{0};
+static std::atomic<uint64_t> g_copied_bytes{0};
+
+static int class_of(size_t n) {
+    int c = 0;
+    while (c < NCLASS && (size_t(1) << (MIN_SHIFT + c)) < n) c++;
+    return c; // NCLASS when too big to pool
+}
+
+// Block size actually allocated for a request of n bytes.
+static size_t block_size(size_t n) {
+    int c = class_of(n);
+    if (c < NCLASS) return size_t(1) << (MIN_SHIFT + c);
+    return (n + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+}
+
+static unsigned char *os_alloc(size_t n) {
+#ifdef __linux__
+    if (n >= HUGE_PAGE) {
+        // Over-map by one huge page and trim, so the block is 2 MiB aligned
+        // and khugepaged can back all of it.
+        void *raw = mmap(nullptr, n + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) throw std::bad_alloc();
+        uintptr_t base = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = (base + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1);
+        if (aligned > base) munmap(raw, aligned - base);
+        size_t tail = (base + n + HUGE_PAGE) - (aligned + n);
+        if (tail > 0) munmap(reinterpret_cast<void *>(aligned + n), tail);
+#ifdef MADV_HUGEPAGE
+        madvise(reinterpret_cast<void *>(aligned), n, MADV_HUGEPAGE);
+#endif
+        return reinterpret_cast<unsigned char *>(aligned);
+    }
+#endif
+    return static_cast<unsigned char *>(::operator new(n));
+}
+
+static void os_free(unsigned char *p, size_t n) {
+#ifdef __linux__
+    if (n >= HUGE_PAGE) {
+        munmap(p, n);
+        return;
+    }
+#endif
+    ::operator delete(p);
+}
+
+static unsigned char *pool_acquire(size_t n, size_t &cap) {
+    cap = block_size(n);
+    g_acquires.fetch_add(1, std::memory_order_relaxed);
+    size_t now = g_in_use.fetch_add(cap, std::memory_order_relaxed) + cap;
+    size_t peak = g_peak.load(std::memory_order_relaxed);
+    while (now > peak && !g_peak.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+    }
+
+    int c = class_of(n);
+    if (c < NCLASS) {
+        SizeClass &sc = g_classes[c];
+        std::lock_guard<std::mutex> lk(sc.mu);
+        if (!sc.idle.empty()) {
+            unsigned char *p = sc.idle.back();
+            sc.idle.pop_back();
+            g_cached.fetch_sub(cap, std::memory_order_relaxed);
+            g_hits.fetch_add(1, std::memory_order_relaxed);
+            return p;
+        }
+    }
+    return os_alloc(cap);
+}
+
+static void pool_release(unsigned char *p, size_t cap) {
+    g_in_use.fetch_sub(cap, std::memory_order_relaxed);
+    int c = class_of(cap);
+    if (c < NCLASS && g_cached.load(std::memory_order_relaxed) + cap <= g_max_cached.load(std::memory_order_relaxed)) {
+        SizeClass &sc = g_classes[c];
+        std::lock_guard<std::mutex> lk(sc.mu);
+        sc.idle.push_back(p);
+        g_cached.fetch_add(cap, std::memory_order_relaxed);
+        return;
+    }
+    os_free(p, cap);
+}
+
+PoolBuffer::PoolBuffer(PoolBuffer &&o) noexcept { swap(o); }
+
+PoolBuffer &PoolBuffer::operator=(PoolBuffer &&o) noexcept {
+    if (this != &o) {
+        reset();
+        swap(o);
+    }
+    return *this;
+}
+
+PoolBuffer::~PoolBuffer() { reset(); }
+
+void PoolBuffer::swap(PoolBuffer &o) noexcept {
+    std::swap(ptr_, o.ptr_);
+    std::swap(size_, o.size_);
+    std::swap(cap_, o.cap_);
+}
+
+void PoolBuffer::reset() {
+    if (ptr_) pool_release(ptr_, cap_);
+    ptr_ = nullptr;
+    size_ = 0;
+    cap_ = 0;
+}
+
+void PoolBuffer::reserve(size_t n) {
+    if (n <= cap_) return;
+    size_t cap = 0;
+    unsigned char *p = pool_acquire(n, cap);
+    if (size_ > 0) {
+        memcpy(p, ptr_, size_);
+        buffer_pool_note_copy(size_);
+    }
+    if (ptr_) pool_release(ptr_, cap_);
+    ptr_ = p;
+    cap_ = cap;
+}
+
+void PoolBuffer::resize(size_t n) {
+    reserve(n);
+    size_ = n;
+}
+
+void PoolBuffer::append(const void *p, size_t n) {
+    if (n == 0) return;
+    // Above the pooled classes blocks are exact 2 MiB multiples, so growing
+    // only to fit would copy on nearly every append of a streamed body.
+    if (size_ + n > cap_) reserve(std::max(size_ + n, cap_ * 2));
+    memcpy(ptr_ + size_, p, n);
+    size_ += n;
+}
+
+void buffer_pool_note_copy(size_t bytes) {
+    g_copies.fetch_add(1, std::memory_order_relaxed);
+    g_copied_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void buffer_pool_configure(size_t max_cached_bytes) {
+    g_max_cached.store(max_cached_bytes, std::memory_order_relaxed);
+    // Trim what is already idle down to the new limit.
+    for (int c = NCLASS - 1; c >= 0 && g_cached.load(std::memory_order_relaxed) > max_cached_bytes; c--) {
+        SizeClass &sc = g_classes[c];
+        size_t cap = size_t(1) << (MIN_SHIFT + c);
+        std::lock_guard<std::mutex> lk(sc.mu);
+        while (!sc.idle.empty() && g_cached.load(std::memory_order_relaxed) > max_cached_bytes) {
+            os_free(sc.idle.back(), cap);
+            sc.idle.pop_back();
+            g_cached.fetch_sub(cap, std::memory_order_relaxed);
+        }
+    }
+}
+
+BufferPoolStats buffer_pool_stats() {
+    BufferPoolStats s;
+    s.acquires = g_acquires.load(std::memory_order_relaxed);
+    s.hits = g_hits.load(std::memory_order_relaxed);
+    s.in_use_bytes = g_in_use.load(std::memory_order_relaxed);
+    s.peak_bytes = g_peak.load(std::memory_order_relaxed);
+    s.cached_bytes = g_cached.load(std::memory_order_relaxed);
+    s.copies = g_copies.load(std::memory_order_relaxed);
+    s.copied_bytes = g_copied_bytes.load(std::memory_order_relaxed);
+    return s;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Non-owning view of item bytes held by a PoolBuffer, a MappedFile or the
+// caller. Stages pass views around; only the owner decides the lifetime.
+struct ByteView {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+};
+
+// Growable byte buffer whose storage is borrowed from a process-wide pool of
+// power-of-two size classes (4 KiB to 64 MiB) and handed back on
+// destruction, so a long batch reuses the same few blocks instead of
+// churning the heap. Classes of 2 MiB and up are backed by transparent huge
+// pages on Linux. Move-only.
+struct PoolBuffer {
+    PoolBuffer() = default;
+    PoolBuffer(const PoolBuffer &) = delete;
+    PoolBuffer &operator=(const PoolBuffer &) = delete;
+    PoolBuffer(PoolBuffer &&o) noexcept;
+    PoolBuffer &operator=(PoolBuffer &&o) noexcept;
+    ~PoolBuffer();
+
+    unsigned char *data() { return ptr_; }
+    const unsigned char *data() const { return ptr_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return cap_; }
+    bool empty() const { return size_ == 0; }
+    ByteView view() const { return ByteView{ptr_, size_}; }
+    unsigned char &operator[](size_t i) { return ptr_[i]; }
+    const unsigned char &operator[](size_t i) const { return ptr_[i]; }
+
+    void reserve(size_t n);  // keeps the contents
+    void resize(size_t n);   // new bytes are left uninitialised
+    void append(const void *p, size_t n);
+    void clear() { size_ = 0; }
+    void reset();            // returns the block to the pool
+    void swap(PoolBuffer &o) noexcept;
+
+private:
+    unsigned char *ptr_ = nullptr;
+    size_t size_ = 0;
+    size_t cap_ = 0;
+};
+
+struct BufferPoolStats {
+    uint64_t acquires = 0;
+    uint64_t hits = 0;       // acquires served from a cached block
+    size_t in_use_bytes = 0;
+    size_t peak_bytes = 0;   // high-water mark of in_use_bytes
+    size_t cached_bytes = 0; // idle blocks kept for reuse
+    uint64_t copies = 0;     // payload moved to a second buffer in memory
+    uint64_t copied_bytes = 0;
+};
+
+// Upper bound on idle bytes kept for reuse (default 256 MiB); blocks
+// released beyond it go back to the OS.
+void buffer_pool_configure(size_t max_cached_bytes);
+BufferPoolStats buffer_pool_stats();
+
+// Counts a payload copy made outside PoolBuffer (growth copies are counted
+// by PoolBuffer itself), so the copies stat covers the whole pipeline.
+void buffer_pool_note_copy(size_t bytes);
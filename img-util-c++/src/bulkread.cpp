@@ -0,0 +1,411 @@
+#include "bulkread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mpmc.h"
+#include "util.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define IMGUTIL_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+static std::string hex_digest(Md5 &m) {
+    unsigned char dig[16];
+    m.finish(dig);
+    static const char *hex = "0123456789abcdef";
+    std::string out(32, '0');
+    for (int i = 0; i < 16; i++) {
+        out[i * 2] = hex[(dig[i] >> 4) & 0xF];
+        out[i * 2 + 1] = hex[dig[i] & 0xF];
+    }
+    return out;
+}
+
+// Fallback: a pool of threads, each reading whole files with pread (plain
+// read on Windows) into its own chunk buffer.
+static void bulk_hash_pread(const BulkHashOptions &opt,
+                            const std::function<bool(std::string &)> &next,
+                            const std::function<void(const BulkHashResult &)> &done) {
+    std::mutex next_mu;
+    bool more = true;
+    auto worker = [&]() {
+        std::vector<unsigned char> buf(opt.chunk_size);
+        for (;;) {
+            BulkHashResult r;
+            {
+                std::lock_guard<std::mutex> lk(next_mu);
+                if (!more || !next(r.path)) {
+                    more = false;
+                    return;
+                }
+            }
+#ifdef _WIN32
+            int fd = _open(r.path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+            int fd = open(r.path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+            if (fd < 0) {
+                r.error = strerror(errno);
+                done(r);
+                continue;
+            }
+            Md5 m;
+            for (;;) {
+#ifdef _WIN32
+                long n = _read(fd, buf.data(), static_cast<unsigned>(buf.size()));
+#else
+                ssize_t n = pread(fd, buf.data(), buf.size(), static_cast<off_t>(r.size));
+#endif
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) {
+                    r.error = strerror(errno);
+                    break;
+                }
+                if (n == 0) {
+                    r.ok = true;
+                    break;
+                }
+                m.update(buf.data(), static_cast<size_t>(n));
+                r.size += static_cast<uint64_t>(n);
+            }
+#ifdef _WIN32
+            _close(fd);
+#else
+            close(fd);
+#endif
+            if (r.ok) r.md5 = hex_digest(m);
+            done(r);
+        }
+    };
+    int threads = std::max(2, std::min(opt.queue_depth, 4 * std::max(1, opt.hash_threads)));
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++) pool.emplace_back(worker);
+    worker();
+    for (std::thread &t : pool) t.join();
+}
+
+#ifdef IMGUTIL_HAVE_IO_URING
+
+// Minimal io_uring driver on the raw syscalls, so there is no liburing
+// dependency: one submission and one completion ring, used from one thread.
+struct Ring {
+    int fd = -1;
+    unsigned entries = 0;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    void *sq_ptr = nullptr, *cq_ptr = nullptr;
+    size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+    unsigned local_tail = 0;
+    unsigned to_submit = 0;
+
+    bool init(unsigned n) {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, n, &p));
+        if (fd < 0) return false;
+        entries = p.sq_entries;
+        sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sq_size = cq_size = std::max(sq_size, cq_size);
+
+        sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sq_ptr == MAP_FAILED) return false;
+        cq_ptr = single ? sq_ptr
+                        : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) return false;
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        void *s = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (s == MAP_FAILED) return false;
+        sqes = static_cast<io_uring_sqe *>(s);
+
+        char *sq = static_cast<char *>(sq_ptr);
+        char *cq = static_cast<char *>(cq_ptr);
+        sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+        local_tail = *sq_tail;
+        return true;
+    }
+
+    // Closing the ring fd cancels whatever is still in flight, so buffers
+    // handed to the kernel may be freed only after this.
+    void destroy() {
+        if (sqes) munmap(sqes, sqes_size);
+        if (cq_ptr && cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        if (sq_ptr && sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+        if (fd >= 0) close(fd);
+        sqes = nullptr;
+        sq_ptr = cq_ptr = nullptr;
+        fd = -1;
+    }
+
+    ~Ring() { destroy(); }
+
+    io_uring_sqe *get_sqe() {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (local_tail - head >= entries) return nullptr;
+        unsigned idx = local_tail & *sq_mask;
+        sq_array[idx] = idx;
+        io_uring_sqe *sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        local_tail++;
+        to_submit++;
+        return sqe;
+    }
+
+    int submit_and_wait(unsigned wait_nr) {
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        int r;
+        do {
+            r = static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, IORING_ENTER_GETEVENTS, nullptr, 0));
+        } while (r < 0 && errno == EINTR);
+        if (r >= 0) to_submit -= std::min(to_submit, static_cast<unsigned>(r));
+        return r;
+    }
+
+    template <typename Fn>
+    void reap(Fn fn) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) fn(cqes[head & *cq_mask]);
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+};
+
+struct UringFile {
+    BulkHashResult r;
+    int fd = -1;
+    uint64_t size = 0;
+    int slot = -1;
+    size_t chunk = 0; // bytes of the last completed read
+    Md5 md5;
+};
+
+static const uint64_t WAKE_TAG = ~0ull;
+
+// Returns false if the ring could not be used. When that happens mid-run,
+// the files that were still being read are left in `unread` for the caller
+// to hash another way; none of them has been reported through `done`.
+static bool bulk_hash_uring(const BulkHashOptions &opt,
+                            const std::function<bool(std::string &)> &next,
+                            const std::function<void(const BulkHashResult &)> &done,
+                            std::vector<std::string> &unread) {
+    unsigned depth = static_cast<unsigned>(std::max(1, std::min(opt.queue_depth, 4096)));
+    Ring ring;
+    if (!ring.init(depth + 1)) return false;
+    int wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0) return false;
+
+    // One arena, registered as a single fixed buffer, carved into slots.
+    size_t chunk = std::max<size_t>(opt.chunk_size, 4096);
+    void *arena_ptr = mmap(nullptr, depth * chunk, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena_ptr == MAP_FAILED) {
+        close(wake_fd);
+        return false;
+    }
+    unsigned char *arena = static_cast<unsigned char *>(arena_ptr);
+    iovec whole = {arena, depth * chunk};
+    bool fixed = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &whole, 1) == 0;
+    std::vector<iovec> slot_iov(depth);
+    for (unsigned i = 0; i < depth; i++) slot_iov[i] = iovec{arena + i * chunk, chunk};
+    log_line("bulk read: io_uring, queue depth %u, %zu KiB chunks, %s buffers", depth, chunk >> 10,
+             fixed ? "registered" : "unregistered");
+
+    std::vector<int> free_slots;
+    for (unsigned i = 0; i < depth; i++) free_slots.push_back(static_cast<int>(depth - 1 - i));
+    std::vector<UringFile *> by_slot(depth, nullptr); // files still being read
+
+    // Hash stage: workers take filled slots, update the file's digest and
+    // hand the file back to the ring thread for its next chunk. At most
+    // `depth` files are open, so neither ring can fill up.
+    MpmcQueue<UringFile *> to_hash(depth);
+    MpmcQueue<UringFile *> hashed(depth);
+    auto hasher = [&]() {
+        UringFile *f;
+        while (to_hash.pop(f)) {
+            f->md5.update(arena + static_cast<size_t>(f->slot) * chunk, f->chunk);
+            hashed.push(f);
+            uint64_t one = 1;
+            (void)!write(wake_fd, &one, sizeof(one));
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 0; i < std::max(1, opt.hash_threads); i++) pool.emplace_back(hasher);
+
+    uint64_t wake_buf = 0;
+    iovec wake_iov = {&wake_buf, sizeof(wake_buf)};
+    auto arm_wake = [&]() {
+        io_uring_sqe *sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = wake_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&wake_iov);
+        sqe->len = 1;
+        sqe->user_data = WAKE_TAG;
+    };
+    auto queue_read = [&](UringFile *f) {
+        io_uring_sqe *sqe = ring.get_sqe();
+        uint64_t left = f->size - f->r.size;
+        unsigned len = static_cast<unsigned>(std::min<uint64_t>(chunk, left));
+        sqe->fd = f->fd;
+        sqe->off = f->r.size;
+        sqe->user_data = reinterpret_cast<uint64_t>(f);
+        if (fixed) {
+            sqe->opcode = IORING_OP_READ_FIXED;
+            sqe->addr = reinterpret_cast<uint64_t>(arena + static_cast<size_t>(f->slot) * chunk);
+            sqe->len = len;
+            sqe->buf_index = 0;
+        } else {
+            slot_iov[static_cast<size_t>(f->slot)].iov_len = len;
+            sqe->opcode = IORING_OP_READV;
+            sqe->addr = reinterpret_cast<uint64_t>(&slot_iov[static_cast<size_t>(f->slot)]);
+            sqe->len = 1;
+        }
+    };
+    size_t open_files = 0;
+    auto finish = [&](UringFile *f) {
+        close(f->fd);
+        if (f->r.error.empty()) {
+            f->r.ok = true;
+            f->r.md5 = hex_digest(f->md5);
+        }
+        done(f->r);
+        by_slot[static_cast<size_t>(f->slot)] = nullptr;
+        free_slots.push_back(f->slot);
+        open_files--;
+        delete f;
+    };
+
+    arm_wake();
+    bool more = true;
+    bool failed = false;
+    while (more || open_files > 0) {
+        while (more && !free_slots.empty()) {
+            std::unique_ptr<UringFile> f(new UringFile);
+            if (!next(f->r.path)) {
+                more = false;
+                break;
+            }
+            f->fd = open(f->r.path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (f->fd < 0 || fstat(f->fd, &st) != 0) {
+                f->r.error = strerror(errno);
+                if (f->fd >= 0) close(f->fd);
+                done(f->r);
+                continue;
+            }
+            f->size = static_cast<uint64_t>(st.st_size);
+            f->slot = free_slots.back();
+            free_slots.pop_back();
+            by_slot[static_cast<size_t>(f->slot)] = f.get();
+            open_files++;
+            if (f->size == 0) finish(f.release());
+            else queue_read(f.release());
+        }
+
+        UringFile *ready;
+        while (hashed.try_pop(ready)) {
+            if (ready->r.size >= ready->size) finish(ready);
+            else queue_read(ready);
+        }
+        if (!more && open_files == 0) break;
+
+        if (ring.submit_and_wait(1) < 0) {
+            log_line("bulk read: io_uring_enter failed: %s", strerror(errno));
+            failed = true;
+            break;
+        }
+        bool rearm = false;
+        ring.reap([&](const io_uring_cqe &cqe) {
+            if (cqe.user_data == WAKE_TAG) {
+                rearm = true;
+                return;
+            }
+            auto *f = reinterpret_cast<UringFile *>(cqe.user_data);
+            if (cqe.res <= 0) {
+                // Error, or the file shrank under us: report what we have.
+                if (cqe.res < 0) f->r.error = strerror(-cqe.res);
+                else f->size = f->r.size;
+                hashed.push(f);
+                return;
+            }
+            f->chunk = static_cast<size_t>(cqe.res);
+            f->r.size += f->chunk;
+            to_hash.push(f);
+        });
+        if (rearm) arm_wake();
+    }
+
+    to_hash.close();
+    for (std::thread &t : pool) t.join();
+    // The wake read, and after a failure any file reads, are still in
+    // flight; the ring has to go before the buffers they point into.
+    if (fixed) syscall(__NR_io_uring_register, ring.fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+    ring.destroy();
+    close(wake_fd);
+    munmap(arena_ptr, depth * chunk);
+    for (UringFile *f : by_slot) {
+        if (!f) continue;
+        close(f->fd);
+        unread.push_back(std::move(f->r.path));
+        delete f;
+    }
+    return !failed;
+}
+
+#endif
+
+void bulk_hash_files(const BulkHashOptions &opt,
+                     const std::function<bool(std::string &)> &next,
+                     const std::function<void(const BulkHashResult &)> &done) {
+#ifdef IMGUTIL_HAVE_IO_URING
+    // `next` is not asked again once it has said there is nothing more.
+    bool ended = false;
+    auto until_end = [&](std::string &path) {
+        if (ended) return false;
+        ended = !next(path);
+        return !ended;
+    };
+    std::vector<std::string> unread;
+    if (opt.use_io_uring && bulk_hash_uring(opt, until_end, done, unread)) return;
+    if (opt.use_io_uring) log_line("bulk read: io_uring unavailable, using pread threads");
+    // Files the ring gave up on go first, then whatever `next` has left.
+    auto resume = [&](std::string &path) {
+        if (unread.empty()) return until_end(path);
+        path = std::move(unread.back());
+        unread.pop_back();
+        return true;
+    };
+    bulk_hash_pread(opt, resume, done);
+#else
+    bulk_hash_pread(opt, next, done);
+#endif
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+struct BulkHashOptions {
+    int queue_depth = 128;            // files in flight
+    size_t chunk_size = 256u << 10;   // bytes per read; one registered buffer each
+    int hash_threads = 2;
+    bool use_io_uring = true;         // false forces the pread pool
+};
+
+struct BulkHashResult {
+    std::string path;
+    bool ok = false;
+    std::string md5; // hex
+    uint64_t size = 0;
+    std::string error;
+};
+
+// Reads every local file that `next` yields (until it returns false) and
+// reports its MD5 through `done`, which is called from several threads.
+// On Linux the reads go through io_uring with registered buffers and
+// `queue_depth` files in flight, and each completed chunk is handed straight
+// to a pool of `hash_threads` hashers. Where io_uring is unavailable a thread
+// pool reads with pread instead.
+void bulk_hash_files(const BulkHashOptions &opt,
+                     const std::function<bool(std::string &)> &next,
+                     const std::function<void(const BulkHashResult &)> &done);
@@ -0,0 +1,778 @@
+#include "coro.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "breaker.h"
+#include "hosts.h"
+#include "mapped.h"
+#include "metrics.h"
+#include "qiniu.h"
+#include "retry.h"
+#include "shaper.h"
+#include "trace.h"
+#include "util.h"
+#include "webp.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct EventLoop;
+struct CurlWait;
+thread_local EventLoop *t_loop = nullptr;
+
+// One thread, one epoll set, one curl multi handle. curl says which sockets
+// and which timeout to watch; other threads hand work over through post().
+struct EventLoop {
+    AsyncUploader::Impl *owner = nullptr;
+    int ep = -1;
+    int wake = -1;
+    CURLM *multi = nullptr;
+    std::thread th;
+
+    std::mutex mu;
+    std::vector<std::function<void()>> posted;
+
+    // Touched by the loop thread only.
+    bool stopping = false;
+    bool timer_armed = false;
+    Clock::time_point timer_at;
+    std::multimap<Clock::time_point, std::coroutine_handle<>> sleepers;
+    std::vector<CurlWait *> paced; // uploads whose body may pause itself
+
+    bool start(AsyncUploader::Impl *o, long max_connections);
+    void post(std::function<void()> fn);
+    void stop();
+    void run();
+    void run_posted();
+    void finish_transfers();
+    Clock::time_point next_resume();
+    void resume_paced(Clock::time_point now);
+};
+
+int on_socket(CURL *, curl_socket_t s, int what, void *userp, void *socketp) {
+    auto *l = static_cast<EventLoop *>(userp);
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(l->ep, EPOLL_CTL_DEL, s, nullptr);
+        return 0;
+    }
+    epoll_event ev{};
+    if (what & CURL_POLL_IN) ev.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+    ev.data.fd = s;
+    if (socketp) {
+        epoll_ctl(l->ep, EPOLL_CTL_MOD, s, &ev);
+    } else {
+        if (epoll_ctl(l->ep, EPOLL_CTL_ADD, s, &ev) != 0) epoll_ctl(l->ep, EPOLL_CTL_MOD, s, &ev);
+        curl_multi_assign(l->multi, s, l); // any non-null marks the socket as known
+    }
+    return 0;
+}
+
+int on_timer(CURLM *, long timeout_ms, void *userp) {
+    auto *l = static_cast<EventLoop *>(userp);
+    l->timer_armed = timeout_ms >= 0;
+    if (l->timer_armed) l->timer_at = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    return 0;
+}
+
+bool EventLoop::start(AsyncUploader::Impl *o, long max_connections) {
+    owner = o;
+    ep = epoll_create1(EPOLL_CLOEXEC);
+    wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    multi = curl_multi_init();
+    if (ep < 0 || wake < 0 || !multi) return false;
+
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wake;
+    epoll_ctl(ep, EPOLL_CTL_ADD, wake, &ev);
+
+    curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, on_socket);
+    curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, on_timer);
+    curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+    http_multiplex_setup(multi);
+    if (max_connections > 0) curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, max_connections);
+    th = std::thread([this] { run(); });
+    return true;
+}
+
+void EventLoop::post(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        posted.push_back(std::move(fn));
+    }
+    uint64_t one = 1;
+    if (write(wake, &one, sizeof(one)) < 0) {
+        // Counter saturated: the loop is already due to wake up.
+    }
+}
+
+void EventLoop::stop() {
+    if (th.joinable()) {
+        post([this] { stopping = true; });
+        th.join();
+    }
+    if (multi) curl_multi_cleanup(multi);
+    if (wake >= 0) close(wake);
+    if (ep >= 0) close(ep);
+    multi = nullptr;
+    wake = ep = -1;
+}
+
+void EventLoop::run_posted() {
+    std::vector<std::function<void()>> batch;
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        batch.swap(posted);
+    }
+    for (auto &fn : batch) fn();
+}
+
+void EventLoop::run() {
+    t_loop = this;
+    epoll_event evs[64];
+    int running = 0;
+    while (!stopping) {
+        int timeout = -1;
+        auto now = Clock::now();
+        auto until = [&](Clock::time_point at) {
+            auto ms = std::chrono::ceil<std::chrono::milliseconds>(at - now).count();
+            int t = static_cast<int>(std::max<long long>(0, ms));
+            if (timeout < 0 || t < timeout) timeout = t;
+        };
+        if (timer_armed) until(timer_at);
+        if (!sleepers.empty()) until(sleepers.begin()->first);
+        if (!paced.empty()) {
+            Clock::time_point due = next_resume();
+            if (due != Clock::time_point::max()) until(due);
+        }
+
+        int n = epoll_wait(ep, evs, 64, timeout);
+        for (int i = 0; i < n; i++) {
+            int fd = evs[i].data.fd;
+            if (fd == wake) {
+                uint64_t v;
+                if (read(wake, &v, sizeof(v)) < 0) {
+                    // Nothing pending; another wake-up drained it.
+                }
+                continue;
+            }
+            int flags = 0;
+            if (evs[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+            if (evs[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+            if (evs[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+            curl_multi_socket_action(multi, fd, flags, &running);
+        }
+
+        now = Clock::now();
+        if (timer_armed && now >= timer_at) {
+            timer_armed = false;
+            curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+        resume_paced(now);
+        finish_transfers();
+        while (!sleepers.empty() && sleepers.begin()->first <= now) {
+            std::coroutine_handle<> h = sleepers.begin()->second;
+            sleepers.erase(sleepers.begin());
+            h.resume();
+        }
+        run_posted();
+    }
+    t_loop = nullptr;
+}
+
+// Awaits one transfer on the current loop's multi handle. A paced upload
+// passes its body, so the loop can resume it when its pause is over.
+struct CurlWait {
+    CURL *curl;
+    BodyReader *body = nullptr;
+    CURLcode rc = CURLE_OK;
+    std::coroutine_handle<> h = nullptr;
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> c) {
+        h = c;
+        // The process-wide share would keep the connection cache outside
+        // this multi handle, where its socket callbacks cannot see it.
+        curl_easy_setopt(curl, CURLOPT_SHARE, nullptr);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, this);
+        if (curl_multi_add_handle(t_loop->multi, curl) != CURLM_OK) {
+            rc = CURLE_FAILED_INIT;
+            return false;
+        }
+        if (body && body->paced) t_loop->paced.push_back(this);
+        return true;
+    }
+    CURLcode await_resume() { return rc; }
+};
+
+Clock::time_point EventLoop::next_resume() {
+    Clock::time_point due = Clock::time_point::max();
+    for (CurlWait *w : paced) {
+        if (w->body->paused) due = std::min(due, w->body->resume_at);
+    }
+    return due;
+}
+
+void EventLoop::resume_paced(Clock::time_point now) {
+    for (CurlWait *w : paced) {
+        if (!w->body->paused || w->body->resume_at > now) continue;
+        w->body->paused = false;
+        curl_easy_pause(w->curl, CURLPAUSE_CONT);
+    }
+}
+
+void EventLoop::finish_transfers() {
+    int left = 0;
+    while (CURLMsg *m = curl_multi_info_read(multi, &left)) {
+        if (m->msg != CURLMSG_DONE) continue;
+        CURL *curl = m->easy_handle;
+        CURLcode rc = m->data.result;
+        CurlWait *w = nullptr;
+        curl_easy_getinfo(curl, CURLINFO_PRIVATE, &w);
+        curl_multi_remove_handle(multi, curl);
+        if (!w) continue;
+        paced.erase(std::remove(paced.begin(), paced.end(), w), paced.end());
+        w->rc = rc;
+        w->h.resume();
+    }
+}
+
+// Backoff between attempts without holding the loop.
+struct Sleep {
+    long ms;
+
+    bool await_ready() { return ms <= 0; }
+    void await_suspend(std::coroutine_handle<> h) {
+        t_loop->sleepers.emplace(Clock::now() + std::chrono::milliseconds(ms), h);
+    }
+    void await_resume() {}
+};
+
+// A slot from the upload concurrency limiter; a coroutine that has to wait
+// for one is resumed on its own loop by whichever upload frees it.
+struct AcquireSlot {
+    ConcurrencyLimiter &limiter;
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        EventLoop *l = t_loop;
+        return !limiter.acquire_async([l, h] { l->post([h] { h.resume(); }); });
+    }
+    void await_resume() {}
+};
+
+// Reading, webp and hashing block or burn CPU, so they run here and the
+// loops keep servicing sockets.
+struct CpuPool {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> q;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    void start(size_t n) {
+        for (size_t i = 0; i < n; i++) threads.emplace_back([this] { worker(); });
+    }
+    void post(std::function<void()> fn) {
+        std::lock_guard<std::mutex> lk(mu);
+        q.push_back(std::move(fn));
+        cv.notify_one();
+    }
+    void worker() {
+        for (;;) {
+            std::function<void()> fn;
+            {
+                std::unique_lock<std::mutex> lk(mu);
+                cv.wait(lk, [&] { return stopping || !q.empty(); });
+                if (q.empty()) return;
+                fn = std::move(q.front());
+                q.pop_front();
+            }
+            fn();
+        }
+    }
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (std::thread &t : threads) t.join();
+        threads.clear();
+    }
+};
+
+// Single flight for the token and the host table: the first caller that
+// finds the value missing fetches it; the others park and are resumed on
+// their own loops once it lands.
+struct Flight {
+    std::mutex mu;
+    bool busy = false;
+    std::vector<std::pair<EventLoop *, std::coroutine_handle<>>> waiters;
+
+    void finish() {
+        std::vector<std::pair<EventLoop *, std::coroutine_handle<>>> w;
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            busy = false;
+            w.swap(waiters);
+        }
+        for (auto &p : w) {
+            std::coroutine_handle<> h = p.second;
+            p.first->post([h] { h.resume(); });
+        }
+    }
+};
+
+// Yields true to the caller that must fetch (and then call finish()).
+// Awaiters here take callables by reference: GCC 12 destroys non-trivial
+// temporaries inside a co_await operand twice.
+struct JoinFlight {
+    Flight &f;
+    const std::function<bool()> &fresh;
+    bool lead = false;
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        std::lock_guard<std::mutex> lk(f.mu);
+        if (fresh()) return false;
+        if (!f.busy) {
+            f.busy = true;
+            lead = true;
+            return false;
+        }
+        f.waiters.emplace_back(t_loop, h);
+        return true;
+    }
+    bool await_resume() { return lead; }
+};
+
+// Fire-and-forget coroutine for submit().
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+// Bytes of one item, as in the threaded pipeline: a mapped file or a pooled
+// buffer, read through `view`.
+struct AsyncItem {
+    MappedFile file;
+    PoolBuffer heap;
+    ByteView view;
+};
+
+} // namespace
+
+struct AsyncUploader::Impl {
+    AsyncUploader *owner = nullptr;
+    Uploader base; // config, token, host table and dedup map
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    std::atomic<size_t> next_loop{0};
+    CpuPool cpu;
+    Flight token_flight;
+    Flight hosts_flight;
+
+    std::mutex mu;
+    std::condition_variable idle_cv;
+    size_t pending = 0;
+
+    EventLoop *pick() { return loops[next_loop.fetch_add(1, std::memory_order_relaxed) % loops.size()].get(); }
+
+    Task<HttpResult> get(std::string url, std::vector<std::string> headers, PoolBuffer *pool = nullptr);
+    Task<UploadResult> send(AsyncItem &item, std::string name, std::string content_type, UploadResult r,
+                            Clock::time_point t0);
+};
+
+namespace {
+
+// Moves the awaiting coroutine onto one of `impl`'s loops, unless it is
+// already running on one.
+struct EnterLoop {
+    AsyncUploader::Impl *impl;
+
+    bool await_ready() { return t_loop && t_loop->owner == impl; }
+    void await_suspend(std::coroutine_handle<> h) {
+        impl->pick()->post([h] { h.resume(); });
+    }
+    void await_resume() {}
+};
+
+// Runs `fn` on the CPU pool, then resumes on the loop that awaited it.
+struct OnCpu {
+    AsyncUploader::Impl *impl;
+    const std::function<void()> &fn;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        EventLoop *l = t_loop;
+        impl->cpu.post([this, l, h] {
+            fn();
+            l->post([h] { h.resume(); });
+        });
+    }
+    void await_resume() {}
+};
+
+Detached run_detached(AsyncUploader *u, AsyncUploader::Impl *impl, std::string input, UploadCallback done) {
+    UploadResult r = co_await u->upload(std::move(input));
+    if (done) done(r);
+    std::lock_guard<std::mutex> lk(impl->mu);
+    if (--impl->pending == 0) impl->idle_cv.notify_all();
+}
+
+} // namespace
+
+// GET under the engine's retry policy and the host's circuit breaker.
+Task<HttpResult> AsyncUploader::Impl::get(std::string url, std::vector<std::string> headers, PoolBuffer *pool) {
+    HttpResult out;
+    HttpGetXfer x;
+    if (!http_get_setup(x, url, headers, pool)) co_return out;
+    std::string host = url_host(url);
+    retry_note_request();
+
+    CURLcode rc = CURLE_OK;
+    for (int attempt = 1;; attempt++) {
+        http_get_reset(x);
+        out.status = 0;
+        if (!breaker_allow(host)) {
+            rc = CURLE_COULDNT_CONNECT;
+            break;
+        }
+        uint64_t t0 = trace_now_us();
+        rc = co_await CurlWait{x.curl};
+        curl_easy_getinfo(x.curl, CURLINFO_RESPONSE_CODE, &out.status);
+        trace_curl_parts(x.curl, t0);
+        metrics_http_status(rc == CURLE_OK ? out.status : 0);
+        breaker_record(host, retry_classify(rc, out.status) != RETRY_TRANSIENT);
+        long delay = 0;
+        if (!retry_decide(attempt, rc, out.status, x.retry_after, delay)) break;
+        co_await Sleep{delay};
+    }
+    out.ok = rc == CURLE_OK && out.status >= 200 && out.status < 300;
+    out.body.swap(x.resp.data);
+    co_return out;
+}
+
+AsyncUploader::AsyncUploader() : impl_(new Impl) { impl_->owner = this; }
+
+AsyncUploader::~AsyncUploader() { close(); }
+
+bool AsyncUploader::open(const std::string &config_text, std::string &error, int loops) {
+    if (!impl_->base.open(config_text, error)) return false;
+    long max_connections = json_get_int(config_text, "async_max_connections", 0);
+    for (int i = 0; i < std::max(1, loops); i++) {
+        std::unique_ptr<EventLoop> l(new EventLoop);
+        if (!l->start(impl_.get(), max_connections)) {
+            l->stop();
+            error = "could not start event loop";
+            close();
+            return false;
+        }
+        impl_->loops.push_back(std::move(l));
+    }
+    impl_->cpu.start(std::max(1u, std::thread::hardware_concurrency()));
+    return true;
+}
+
+Task<std::string> AsyncUploader::token() {
+    co_await EnterLoop{impl_.get()};
+    UploadContext &ctx = context();
+    std::function<bool()> fresh = [&ctx] {
+        std::lock_guard<std::mutex> lk(ctx.mu);
+        bool stale = ctx.token_ttl_sec > 0 && Clock::now() - ctx.utoken_at > std::chrono::seconds(ctx.token_ttl_sec);
+        return !ctx.utoken.empty() && !stale;
+    };
+    if (co_await JoinFlight{impl_->token_flight, fresh}) {
+        PhaseTimer t(PHASE_TOKEN);
+        std::vector<std::string> hdrs;
+        hdrs.push_back("token: " + ctx.user_token);
+        hdrs.push_back("Content-Type: application/json");
+        HttpResult r = co_await impl_->get(ctx.qiniu_token_url, std::move(hdrs));
+        std::string tok = r.ok ? parse_qiniu_token(r.body) : "";
+        {
+            std::lock_guard<std::mutex> lk(ctx.mu);
+            ctx.utoken = tok;
+            ctx.utoken_at = Clock::now();
+        }
+        impl_->token_flight.finish();
+    }
+    std::string tok;
+    {
+        std::lock_guard<std::mutex> lk(ctx.mu);
+        tok = ctx.utoken;
+    }
+    co_return tok;
+}
+
+Task<bool> AsyncUploader::query_hosts() {
+    co_await EnterLoop{impl_.get()};
+    UploadContext &ctx = context();
+    std::string tok = co_await token();
+    if (tok.empty()) co_return false;
+    std::function<bool()> loaded = [&ctx] {
+        std::lock_guard<std::mutex> lk(ctx.mu);
+        return ctx.hosts_loaded;
+    };
+    if (co_await JoinFlight{impl_->hosts_flight, loaded}) {
+        PhaseTimer t(PHASE_QUERY);
+        HttpResult r = co_await impl_->get(upload_hosts_url(ctx.qiniu_query_url, tok, ctx.bucket), {});
+        std::vector<std::string> hosts;
+        if (r.ok) hosts = parse_upload_hosts(r.body);
+        if (std::find(hosts.begin(), hosts.end(), DEFAULT_UPLOAD_HOST) == hosts.end()) {
+            hosts.push_back(DEFAULT_UPLOAD_HOST);
+        }
+        ctx.hosts.assign(hosts);
+        {
+            std::lock_guard<std::mutex> lk(ctx.mu);
+            ctx.hosts_loaded = true;
+        }
+        impl_->hosts_flight.finish();
+    }
+    co_return true;
+}
+
+Task<DownloadResult> AsyncUploader::download(std::string url) {
+    co_await EnterLoop{impl_.get()};
+    DownloadResult d;
+    PhaseTimer t(PHASE_DOWNLOAD);
+    HttpResult r = co_await impl_->get(std::move(url), {}, &d.body);
+    d.ok = r.ok;
+    d.status = r.status;
+    co_return d;
+}
+
+// Unlike upload_once() there is no hedging: a slow host is left to the
+// connect timeout and the retry policy. Like it, the upload holds a slot
+// of the concurrency limiter for all its attempts, and is held to the
+// request and byte rates, by sleeping and by pausing its body, so the
+// loop's other transfers keep going.
+Task<HttpResult> AsyncUploader::put(std::string upload_token, std::string key, ByteView body, std::string mime_type) {
+    co_await EnterLoop{impl_.get()};
+    UploadContext &ctx = context();
+    HttpResult out;
+    CURLcode rc = CURLE_OK;
+    bool overload = false;
+    retry_note_request();
+    co_await AcquireSlot{ctx.limiter};
+    auto t0 = Clock::now();
+
+    for (int attempt = 1;; attempt++) {
+        rc = CURLE_COULDNT_CONNECT;
+        long retry_after = -1;
+        out.status = 0;
+        out.body = "all upload hosts unavailable (circuit open)";
+        bool tried = false;
+        for (const std::string &host : ctx.hosts.ranked()) {
+            if (!breaker_allow(host)) continue;
+            UploadXfer x;
+            x.host = host;
+            if (!upload_xfer_setup(x, ctx.target.scheme + "://" + host, upload_token, key, body, mime_type,
+                                   SHAPE_PACED)) {
+                breaker_abandon(host);
+                continue;
+            }
+            tried = true;
+            co_await Sleep{static_cast<long>(std::ceil(shaper_request_wait() * 1000))};
+            x.t0 = trace_now_us();
+            rc = co_await CurlWait{x.curl, &x.body};
+            curl_easy_getinfo(x.curl, CURLINFO_RESPONSE_CODE, &x.status);
+            trace_curl_parts(x.curl, x.t0);
+            metrics_http_status(rc == CURLE_OK ? x.status : 0);
+            long conns = 0;
+            curl_easy_getinfo(x.curl, CURLINFO_NUM_CONNECTS, &conns);
+            metrics().upload_connections.fetch_add(static_cast<uint64_t>(conns), std::memory_order_relaxed);
+
+            curl_off_t conn_us = 0;
+            curl_easy_getinfo(x.curl, CURLINFO_CONNECT_TIME_T, &conn_us);
+            bool other_region = upload_no_such_domain(x);
+            bool transient = retry_classify(rc, x.status) == RETRY_TRANSIENT;
+            overload = overload || transient;
+            bool host_ok = !transient && !other_region;
+            ctx.hosts.record(host, host_ok, conn_us > 0 ? static_cast<double>(conn_us) / 1000.0 : -1);
+            breaker_record(host, host_ok);
+
+            out.status = x.status;
+            out.body.swap(x.resp.data);
+            retry_after = x.retry_after;
+            if (!other_region) break;
+        }
+        if (!tried) break;
+        long delay = 0;
+        if (!retry_decide(attempt, rc, out.status, retry_after, delay)) break;
+        co_await Sleep{delay};
+    }
+    // Latency per 256 KiB, as in the threaded pipeline.
+    std::chrono::duration<double, std::milli> ms = Clock::now() - t0;
+    double units = std::max(1.0, static_cast<double>(body.size) / (256.0 * 1024.0));
+    ctx.limiter.release(ms.count() / units, overload);
+    out.ok = rc == CURLE_OK;
+    co_return out;
+}
+
+Task<UploadResult> AsyncUploader::upload(std::string input) {
+    co_await EnterLoop{impl_.get()};
+    auto t0 = Clock::now();
+    UploadResult r;
+    normalize_input_inplace(input);
+    r.input = input;
+
+    AsyncItem item;
+    std::string content_type;
+    if (input.empty()) {
+        r.error = "empty input";
+    } else if (input.rfind("http://", 0) == 0 || input.rfind("https://", 0) == 0) {
+        DownloadResult d = co_await download(input);
+        if (d.ok) {
+            item.heap = std::move(d.body);
+            item.view = item.heap.view();
+        } else {
+            r.error = "download failed";
+        }
+    } else {
+        bool opened = false;
+        std::function<void()> read = [&] {
+            PhaseTimer t(PHASE_READ);
+            opened = item.file.open(input, context().map_files);
+        };
+        co_await OnCpu{impl_.get(), read};
+        if (opened) {
+            item.view = item.file.view();
+            content_type = "application/octet-stream";
+        } else {
+            r.error = "could not read file";
+        }
+    }
+    if (!r.error.empty()) {
+        metrics().items_failed.fetch_add(1, std::memory_order_relaxed);
+        r.latency_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+        co_return r;
+    }
+    co_return co_await impl_->send(item, basename_from_path_or_url(input), content_type, std::move(r), t0);
+}
+
+Task<UploadResult> AsyncUploader::upload_bytes(PoolBuffer bytes, std::string name, std::string content_type) {
+    co_await EnterLoop{impl_.get()};
+    auto t0 = Clock::now();
+    UploadResult r;
+    r.input = name;
+    AsyncItem item;
+    item.heap = std::move(bytes);
+    item.view = item.heap.view();
+    co_return co_await impl_->send(item, std::move(name), std::move(content_type), std::move(r), t0);
+}
+
+// Encode, hash, dedup and upload; the tail shared by upload() and
+// upload_bytes(), mirroring the threaded pipeline's send_item().
+Task<UploadResult> AsyncUploader::Impl::send(AsyncItem &item,
+                                             std::string name,
+                                             std::string content_type,
+                                             UploadResult r,
+                                             Clock::time_point t0) {
+    UploadContext &ctx = base.context();
+    std::string mime_type;
+    std::function<void()> encode_and_hash = [&] {
+        std::string ext;
+        if (ctx.enable_webp) {
+            PhaseTimer t(PHASE_ENCODE);
+            PoolBuffer wb;
+            int q = (ctx.webp_quality <= 0 || ctx.webp_quality > 100) ? 95 : ctx.webp_quality;
+            if (!run_cwebp(item.view, q, wb)) {
+                r.error = "cwebp failed (install cwebp or set enable_webp=false)";
+                return;
+            }
+            if (wb.size() < item.view.size) {
+                metrics().webp_bytes_saved.fetch_add(item.view.size - wb.size(),
+                                                     std::memory_order_relaxed);
+            }
+            item.heap.swap(wb);
+            item.file.close();
+            item.view = item.heap.view();
+            mime_type = "image/webp";
+            ext = "webp";
+        } else {
+            mime_type = content_type.empty() ? "application/octet-stream" : content_type;
+        }
+        PhaseTimer t(PHASE_HASH);
+        std::string md5v = md5_hex(item.view.data, item.view.size);
+        r.key = ext.empty() ? object_key(md5v, name) : md5v + "." + ext;
+        r.bytes = item.view.size;
+    };
+    co_await OnCpu{this, encode_and_hash};
+
+    bool done = !r.error.empty();
+    if (!done && dedup_hit(ctx, r.key, r.response)) r.ok = done = true;
+
+    std::string utoken;
+    if (!done) {
+        utoken = co_await owner->token();
+        if (utoken.empty()) {
+            r.error = "qiniu-token failed";
+            done = true;
+        }
+    }
+    if (!done) co_await owner->query_hosts();
+
+    if (!done) {
+        HttpResult h;
+        {
+            PhaseTimer t(PHASE_UPLOAD);
+            h = co_await owner->put(utoken, r.key, item.view, mime_type);
+        }
+        r.ok = upload_outcome(ctx, utoken, r.key, item.view.size, h.ok, h.status, h.body, r.error);
+        if (r.ok) r.response = std::move(h.body);
+    }
+
+    if (r.ok) metrics().items_ok.fetch_add(1, std::memory_order_relaxed);
+    else metrics().items_failed.fetch_add(1, std::memory_order_relaxed);
+    r.latency_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    co_return r;
+}
+
+void AsyncUploader::submit(const std::string &input, UploadCallback done) {
+    {
+        std::lock_guard<std::mutex> lk(impl_->mu);
+        impl_->pending++;
+    }
+    run_detached(this, impl_.get(), input, std::move(done));
+}
+
+void AsyncUploader::wait() {
+    std::unique_lock<std::mutex> lk(impl_->mu);
+    impl_->idle_cv.wait(lk, [&] { return impl_->pending == 0; });
+}
+
+void AsyncUploader::close() {
+    if (!impl_) return;
+    wait();
+    for (auto &l : impl_->loops) l->stop();
+    impl_->loops.clear();
+    impl_->cpu.stop();
+    impl_->base.close();
+}
+
+UploadContext &AsyncUploader::context() { return impl_->base.context(); }
@@ -0,0 +1,116 @@
+#pragma once
+
+// C++20 coroutine front-end to the upload engine. Uploads are coroutines
+// that run on a few event-loop threads, each driving a curl multi handle
+// through its socket API with epoll, so thousands of uploads can be in
+// flight without a thread each. Linux only; built as imgutil-coro.
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "bufpool.h"
+#include "uploader.h"
+
+// A lazily started coroutine producing a T. Awaiting it starts it; when it
+// finishes it resumes the awaiter directly.
+template <typename T>
+class Task {
+public:
+    struct promise_type {
+        std::optional<T> value;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                std::coroutine_handle<> c = h.promise().continuation;
+                if (c) return c;
+                return std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        FinalAwaiter final_suspend() noexcept { return {}; }
+
+        void return_value(T v) { value = std::move(v); }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    Task(Task &&o) noexcept : h_(std::exchange(o.h_, nullptr)) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() {
+        if (h_) h_.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        h_.promise().continuation = awaiting;
+        return h_;
+    }
+    T await_resume() { return std::move(*h_.promise().value); }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) : h_(h) {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+struct HttpResult {
+    bool ok = false; // transfer completed with a 2xx status
+    long status = 0;
+    std::string body;
+};
+
+struct DownloadResult {
+    bool ok = false;
+    long status = 0;
+    PoolBuffer body;
+};
+
+// Every awaitable hops onto one of the uploader's loop threads first, so
+// callers may await from any thread; the awaiter is resumed on a loop
+// thread and should not block it.
+struct AsyncUploader {
+    AsyncUploader();
+    AsyncUploader(const AsyncUploader &) = delete;
+    AsyncUploader &operator=(const AsyncUploader &) = delete;
+    ~AsyncUploader(); // close()
+
+    // Same config as Uploader::open(); `loops` event-loop threads share the
+    // transfers round-robin.
+    bool open(const std::string &config_text, std::string &error, int loops = 1);
+
+    // A local path or http(s) URL, read, hashed, deduplicated and uploaded.
+    Task<UploadResult> upload(std::string input);
+    // Bytes already in memory; `name` only supplies the key's extension.
+    Task<UploadResult> upload_bytes(PoolBuffer bytes, std::string name, std::string content_type);
+
+    // The cached upload token, fetched once for all concurrent callers; ""
+    // on failure.
+    Task<std::string> token();
+    // Loads the ranked upload host table once; false without a token.
+    Task<bool> query_hosts();
+    Task<DownloadResult> download(std::string url);
+    // One object to the best upload host, moving on from hosts that do not
+    // serve the bucket and retrying transient failures with backoff.
+    Task<HttpResult> put(std::string upload_token, std::string key, ByteView body, std::string mime_type);
+
+    // Callback style for callers without a coroutine of their own: `done`
+    // runs on a loop thread.
+    void submit(const std::string &input, UploadCallback done);
+    void wait();  // until every submit() has called back
+    void close(); // wait(), then stop the loops; awaited uploads must be done
+
+    UploadContext &context();
+
+    struct Impl;
+
+private:
+    std::unique_ptr<Impl> impl_;
+};
@@ -0,0 +1,216 @@
+#include "executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "metrics.h"
+
+struct Executor::Impl {
+    struct Worker {
+        std::mutex mu;
+        std::deque<std::function<void()>> q;
+    };
+
+    std::string name;
+    size_t capacity = 1;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    // Counters and sleeping; each deque has its own lock so pushes, pops and
+    // steals on different workers do not contend.
+    mutable std::mutex mu;
+    std::condition_variable work_cv;  // available > 0 or stopping
+    std::condition_variable space_cv; // queued < capacity
+    std::condition_variable idle_cv;  // queued == 0 && running == 0
+    size_t queued = 0;    // accepted by submit(), not yet started
+    size_t available = 0; // pushed onto a deque, not yet claimed by a worker
+    size_t running = 0;
+    size_t peak = 0;
+    bool stopping = false;
+
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> executed{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> waits{0};
+
+    std::function<void()> take(size_t self);
+    void run(size_t self);
+};
+
+// Which executor and worker the current thread belongs to, if any.
+static thread_local const void *t_exec = nullptr;
+static thread_local size_t t_worker = 0;
+
+static std::mutex g_live_mu;
+static std::vector<Executor *> g_live;
+// Final stats of destroyed executors, so their counters do not vanish from
+// the metrics written at the end of a run.
+static std::vector<ExecutorStats> g_retired;
+
+static std::string render_executors() {
+    std::vector<ExecutorStats> all = executor_stats();
+    if (all.empty()) return "";
+    std::ostringstream os;
+    auto family = [&](const char *name, const char *type, const char *help, auto value) {
+        os << "# HELP " << name << " " << help << "\n";
+        os << "# TYPE " << name << " " << type << "\n";
+        for (const ExecutorStats &s : all) os << name << "{executor=\"" << s.name << "\"} " << value(s) << "\n";
+    };
+    family("imgutil_executor_threads", "gauge", "Worker threads per executor.",
+           [](const ExecutorStats &s) { return s.threads; });
+    family("imgutil_executor_queue_depth", "gauge", "Tasks queued and not yet started.",
+           [](const ExecutorStats &s) { return s.queued; });
+    family("imgutil_executor_queue_depth_peak", "gauge", "Highest queue depth seen.",
+           [](const ExecutorStats &s) { return s.peak_queued; });
+    family("imgutil_executor_tasks_total", "counter", "Tasks run.", [](const ExecutorStats &s) { return s.executed; });
+    family("imgutil_executor_steals_total", "counter", "Tasks taken from another worker's deque.",
+           [](const ExecutorStats &s) { return s.steals; });
+    family("imgutil_executor_backpressure_waits_total", "counter", "Submits that waited for queue room.",
+           [](const ExecutorStats &s) { return s.backpressure_waits; });
+    return os.str();
+}
+
+std::function<void()> Executor::Impl::take(size_t self) {
+    std::function<void()> fn;
+    {
+        Worker &w = *workers[self];
+        std::lock_guard<std::mutex> lk(w.mu);
+        if (!w.q.empty()) {
+            fn = std::move(w.q.back());
+            w.q.pop_back();
+            return fn;
+        }
+    }
+    for (size_t k = 1; k < workers.size(); k++) {
+        Worker &v = *workers[(self + k) % workers.size()];
+        std::lock_guard<std::mutex> lk(v.mu);
+        if (v.q.empty()) continue;
+        fn = std::move(v.q.front());
+        v.q.pop_front();
+        steals.fetch_add(1, std::memory_order_relaxed);
+        return fn;
+    }
+    return fn;
+}
+
+void Executor::Impl::run(size_t self) {
+    t_exec = this;
+    t_worker = self;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lk(mu);
+            work_cv.wait(lk, [&] { return stopping || available > 0; });
+            if (available == 0) break;
+            available--;
+        }
+        // The claim above guarantees a task is on some deque; a scan can
+        // still miss it while another worker is mid-steal, so rescan.
+        std::function<void()> fn;
+        while (!(fn = take(self))) std::this_thread::yield();
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            queued--;
+            running++;
+        }
+        space_cv.notify_one();
+        fn();
+        executed.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(mu);
+        running--;
+        if (queued == 0 && running == 0) idle_cv.notify_all();
+    }
+    t_exec = nullptr;
+}
+
+Executor::Executor(const std::string &name, size_t threads, size_t capacity) : impl_(new Impl) {
+    impl_->name = name;
+    threads = std::max<size_t>(1, threads);
+    impl_->capacity = std::max<size_t>(1, capacity);
+    for (size_t i = 0; i < threads; i++) impl_->workers.emplace_back(new Impl::Worker);
+    for (size_t i = 0; i < threads; i++) impl_->threads.emplace_back([this, i] { impl_->run(i); });
+
+    static bool registered = false;
+    std::lock_guard<std::mutex> lk(g_live_mu);
+    g_live.push_back(this);
+    if (!registered) {
+        metrics_add_collector(render_executors);
+        registered = true;
+    }
+}
+
+Executor::~Executor() {
+    shutdown();
+    ExecutorStats last = stats();
+    std::lock_guard<std::mutex> lk(g_live_mu);
+    g_live.erase(std::remove(g_live.begin(), g_live.end(), this), g_live.end());
+    g_retired.push_back(last);
+}
+
+void Executor::submit(std::function<void()> fn, bool block) {
+    Impl &m = *impl_;
+    bool own = t_exec == &m;
+    {
+        std::unique_lock<std::mutex> lk(m.mu);
+        if (block && !own && m.queued >= m.capacity) {
+            m.waits.fetch_add(1, std::memory_order_relaxed);
+            m.space_cv.wait(lk, [&] { return m.queued < m.capacity; });
+        }
+        m.queued++;
+        m.peak = std::max(m.peak, m.queued);
+    }
+    size_t target = own ? t_worker : m.next.fetch_add(1, std::memory_order_relaxed) % m.workers.size();
+    {
+        Impl::Worker &w = *m.workers[target];
+        std::lock_guard<std::mutex> lk(w.mu);
+        w.q.push_back(std::move(fn));
+    }
+    {
+        std::lock_guard<std::mutex> lk(m.mu);
+        m.available++;
+    }
+    m.work_cv.notify_one();
+}
+
+void Executor::wait_idle() {
+    std::unique_lock<std::mutex> lk(impl_->mu);
+    impl_->idle_cv.wait(lk, [&] { return impl_->queued == 0 && impl_->running == 0; });
+}
+
+void Executor::shutdown() {
+    if (impl_->threads.empty()) return;
+    wait_idle();
+    {
+        std::lock_guard<std::mutex> lk(impl_->mu);
+        impl_->stopping = true;
+    }
+    impl_->work_cv.notify_all();
+    for (std::thread &t : impl_->threads) t.join();
+    impl_->threads.clear();
+}
+
+ExecutorStats Executor::stats() const {
+    ExecutorStats s;
+    s.name = impl_->name;
+    s.threads = impl_->workers.size();
+    {
+        std::lock_guard<std::mutex> lk(impl_->mu);
+        s.queued = impl_->queued;
+        s.peak_queued = impl_->peak;
+    }
+    s.executed = impl_->executed.load(std::memory_order_relaxed);
+    s.steals = impl_->steals.load(std::memory_order_relaxed);
+    s.backpressure_waits = impl_->waits.load(std::memory_order_relaxed);
+    return s;
+}
+
+std::vector<ExecutorStats> executor_stats() {
+    std::lock_guard<std::mutex> lk(g_live_mu);
+    std::vector<ExecutorStats> out = g_retired;
+    for (Executor *e : g_live) out.push_back(e->stats());
+    return out;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ExecutorStats {
+    std::string name;
+    size_t threads = 0;
+    size_t queued = 0;       // accepted, not yet started
+    size_t peak_queued = 0;
+    uint64_t executed = 0;
+    uint64_t steals = 0;     // tasks run by a worker other than the one they were queued on
+    uint64_t backpressure_waits = 0; // submit() calls that had to wait for room
+};
+
+// A pool of workers with one deque each. A worker runs its own deque
+// newest-first and, once that is empty, steals the oldest task from
+// another worker's, so a long job (a big webp encode) only holds up its
+// own thread while the short ones queued behind it move elsewhere.
+// submit() blocks while `capacity` tasks are queued, which is how a stage
+// pushes back on the one feeding it.
+struct Executor {
+    Executor(const std::string &name, size_t threads, size_t capacity);
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+    ~Executor(); // shutdown()
+
+    // Queues `fn` on the calling worker's own deque, or round-robin when
+    // called from outside. `block` = false skips the capacity wait, for
+    // hand-offs that would otherwise close a cycle between two executors;
+    // a worker submitting to its own executor never waits either.
+    void submit(std::function<void()> fn, bool block = true);
+    void wait_idle(); // until nothing is queued or running
+    void shutdown();  // wait_idle(), then join the workers
+
+    ExecutorStats stats() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// Stats of every executor, destroyed ones first with their final numbers;
+// they are also exported as imgutil_executor_* metrics.
+std::vector<ExecutorStats> executor_stats();
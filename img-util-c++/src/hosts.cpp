@@ -0,0 +1,121 @@
+#include "hosts.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const double EWMA_ALPHA = 0.3;
+// Unmeasured hosts are assumed to connect this fast, so they get tried once
+// the measured ones degrade past it.
+static const double UNMEASURED_CONNECT_MS = 100;
+
+void HostTable::assign(const std::vector<std::string> &list) {
+    std::lock_guard<std::mutex> lk(mu);
+    std::vector<HostStats> next;
+    for (size_t i = 0; i < list.size(); i++) {
+        HostStats hs;
+        for (const HostStats &old : hosts) {
+            if (old.host == list[i]) hs = old;
+        }
+        hs.host = list[i];
+        hs.listed = i;
+        next.push_back(hs);
+    }
+    hosts.swap(next);
+}
+
+bool HostTable::empty() {
+    std::lock_guard<std::mutex> lk(mu);
+    return hosts.empty();
+}
+
+static double score(const HostStats &h) {
+    double base = h.connect_ms >= 0 ? h.connect_ms : UNMEASURED_CONNECT_MS + static_cast<double>(h.listed);
+    return base * (1.0 + 20.0 * h.error_rate);
+}
+
+std::vector<std::string> HostTable::ranked() {
+    std::lock_guard<std::mutex> lk(mu);
+    std::vector<const HostStats *> order;
+    for (const HostStats &h : hosts) order.push_back(&h);
+    std::stable_sort(order.begin(), order.end(),
+                     [](const HostStats *a, const HostStats *b) { return score(*a) < score(*b); });
+    std::vector<std::string> out;
+    for (const HostStats *h : order) out.push_back(h->host);
+    return out;
+}
+
+void HostTable::record(const std::string &host, bool ok, double connect_ms) {
+    std::lock_guard<std::mutex> lk(mu);
+    for (HostStats &h : hosts) {
+        if (h.host != host) continue;
+        if (connect_ms >= 0) {
+            h.connect_ms = h.connect_ms < 0 ? connect_ms : h.connect_ms + EWMA_ALPHA * (connect_ms - h.connect_ms);
+        }
+        h.error_rate += EWMA_ALPHA * ((ok ? 0.0 : 1.0) - h.error_rate);
+        if (ok) h.ok++;
+        else h.failed++;
+        return;
+    }
+}
+
+void HostTable::record_slow(const std::string &host, double waited_ms) {
+    std::lock_guard<std::mutex> lk(mu);
+    for (HostStats &h : hosts) {
+        if (h.host != host) continue;
+        if (h.connect_ms < waited_ms) {
+            h.connect_ms = h.connect_ms < 0 ? waited_ms : h.connect_ms + EWMA_ALPHA * (waited_ms - h.connect_ms);
+        }
+        return;
+    }
+}
+
+std::vector<HostStats> HostTable::snapshot() {
+    std::lock_guard<std::mutex> lk(mu);
+    return hosts;
+}
+
+static void add_host(std::vector<std::string> &out, std::string host) {
+    if (host.rfind("http://", 0) == 0) host.erase(0, 7);
+    else if (host.rfind("https://", 0) == 0) host.erase(0, 8);
+    size_t slash = host.find('/');
+    if (slash != std::string::npos) host.resize(slash);
+    if (host.empty()) return;
+    if (std::find(out.begin(), out.end(), host) == out.end()) out.push_back(host);
+}
+
+// Appends the strings of the array that follows `"name"` inside [p, end).
+static void collect_array(const char *p, const char *end, const char *name, std::vector<std::string> &out) {
+    std::string pat = std::string("\"") + name + "\"";
+    const char *k = strstr(p, pat.c_str());
+    if (!k || k >= end) return;
+    const char *q = strchr(k + pat.size(), '[');
+    if (!q || q >= end) return;
+    const char *qe = strchr(q, ']');
+    if (!qe || qe > end) return;
+    for (q++; q < qe; q++) {
+        if (*q != '"') continue;
+        const char *se = strchr(q + 1, '"');
+        if (!se || se > qe) return;
+        add_host(out, std::string(q + 1, static_cast<size_t>(se - q - 1)));
+        q = se;
+    }
+}
+
+std::vector<std::string> parse_upload_hosts(const std::string &json) {
+    std::vector<std::string> primary;
+    std::vector<std::string> backup;
+    const char *p = json.c_str();
+    while ((p = strstr(p, "\"up\"")) != nullptr) {
+        const char *obj = strchr(p, '{');
+        if (!obj) break;
+        // "up" objects only nest arrays of strings, so the first '}' closes it.
+        const char *end = strchr(obj, '}');
+        if (!end) break;
+        collect_array(obj, end, "domains", primary);
+        collect_array(obj, end, "old", backup);
+        p = end;
+    }
+    if (primary.empty()) collect_array(json.c_str(), json.c_str() + json.size(), "domains", primary);
+    for (const std::string &h : backup) add_host(primary, h);
+    return primary;
+}
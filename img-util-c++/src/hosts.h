@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct HostStats {
+    std::string host;
+    size_t listed = 0;          // position in the /v4/query answer
+    double connect_ms = -1;     // EWMA of connect time, -1 until measured
+    double error_rate = 0;      // EWMA of transport/5xx failures
+    uint64_t ok = 0;
+    uint64_t failed = 0;
+};
+
+// Upload domains for one bucket, ranked by observed connect time and error
+// rate so that a slow or failing edge node drops behind the healthy ones.
+struct HostTable {
+    std::mutex mu;
+    std::vector<HostStats> hosts;
+
+    void assign(const std::vector<std::string> &list);
+    bool empty();
+    std::vector<std::string> ranked();
+    void record(const std::string &host, bool ok, double connect_ms);
+    // For an attempt abandoned before it connected: counts the time waited
+    // as a connect sample if that is worse than what we already know.
+    void record_slow(const std::string &host, double waited_ms);
+    std::vector<HostStats> snapshot();
+};
+
+// Collects every "up" domain (primary and "old"/backup lists, all regions)
+// from a /v4/query reply, scheme and path stripped, in answer order.
+std::vector<std::string> parse_upload_hosts(const std::string &json);
@@ -0,0 +1,100 @@
+#include "imgutil.h"
+
+#include <curl/curl.h>
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+#include "qiniu.h"
+#include "uploader.h"
+#include "util.h"
+
+struct imgutil_uploader {
+    Uploader up;
+};
+
+static std::mutex g_global_mu;
+static int g_open = 0;
+
+static void to_c(const UploadResult &r, imgutil_result &c) {
+    c.id = r.id;
+    c.ok = r.ok ? 1 : 0;
+    c.input = r.input.c_str();
+    c.key = r.key.c_str();
+    c.response = r.response.c_str();
+    c.error = r.error.c_str();
+    c.bytes = r.bytes;
+    c.latency_ms = r.latency_ms;
+}
+
+static UploadCallback wrap(imgutil_callback cb, void *user) {
+    if (!cb) return UploadCallback();
+    return [cb, user](const UploadResult &r) {
+        imgutil_result c;
+        to_c(r, c);
+        cb(&c, user);
+    };
+}
+
+imgutil_uploader *imgutil_open(const char *config_json, int max_inflight, char *err, size_t err_cap) {
+    {
+        std::lock_guard<std::mutex> lk(g_global_mu);
+        if (g_open++ == 0) curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
+    imgutil_uploader *u = new imgutil_uploader;
+    std::string error;
+    if (!config_json || !u->up.open(config_json, error, max_inflight)) {
+        if (!config_json) error = "no config";
+        if (err && err_cap > 0) snprintf(err, err_cap, "%s", error.c_str());
+        imgutil_close(u);
+        return nullptr;
+    }
+    return u;
+}
+
+uint64_t imgutil_submit(imgutil_uploader *u, const char *input, imgutil_callback cb, void *user) {
+    if (!u || !input) return 0;
+    return u->up.submit(input, wrap(cb, user));
+}
+
+uint64_t imgutil_submit_bytes(imgutil_uploader *u,
+                              const void *data,
+                              size_t len,
+                              const char *name,
+                              const char *content_type,
+                              imgutil_callback cb,
+                              void *user) {
+    if (!u || (!data && len > 0)) return 0;
+    PoolBuffer b;
+    b.append(data, len);
+    return u->up.submit_bytes(std::move(b), name ? name : "upload.bin", content_type ? content_type : "", wrap(cb, user));
+}
+
+int imgutil_upload(imgutil_uploader *u, const char *input, imgutil_callback cb, void *user) {
+    if (!u || !input) return 0;
+    UploadResult r;
+    bool ok = u->up.upload(input, r);
+    if (cb) wrap(cb, user)(r);
+    return ok ? 1 : 0;
+}
+
+void imgutil_wait(imgutil_uploader *u) {
+    if (u) u->up.wait();
+}
+
+void imgutil_close(imgutil_uploader *u) {
+    if (!u) return;
+    u->up.close();
+    delete u;
+    std::lock_guard<std::mutex> lk(g_global_mu);
+    if (--g_open == 0) {
+        http_share_cleanup();
+        curl_global_cleanup();
+    }
+}
+
+void imgutil_print_json(const char *json) {
+    if (json) json_pretty_print(json);
+}
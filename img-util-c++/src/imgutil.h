@@ -0,0 +1,64 @@
+#ifndef IMGUTIL_H
+#define IMGUTIL_H
+
+/* C interface to the upload engine (see uploader.h). Strings are UTF-8 and
+ * NUL-terminated; pointers inside an imgutil_result are only valid during
+ * the callback that receives it. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct imgutil_uploader imgutil_uploader;
+
+typedef struct {
+    uint64_t id;
+    int ok;
+    const char *input;
+    const char *key;
+    const char *response; /* Qiniu's JSON answer */
+    const char *error;    /* empty when ok */
+    size_t bytes;
+    double latency_ms;
+} imgutil_result;
+
+/* Runs on one of the uploader's worker threads, or on the caller's thread
+ * for imgutil_upload(). */
+typedef void (*imgutil_callback)(const imgutil_result *res, void *user);
+
+/* Creates an uploader from the text of a config.json. max_inflight > 0
+ * overrides the config. Returns NULL and fills err on failure, including
+ * when another uploader is still open: only one may exist per process. It
+ * also initialises libcurl for the process. */
+imgutil_uploader *imgutil_open(const char *config_json, int max_inflight, char *err, size_t err_cap);
+
+/* Queue a local path or http(s) URL, or bytes (copied) with a name that
+ * supplies the key's extension. Return the item id, or 0 on bad arguments. */
+uint64_t imgutil_submit(imgutil_uploader *u, const char *input, imgutil_callback cb, void *user);
+uint64_t imgutil_submit_bytes(imgutil_uploader *u,
+                              const void *data,
+                              size_t len,
+                              const char *name,
+                              const char *content_type,
+                              imgutil_callback cb,
+                              void *user);
+
+/* Uploads on the calling thread; cb (may be NULL) runs before it returns.
+ * Returns 1 on success. */
+int imgutil_upload(imgutil_uploader *u, const char *input, imgutil_callback cb, void *user);
+
+void imgutil_wait(imgutil_uploader *u);
+/* Waits for queued items, then frees the uploader. */
+void imgutil_close(imgutil_uploader *u);
+
+/* Pretty-prints a JSON document to stdout, as the CLIs do. */
+void imgutil_print_json(const char *json);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
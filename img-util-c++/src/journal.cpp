@@ -0,0 +1,139 @@
+#include "journal.h"
+
+#include <chrono>
+#include <cstring>
+
+#include "util.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static bool sync_file(FILE *f) {
+    if (fflush(f) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+bool Journal::open(const std::string &p, int sync_interval_ms) {
+    path = p;
+    sync_ms = sync_interval_ms > 0 ? sync_interval_ms : 200;
+
+    std::string text;
+    bool torn = false;
+    if (read_text_file(path, text)) {
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t nl = text.find('\n', pos);
+            if (nl == std::string::npos) {
+                torn = true; // crashed mid-append
+                break;
+            }
+            records++;
+            if (text[pos] == 'U' && text[pos + 1] == '\t') {
+                size_t tab = text.find('\t', pos + 2);
+                if (tab != std::string::npos && tab < nl) {
+                    done_inputs[text.substr(tab + 1, nl - tab - 1)] = text.substr(pos + 2, tab - pos - 2);
+                }
+            }
+            pos = nl + 1;
+        }
+        if (!done_inputs.empty()) log_line("journal: %zu items already uploaded, skipping them", done_inputs.size());
+    }
+
+    // Q/H lines of finished items and repeated U lines are dead weight.
+    if ((torn || records > 2 * done_inputs.size() + 1024) && !compact()) return false;
+
+    f = fopen(path.c_str(), "ab");
+    if (!f) return false;
+    flusher = std::thread(&Journal::flush_loop, this);
+    return true;
+}
+
+// Rewrites the journal as one U line per completed input, via a temp file
+// and rename so a crash leaves either the old or the new journal.
+bool Journal::compact() {
+    std::string tmp = path + ".compact";
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if (!out) return false;
+    for (const auto &d : done_inputs) fprintf(out, "U\t%s\t%s\n", d.second.c_str(), d.first.c_str());
+    bool ok = sync_file(out);
+    ok = fclose(out) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+#endif
+    if (!ok) {
+        remove(tmp.c_str());
+        log_line("journal: compaction of %s failed", path.c_str());
+        return false;
+    }
+    log_line("journal: compacted %zu records to %zu", records, done_inputs.size());
+    records = done_inputs.size();
+    return true;
+}
+
+void Journal::append(char state, const std::string &key, const std::string &input) {
+    if (!f) return;
+    std::lock_guard<std::mutex> lk(mu);
+    pending += state;
+    if (state != 'Q') {
+        pending += '\t';
+        pending += key;
+    }
+    pending += '\t';
+    pending += input;
+    pending += '\n';
+}
+
+void Journal::queued(const std::string &input) { append('Q', "", input); }
+
+void Journal::hashed(const std::string &input, const std::string &key) { append('H', key, input); }
+
+void Journal::uploaded(const std::string &input, const std::string &key) {
+    append('U', key, input);
+    std::lock_guard<std::mutex> lk(mu);
+    done_inputs[input] = key;
+}
+
+bool Journal::done(const std::string &input) {
+    std::lock_guard<std::mutex> lk(mu);
+    return done_inputs.count(input) != 0;
+}
+
+void Journal::flush_loop() {
+    std::unique_lock<std::mutex> lk(mu);
+    for (;;) {
+        bool stopping = cv.wait_for(lk, std::chrono::milliseconds(sync_ms), [&] { return stop; });
+        std::string batch;
+        batch.swap(pending);
+        lk.unlock();
+        if (!batch.empty()) {
+            bool ok = fwrite(batch.data(), 1, batch.size(), f) == batch.size();
+            if (!ok || !sync_file(f)) log_line("journal: write to %s failed: %s", path.c_str(), strerror(errno));
+            for (char c : batch) records += c == '\n';
+        }
+        lk.lock();
+        if (stopping) return;
+    }
+}
+
+void Journal::close() {
+    if (!f) return;
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        stop = true;
+    }
+    cv.notify_all();
+    flusher.join();
+    fclose(f);
+    f = nullptr;
+    if (records > 2 * done_inputs.size() + 1024) compact();
+}
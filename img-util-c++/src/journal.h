@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+// Append-only record of batch progress, one line per state change:
+//
+//   Q\t<input>           handed to a worker
+//   H\t<key>\t<input>    content hashed, key known
+//   U\t<key>\t<input>    uploaded (or already present)
+//
+// Lines are buffered and written + fsynced together every `sync_ms`, so the
+// cost per item is a memcpy; a crash loses at most the last batch, and
+// those items are simply uploaded again (the key dedups them). A restarted
+// run skips every input with a U record, at one hash lookup per item.
+struct Journal {
+    std::string path;
+    int sync_ms = 200;
+
+    std::mutex mu; // guards done_inputs, pending and stop
+    std::unordered_map<std::string, std::string> done_inputs; // input -> key
+    std::condition_variable cv;
+    std::string pending;
+    bool stop = false;
+    FILE *f = nullptr;
+    std::thread flusher;
+    size_t records = 0; // lines in the file, for compaction
+
+    // Loads any existing journal, compacts it if it is mostly dead records
+    // or ends in a torn line, and opens it for appending. close() flushes
+    // and compacts again.
+    bool open(const std::string &p, int sync_interval_ms);
+    void close();
+
+    bool done(const std::string &input);
+
+    void queued(const std::string &input);
+    void hashed(const std::string &input, const std::string &key);
+    void uploaded(const std::string &input, const std::string &key);
+
+private:
+    void append(char state, const std::string &key, const std::string &input);
+    void flush_loop();
+    bool compact();
+};
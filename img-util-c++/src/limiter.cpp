@@ -0,0 +1,152 @@
+#include "limiter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "metrics.h"
+#include "util.h"
+
+static const double SHORT_ALPHA = 0.2;
+static const double LONG_ALPHA = 0.01;
+
+LimiterMode limiter_mode_from_string(const std::string &s) {
+    if (s == "aimd") return LIMITER_AIMD;
+    if (s == "gradient") return LIMITER_GRADIENT;
+    return LIMITER_FIXED;
+}
+
+void ConcurrencyLimiter::configure(LimiterMode m, int lo, int hi, int initial) {
+    std::lock_guard<std::mutex> lk(mu);
+    mode = m;
+    max_limit = std::max(1, hi);
+    min_limit = std::min(std::max(1, lo), max_limit);
+    if (mode == LIMITER_FIXED) initial = max_limit;
+    limit = std::min(std::max(initial, min_limit), max_limit);
+    last_cut = std::chrono::steady_clock::now();
+}
+
+void ConcurrencyLimiter::widen(int n) {
+    if (n <= 0) return;
+    std::vector<std::function<void()>> granted;
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        max_limit += n;
+        limit += n;
+        cv.notify_all();
+        granted = take_waiters();
+    }
+    for (auto &g : granted) g();
+}
+
+int ConcurrencyLimiter::current() {
+    std::lock_guard<std::mutex> lk(mu);
+    return static_cast<int>(limit);
+}
+
+void ConcurrencyLimiter::acquire() {
+    std::unique_lock<std::mutex> lk(mu);
+    cv.wait(lk, [this] { return inflight < static_cast<int>(limit); });
+    inflight++;
+}
+
+bool ConcurrencyLimiter::acquire_async(std::function<void()> grant) {
+    std::lock_guard<std::mutex> lk(mu);
+    if (waiters.empty() && inflight < static_cast<int>(limit)) {
+        inflight++;
+        return true;
+    }
+    waiters.push_back(std::move(grant));
+    return false;
+}
+
+std::vector<std::function<void()>> ConcurrencyLimiter::take_waiters() {
+    std::vector<std::function<void()>> granted;
+    while (!waiters.empty() && inflight < static_cast<int>(limit)) {
+        inflight++;
+        granted.push_back(std::move(waiters.front()));
+        waiters.pop_front();
+    }
+    return granted;
+}
+
+void ConcurrencyLimiter::set_limit(double next, const char *why) {
+    next = std::min(std::max(next, static_cast<double>(min_limit)), static_cast<double>(max_limit));
+    int before = static_cast<int>(limit);
+    limit = next;
+    if (static_cast<int>(limit) != before) {
+        log_line("concurrency %d -> %d (%s, rtt %.1f ms, baseline %.1f ms)", before, static_cast<int>(limit), why,
+                 rtt_short, rtt_long);
+        cv.notify_all();
+    }
+}
+
+void ConcurrencyLimiter::release(double rtt_ms, bool overload) {
+    std::vector<std::function<void()>> granted;
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        inflight--;
+        cv.notify_one();
+        adapt(rtt_ms, overload);
+        granted = take_waiters();
+    }
+    for (auto &g : granted) g();
+}
+
+void ConcurrencyLimiter::adapt(double rtt_ms, bool overload) {
+    if (mode == LIMITER_FIXED) return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (overload) {
+        // One cut per round trip: a burst of failures from the same window
+        // should not collapse the limit several times over.
+        std::chrono::duration<double, std::milli> since = now - last_cut;
+        if (since.count() >= std::max(rtt_short, 50.0)) {
+            last_cut = now;
+            set_limit(limit * backoff, "overload");
+        }
+        return;
+    }
+
+    // Overloaded samples include retry backoff, so only clean ones feed
+    // the latency estimates.
+    if (rtt_ms > 0) {
+        rtt_short = rtt_short < 0 ? rtt_ms : rtt_short + SHORT_ALPHA * (rtt_ms - rtt_short);
+        rtt_long = rtt_long < 0 ? rtt_ms : rtt_long + LONG_ALPHA * (rtt_ms - rtt_long);
+        // The baseline follows improvements at once, degradations slowly.
+        if (rtt_short < rtt_long) rtt_long = rtt_short;
+    }
+
+    if (mode == LIMITER_AIMD) {
+        set_limit(limit + 1.0 / limit, "aimd increase");
+        return;
+    }
+
+    // Gradient: scale the window by the ratio of baseline to current
+    // latency, plus a sqrt(limit) queue allowance so it keeps probing upward
+    // while latency is flat. It settles where limit * (1 - gradient) equals
+    // the allowance: around 100 at a gradient of 0.9, 4 at 0.5.
+    double gradient = rtt_short > 0 ? std::min(1.0, std::max(0.5, rtt_long / rtt_short)) : 1.0;
+    double queue = std::sqrt(limit);
+    set_limit(limit * gradient + queue, gradient < 0.9 ? "rtt inflation" : "gradient increase");
+}
+
+static ConcurrencyLimiter *g_exported = nullptr;
+
+static std::string render_limiter() {
+    if (!g_exported) return "";
+    std::lock_guard<std::mutex> lk(g_exported->mu);
+    std::ostringstream os;
+    os << "# HELP imgutil_concurrency_limit Current upload window.\n";
+    os << "# TYPE imgutil_concurrency_limit gauge\n";
+    os << "imgutil_concurrency_limit " << static_cast<int>(g_exported->limit) << "\n";
+    os << "# HELP imgutil_uploads_inflight Uploads currently on the wire.\n";
+    os << "# TYPE imgutil_uploads_inflight gauge\n";
+    os << "imgutil_uploads_inflight " << g_exported->inflight << "\n";
+    return os.str();
+}
+
+void limiter_export(ConcurrencyLimiter *l) {
+    if (!g_exported) metrics_add_collector(render_limiter);
+    g_exported = l;
+}
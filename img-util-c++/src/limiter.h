@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum LimiterMode {
+    LIMITER_FIXED,
+    LIMITER_AIMD,
+    LIMITER_GRADIENT
+};
+
+LimiterMode limiter_mode_from_string(const std::string &s);
+
+// Caps how many uploads are on the wire at once and adapts the cap from
+// what each finished upload reports. AIMD grows the window by one per
+// window's worth of clean completions and cuts it by `backoff` on 429/5xx
+// or transport errors. Gradient additionally shrinks it when latency rises
+// above the no-load baseline, before the server starts refusing.
+struct ConcurrencyLimiter {
+    LimiterMode mode = LIMITER_FIXED;
+    int min_limit = 1;
+    int max_limit = 1;
+    double backoff = 0.7;
+    double limit = 1;
+
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> waiters; // acquire_async() callers, in order
+    int inflight = 0;
+    double rtt_short = -1; // EWMA over recent samples
+    double rtt_long = -1;  // slow EWMA, tracks the no-load baseline
+    std::chrono::steady_clock::time_point last_cut;
+
+    void configure(LimiterMode m, int lo, int hi, int initial);
+    // Adds `n` slots to both the cap and the current limit, for threads
+    // that come on top of the configured ones (the --serve fast lanes).
+    void widen(int n);
+    void acquire();
+    // acquire() for callers that must not block, such as coroutines on an
+    // event loop. Takes a slot and returns true if one is free; otherwise
+    // queues `grant` and returns false. `grant` runs once a slot has been
+    // taken on its behalf, on the thread that freed it, outside the lock.
+    bool acquire_async(std::function<void()> grant);
+    // `rtt_ms` is the sample latency, `overload` whether the server or the
+    // network pushed back (429, 5xx, timeouts, resets) during this upload.
+    void release(double rtt_ms, bool overload);
+    int current();
+    void set_limit(double next, const char *why); // caller holds mu
+
+private:
+    void adapt(double rtt_ms, bool overload); // caller holds mu
+    // Takes slots for queued acquire_async() callers while there is room;
+    // the caller holds mu and runs the returned grants after unlocking.
+    std::vector<std::function<void()>> take_waiters();
+};
+
+// Registers limit/inflight gauges for `l` with the metrics exporter.
+void limiter_export(ConcurrencyLimiter *l);
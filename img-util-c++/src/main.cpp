@@ -1,13 +1,36 @@
 #include <curl/curl.h>
-#include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <ctime>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
+#include "bulkread.h"
+#include "journal.h"
+#include "metrics.h"
+#include "mpmc.h"
+#include "pipeline.h"
+#include "qiniu.h"
+#include "executor.h"
+#include "schedule.h"
+#include "server.h"
+#include "shard.h"
+#include "shaper.h"
+#include "trace.h"
+#include "uploader.h"
+#include "util.h"
+#include "walk.h"
+#include "watch.h"
+
 #ifdef _WIN32
 #include <io.h>
 #include <windows.h>
@@ -15,425 +38,58 @@
 #define F_OK 0
 #endif
 
-static const char *DEFAULT_UPLOAD_HOST = "upload-z2.qiniup.com";
-
-struct Buffer {
-    std::string data;
-};
-
-static size_t curl_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
-    auto *b = static_cast<Buffer *>(userdata);
-    b->data.append(ptr, size * nmemb);
-    return size * nmemb;
-}
-
-static inline uint32_t rol(uint32_t x, uint32_t n) { return (x << n) | (x >> (32 - n)); }
-
-static void md5(const unsigned char *initial_msg, size_t initial_len, unsigned char digest[16]) {
-    uint32_t h0 = 0x67452301;
-    uint32_t h1 = 0xefcdab89;
-    uint32_t h2 = 0x98badcfe;
-    uint32_t h3 = 0x10325476;
-
-    static const uint32_t r[] = {
-        7,12,17,22, 7,12,17,22, 7,12,17,22, 7,12,17,22,
-        5,9,14,20, 5,9,14,20, 5,9,14,20, 5,9,14,20,
-        4,11,16,23, 4,11,16,23, 4,11,16,23, 4,11,16,23,
-        6,10,15,21, 6,10,15,21, 6,10,15,21, 6,10,15,21
-    };
-
-    static const uint32_t k[] = {
-        0xd76aa478,0xe8c7b756,0x242070db,0xc1bdceee,
-        0xf57c0faf,0x4787c62a,0xa8304613,0xfd469501,
-        0x698098d8,0x8b44f7af,0xffff5bb1,0x895cd7be,
-        0x6b901122,0xfd987193,0xa679438e,0x49b40821,
-        0xf61e2562,0xc040b340,0x265e5a51,0xe9b6c7aa,
-        0xd62f105d,0x02441453,0xd8a1e681,0xe7d3fbc8,
-        0x21e1cde6,0xc33707d6,0xf4d50d87,0x455a14ed,
-        0xa9e3e905,0xfcefa3f8,0x676f02d9,0x8d2a4c8a,
-        0xfffa3942,0x8771f681,0x6d9d6122,0xfde5380c,
-        0xa4beea44,0x4bdecfa9,0xf6bb4b60,0xbebfbc70,
-        0x289b7ec6,0xeaa127fa,0xd4ef3085,0x04881d05,
-        0xd9d4d039,0xe6db99e5,0x1fa27cf8,0xc4ac5665,
-        0xf4292244,0x432aff97,0xab9423a7,0xfc93a039,
-        0x655b59c3,0x8f0ccc92,0xffeff47d,0x85845dd1,
-        0x6fa87e4f,0xfe2ce6e0,0xa3014314,0x4e0811a1,
-        0xf7537e82,0xbd3af235,0x2ad7d2bb,0xeb86d391
-    };
+// Items for the batch workers. Directory walkers append while the workers
+// drain, so the first uploads start before a big tree is fully listed; the
+// bound keeps a multi-million-file scan from buffering every path. The
+// hand-off is a lock-free ring, so many workers popping at once do not
+// queue up on one mutex.
+struct InputFeed {
+    static const size_t CAPACITY = 8192;
 
-    size_t new_len = initial_len + 1;
-    while (new_len % 64 != 56) new_len++;
-
-    std::vector<unsigned char> msg(new_len + 8, 0);
-    memcpy(msg.data(), initial_msg, initial_len);
-    msg[initial_len] = 0x80;
-
-    unsigned long long bits_len = static_cast<unsigned long long>(initial_len) * 8;
-    memcpy(msg.data() + new_len, &bits_len, 8);
-
-    for (size_t offset = 0; offset < new_len; offset += 64) {
-        auto *w = reinterpret_cast<uint32_t *>(msg.data() + offset);
-        uint32_t a = h0;
-        uint32_t b = h1;
-        uint32_t c = h2;
-        uint32_t d = h3;
-
-        for (uint32_t i = 0; i < 64; i++) {
-            uint32_t f, g;
-            if (i < 16) {
-                f = (b & c) | ((~b) & d);
-                g = i;
-            } else if (i < 32) {
-                f = (d & b) | ((~d) & c);
-                g = (5 * i + 1) % 16;
-            } else if (i < 48) {
-                f = b ^ c ^ d;
-                g = (3 * i + 5) % 16;
-            } else {
-                f = c ^ (b | (~d));
-                g = (7 * i) % 16;
-            }
-            uint32_t temp = d;
-            d = c;
-            c = b;
-            uint32_t x = a + f + k[i] + w[g];
-            b = b + rol(x, r[i]);
-            a = temp;
-        }
+    MpmcQueue<std::string> items{CAPACITY};
+    std::atomic<int> producers{0};
+    std::atomic<long> next_id{0};
 
-        h0 += a;
-        h1 += b;
-        h2 += c;
-        h3 += d;
-    }
-
-    memcpy(digest + 0, &h0, 4);
-    memcpy(digest + 4, &h1, 4);
-    memcpy(digest + 8, &h2, 4);
-    memcpy(digest + 12, &h3, 4);
-}
-
-static std::string md5_hex(const unsigned char *data, size_t len) {
-    unsigned char dig[16];
-    md5(data, len, dig);
-    static const char *hex = "0123456789abcdef";
-    std::string out;
-    out.resize(32);
-    for (int i = 0; i < 16; i++) {
-        out[i * 2] = hex[(dig[i] >> 4) & 0xF];
-        out[i * 2 + 1] = hex[dig[i] & 0xF];
-    }
-    return out;
-}
+    void push(const std::string &s) { items.push(s); }
 
-static bool read_text_file(const std::string &path, std::string &out) {
-    FILE *f = fopen(path.c_str(), "rb");
-    if (!f) return false;
-    fseek(f, 0, SEEK_END);
-    long n = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    if (n < 0) {
-        fclose(f);
-        return false;
+    void producer_done() {
+        if (producers.fetch_sub(1) == 1) items.close();
     }
-    out.resize(static_cast<size_t>(n));
-    size_t r = fread(out.data(), 1, out.size(), f);
-    fclose(f);
-    out.resize(r);
-    return true;
-}
 
-static bool read_bin_file(const std::string &path, std::vector<unsigned char> &out) {
-    FILE *f = fopen(path.c_str(), "rb");
-    if (!f) return false;
-    fseek(f, 0, SEEK_END);
-    long n = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    if (n < 0) {
-        fclose(f);
-        return false;
+    bool pop(std::string &out, long &id) {
+        if (!items.pop(out)) return false;
+        id = next_id.fetch_add(1, std::memory_order_relaxed);
+        return true;
     }
-    out.resize(static_cast<size_t>(n));
-    size_t r = fread(out.data(), 1, out.size(), f);
-    fclose(f);
-    out.resize(r);
-    return true;
-}
-
-static const char *json_find_key(const std::string &json, const std::string &key) {
-    std::string pat = "\"" + key + "\"";
-    const char *base = json.c_str();
-    const char *p = strstr(base, pat.c_str());
-    if (!p) return nullptr;
-    p = strchr(p + pat.size(), ':');
-    if (!p) return nullptr;
-    p++;
-    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
-    return p;
-}
-
-static bool json_get_bool(const std::string &json, const std::string &key, bool defv) {
-    const char *p = json_find_key(json, key);
-    if (!p) return defv;
-    if (strncmp(p, "true", 4) == 0) return true;
-    if (strncmp(p, "false", 5) == 0) return false;
-    return defv;
-}
-
-static int json_get_int(const std::string &json, const std::string &key, int defv) {
-    const char *p = json_find_key(json, key);
-    if (!p) return defv;
-    return atoi(p);
-}
-
-static std::string json_get_string(const std::string &json, const std::string &key, const std::string &defv) {
-    const char *p = json_find_key(json, key);
-    if (!p || *p != '"') return defv;
-    p++;
-    const char *e = strchr(p, '"');
-    if (!e) return defv;
-    return std::string(p, static_cast<size_t>(e - p));
-}
-
-static void json_pretty_print(const std::string &raw) {
-    const char *s = raw.c_str();
-    int indent = 0;
-    bool in_str = false;
-    bool esc = false;
-    while (*s) {
-        char c = *s++;
-        if (esc) {
-            std::cout << c;
-            esc = false;
-            continue;
-        }
-        if (in_str && c == '\\') {
-            std::cout << c;
-            esc = true;
-            continue;
-        }
-        if (c == '"') {
-            std::cout << c;
-            in_str = !in_str;
-            continue;
-        }
-        if (in_str) {
-            std::cout << c;
-            continue;
-        }
-        if (c == '{' || c == '[') {
-            std::cout << c << "\n";
-            indent++;
-            for (int i = 0; i < indent; i++) std::cout << "  ";
-        } else if (c == '}' || c == ']') {
-            std::cout << "\n";
-            indent = indent > 0 ? indent - 1 : 0;
-            for (int i = 0; i < indent; i++) std::cout << "  ";
-            std::cout << c;
-        } else if (c == ',') {
-            std::cout << c << "\n";
-            for (int i = 0; i < indent; i++) std::cout << "  ";
-        } else if (c == ':') {
-            std::cout << ": ";
-        } else if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
-        } else {
-            std::cout << c;
-        }
-    }
-    std::cout << "\n";
-}
+};
 
-static void normalize_input_inplace(std::string &s) {
-    while (!s.empty()) {
-        char c = s.back();
-        if (c == '\n' || c == '\r' || c == '+' || std::isspace(static_cast<unsigned char>(c))) s.pop_back();
-        else break;
+static bool read_input_list(const std::string &path, std::vector<std::string> &out) {
+    std::string text;
+    if (path == "-") {
+        std::string line;
+        while (std::getline(std::cin, line)) out.push_back(line);
+        return true;
     }
+    if (!read_text_file(path, text)) return false;
     size_t start = 0;
-    while (start < s.size() && std::isspace(static_cast<unsigned char>(s[start]))) start++;
-    if (start > 0) s.erase(0, start);
-    if (s.size() >= 2) {
-        if ((s.front() == '"' && s.back() == '"') || (s.front() == '\'' && s.back() == '\'')) {
-            s = s.substr(1, s.size() - 2);
-        }
-    }
-}
-
-static bool run_cwebp(const std::vector<unsigned char> &in, int quality, std::vector<unsigned char> &out) {
-    char in_path[512];
-    char out_path[512];
-    unsigned long long t = static_cast<unsigned long long>(time(nullptr));
-
-#ifdef _WIN32
-    char tmp[MAX_PATH];
-    GetTempPathA(MAX_PATH, tmp);
-    snprintf(in_path, sizeof(in_path), "%simgutil_%llu.input", tmp, t);
-    snprintf(out_path, sizeof(out_path), "%simgutil_%llu.webp", tmp, t);
-#else
-    snprintf(in_path, sizeof(in_path), "/tmp/imgutil_%llu.input", t);
-    snprintf(out_path, sizeof(out_path), "/tmp/imgutil_%llu.webp", t);
-#endif
-
-    FILE *f = fopen(in_path, "wb");
-    if (!f) return false;
-    fwrite(in.data(), 1, in.size(), f);
-    fclose(f);
-
-    char cmd[1200];
-#ifdef _WIN32
-    snprintf(cmd, sizeof(cmd), "cwebp -q %d \"%s\" -o \"%s\"", quality, in_path, out_path);
-#else
-    snprintf(cmd, sizeof(cmd), "cwebp -q %d '%s' -o '%s'", quality, in_path, out_path);
-#endif
-
-    int rc = system(cmd);
-    remove(in_path);
-    if (rc != 0) {
-        remove(out_path);
-        return false;
+    while (start < text.size()) {
+        size_t nl = text.find('\n', start);
+        if (nl == std::string::npos) nl = text.size();
+        std::string line = text.substr(start, nl - start);
+        normalize_input_inplace(line);
+        if (!line.empty()) out.push_back(line);
+        start = nl + 1;
     }
-
-    std::vector<unsigned char> wb;
-    if (!read_bin_file(out_path, wb)) {
-        remove(out_path);
-        return false;
-    }
-    remove(out_path);
-    out.swap(wb);
     return true;
 }
 
-static bool http_get_bytes(const std::string &url, struct curl_slist *headers, Buffer &resp, long &status) {
-    CURL *curl = curl_easy_init();
-    if (!curl) return false;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 60L);
-    if (headers) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-
-    CURLcode rc = curl_easy_perform(curl);
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
-    curl_easy_cleanup(curl);
-    return rc == CURLE_OK;
-}
-
-static std::string get_qiniu_upload_token(const std::string &user_token, const std::string &qiniu_token_url) {
-    struct curl_slist *hdrs = nullptr;
-    std::string tok_hdr = "token: " + user_token;
-    hdrs = curl_slist_append(hdrs, tok_hdr.c_str());
-    hdrs = curl_slist_append(hdrs, "Content-Type: application/json");
-
-    Buffer resp;
-    long st = 0;
-    bool ok = http_get_bytes(qiniu_token_url, hdrs, resp, st);
-    curl_slist_free_all(hdrs);
-
-    if (!ok || st < 200 || st >= 300) return "";
-
-    const char *p = strstr(resp.data.c_str(), "\"code\"");
-    if (!p) return "";
-    p = strchr(p, ':');
-    if (!p) return "";
-    int code = atoi(p + 1);
-    if (code != 1) return "";
-
-    return json_get_string(resp.data, "token", "");
-}
-
-static std::string query_upload_host(const std::string &upload_token, const std::string &bucket) {
-    std::string ak = upload_token;
-    size_t pos = ak.find(':');
-    if (pos != std::string::npos) ak.resize(pos);
-
-    std::string url = "https://api.qiniu.com/v4/query?ak=" + ak + "&bucket=" + bucket;
-
-    Buffer resp;
-    long st = 0;
-    if (!http_get_bytes(url, nullptr, resp, st) || st < 200 || st >= 300) return DEFAULT_UPLOAD_HOST;
-
-    const char *d = strstr(resp.data.c_str(), "\"domains\"");
-    if (!d) return DEFAULT_UPLOAD_HOST;
-    const char *q = strchr(d, '[');
-    if (!q) return DEFAULT_UPLOAD_HOST;
-    q++;
-    while (*q && *q != '"') q++;
-    if (*q != '"') return DEFAULT_UPLOAD_HOST;
-    q++;
-    const char *qe = strchr(q, '"');
-    if (!qe) return DEFAULT_UPLOAD_HOST;
-
-    std::string host(q, static_cast<size_t>(qe - q));
-    if (host.rfind("http://", 0) == 0) host.erase(0, 7);
-    else if (host.rfind("https://", 0) == 0) host.erase(0, 8);
-    size_t slash = host.find('/');
-    if (slash != std::string::npos) host.resize(slash);
-    if (host.empty()) return DEFAULT_UPLOAD_HOST;
-    return host;
-}
-
-static bool upload_once(const std::string &upload_url,
-                        const std::string &upload_token,
-                        const std::string &key,
-                        const std::vector<unsigned char> &bytes,
-                        const std::string &mime_type,
-                        std::string &out_resp,
-                        long &out_status) {
-    CURL *curl = curl_easy_init();
-    if (!curl) return false;
-
-    Buffer resp;
-
-    curl_easy_setopt(curl, CURLOPT_URL, upload_url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
-    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 120L);
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 60L);
-
-    struct curl_slist *hdrs = nullptr;
-    hdrs = curl_slist_append(hdrs, "user-agent: QiniuDart");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs);
-
-    curl_mime *mime = curl_mime_init(curl);
-    curl_mimepart *part;
-
-    part = curl_mime_addpart(mime);
-    curl_mime_name(part, "token");
-    curl_mime_data(part, upload_token.c_str(), CURL_ZERO_TERMINATED);
-
-    part = curl_mime_addpart(mime);
-    curl_mime_name(part, "key");
-    curl_mime_data(part, key.c_str(), CURL_ZERO_TERMINATED);
-
-    part = curl_mime_addpart(mime);
-    curl_mime_name(part, "file");
-    curl_mime_filename(part, key.c_str());
-    curl_mime_type(part, mime_type.c_str());
-    curl_mime_data(part, reinterpret_cast<const char *>(bytes.data()), bytes.size());
-
-    curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
-
-    CURLcode rc = curl_easy_perform(curl);
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &out_status);
-
-    curl_mime_free(mime);
-    curl_slist_free_all(hdrs);
-    curl_easy_cleanup(curl);
-
-    out_resp = resp.data;
-    return rc == CURLE_OK;
-}
-
-static std::string basename_from_path_or_url(const std::string &s) {
-    size_t p1 = s.find_last_of("/\\");
-    if (p1 == std::string::npos) return s;
-    return s.substr(p1 + 1);
-}
+// One input on its way through the staged pipeline.
+struct StagedJob {
+    std::string input;
+    long id = 0;
+    std::chrono::steady_clock::time_point t0;
+    StagedItem item;
+};
 
 int main(int argc, char **argv) {
     curl_global_init(CURL_GLOBAL_DEFAULT);
@@ -443,6 +99,20 @@ int main(int argc, char **argv) {
     SetConsoleCP(CP_UTF8);
 #endif
 
+    // --merge-results=OUT a.jsonl b.jsonl ... needs no config.
+    for (int i = 1; i < argc; i++) {
+        if (argv[i] && strncmp(argv[i], "--merge-results=", 16) == 0) {
+            std::vector<std::string> parts;
+            for (int j = 1; j < argc; j++) {
+                if (j != i && argv[j] && argv[j][0]) parts.push_back(argv[j]);
+            }
+            bool ok = merge_results(argv[i] + 16, parts);
+            if (!ok) std::cout << "合并结果失败: " << (argv[i] + 16) << "\n";
+            curl_global_cleanup();
+            return ok ? 0 : 1;
+        }
+    }
+
     std::string cfg_text;
     std::string cfg_path = "config.json";
     if (!read_text_file(cfg_path, cfg_text)) {
@@ -450,104 +120,470 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    std::string user_token = json_get_string(cfg_text, "user_token", "");
-    bool enable_webp = json_get_bool(cfg_text, "enable_webp", false);
-    int webp_quality = json_get_int(cfg_text, "webp_quality", 95);
-    std::string bucket = json_get_string(cfg_text, "bucket", "chat68");
-    std::string qiniu_token_url = json_get_string(cfg_text, "qiniu_token_url", "https://chat-go.jwzhd.com/v1/misc/qiniu-token");
+    std::string trace_path;
+    std::string results_path;
+    std::string serve_listen;
+    std::string watch_dir;
+    std::string journal_path;
+    std::string prescan_path;
+    Shard shard;
+    std::vector<std::string> manifests;
+    std::vector<std::string> inputs;
+    int max_inflight = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!argv[i] || !argv[i][0]) continue;
+        if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--results=", 10) == 0) {
+            results_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            serve_listen = argv[i] + 8;
+        } else if (strncmp(argv[i], "--watch=", 8) == 0) {
+            watch_dir = argv[i] + 8;
+        } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            watch_dir = argv[++i];
+        } else if (strncmp(argv[i], "--journal=", 10) == 0) {
+            journal_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--shard=", 8) == 0) {
+            if (!shard_parse(argv[i] + 8, shard)) {
+                std::cout << "--shard 格式应为 i/N: " << (argv[i] + 8) << "\n";
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--prescan=", 10) == 0) {
+            prescan_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--manifest=", 11) == 0) {
+            manifests.push_back(argv[i] + 11);
+        } else if (strncmp(argv[i], "--max-inflight=", 15) == 0) {
+            max_inflight = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "--input-list=", 13) == 0) {
+            if (!read_input_list(argv[i] + 13, inputs)) {
+                std::cout << "无法读取输入列表: " << (argv[i] + 13) << "\n";
+                return 1;
+            }
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
 
-    if (user_token.empty()) {
-        std::cout << "config.json里的 user_token 为空\n";
+    Uploader uploader;
+    std::string open_error;
+    if (!uploader.open(cfg_text, open_error, max_inflight)) {
+        std::cout << "配置错误: " << open_error << "\n";
         return 1;
     }
+    UploadContext &ctx = uploader.context();
+    max_inflight = uploader.max_inflight();
+    shaper_reload_on_sighup(cfg_path);
+
+    std::string metrics_textfile = json_get_string(cfg_text, "metrics_textfile", "");
+    int metrics_interval = json_get_int(cfg_text, "metrics_interval", 15);
+    std::string metrics_listen = json_get_string(cfg_text, "metrics_listen", "");
+    if (!trace_path.empty()) trace_enable(static_cast<size_t>(json_get_int(cfg_text, "trace_buffer_events", 65536)));
+
+    if (!serve_listen.empty()) {
+        if (!metrics_start_exporter(metrics_textfile, metrics_interval, metrics_listen)) {
+            std::cout << "metrics_listen 监听失败: " << metrics_listen << "\n";
+        }
+        ServeOptions so;
+        so.listen = serve_listen;
+        so.workers = max_inflight;
+        so.max_body = static_cast<size_t>(std::max(1, json_get_int(cfg_text, "serve_max_body_mb", 64))) << 20;
+        so.weight_interactive = json_get_int(cfg_text, "serve_weight_interactive", 8);
+        so.weight_normal = json_get_int(cfg_text, "serve_weight_normal", 4);
+        so.weight_bulk = json_get_int(cfg_text, "serve_weight_bulk", 1);
+        so.fast_lanes = std::max(0, json_get_int(cfg_text, "serve_fast_lanes", 1));
+        so.fast_lane_max = static_cast<size_t>(std::max(0, json_get_int(cfg_text, "serve_fast_lane_kb", 1024))) << 10;
+        so.input_root = json_get_string(cfg_text, "serve_input_root", "");
+        so.token = json_get_string(cfg_text, "serve_token", "");
+        int rc = serve_run(ctx, so);
+        metrics_stop_exporter();
+        if (!trace_path.empty() && !trace_write(trace_path)) {
+            std::cout << "写入trace失败: " << trace_path << "\n";
+        }
+        http_share_cleanup();
+        curl_global_cleanup();
+        return rc;
+    }
 
-    std::string input;
-    if (argc >= 2 && argv[1] && argv[1][0]) {
-        input = argv[1];
-    } else {
+    if (!watch_dir.empty()) {
+        FILE *wres = nullptr;
+        if (!results_path.empty() && !(wres = fopen(results_path.c_str(), "ab"))) {
+            std::cout << "无法写入结果文件: " << results_path << "\n";
+            return 1;
+        }
+        if (!metrics_start_exporter(metrics_textfile, metrics_interval, metrics_listen)) {
+            std::cout << "metrics_listen 监听失败: " << metrics_listen << "\n";
+        }
+        WatchOptions wo;
+        wo.dir = watch_dir;
+        wo.workers = max_inflight;
+        wo.settle_ms = json_get_int(cfg_text, "watch_settle_ms", wo.settle_ms);
+        wo.on_success = json_get_string(cfg_text, "watch_on_success", "keep");
+        wo.done_dir = json_get_string(cfg_text, "watch_done_dir", "");
+        wo.results = wres;
+        int rc = watch_run(ctx, wo);
+        if (wres) fclose(wres);
+        metrics_stop_exporter();
+        if (!trace_path.empty() && !trace_write(trace_path)) {
+            std::cout << "写入trace失败: " << trace_path << "\n";
+        }
+        http_share_cleanup();
+        curl_global_cleanup();
+        return rc;
+    }
+
+    // Upload phase of a sharded run: the prescan manifests decide the inputs.
+    if (!manifests.empty()) {
+        std::unordered_set<std::string> keys;
+        for (const std::string &m : manifests) {
+            if (!manifest_read(m, shard, keys, inputs)) {
+                std::cout << "无法读取manifest: " << m << "\n";
+                return 1;
+            }
+        }
+        log_line("manifest: %zu unique keys for shard %d/%d", inputs.size(), shard.index, shard.count);
+        if (inputs.empty()) {
+            http_share_cleanup();
+            curl_global_cleanup();
+            return 0;
+        }
+    }
+
+    if (inputs.empty()) {
+        std::string input;
         std::cout << "请输入图片地址(本地路径或URL): ";
         std::getline(std::cin, input);
+        inputs.push_back(input);
     }
-    normalize_input_inplace(input);
-    if (input.empty()) {
-        std::cout << "未输入图片地址\n";
-        return 1;
+
+    FILE *results = nullptr;
+    if (!results_path.empty()) {
+        results = fopen(results_path.c_str(), "ab");
+        if (!results) {
+            std::cout << "无法写入结果文件: " << results_path << "\n";
+            return 1;
+        }
     }
 
-    std::vector<unsigned char> orig_bytes;
-    std::string name;
-    std::string content_type;
+    WalkOptions walk;
+    walk.threads = json_get_int(cfg_text, "walk_threads", walk.threads);
+    walk.filter = walk_filter_from_string(json_get_string(cfg_text, "walk_filter", "extension"));
 
-    if (input.rfind("http://", 0) == 0 || input.rfind("https://", 0) == 0) {
-        Buffer resp;
-        long st = 0;
-        if (!http_get_bytes(input, nullptr, resp, st) || st < 200 || st >= 300) {
-            std::cout << "上传失败: download failed\n";
+    FILE *prescan = nullptr;
+    if (!prescan_path.empty()) {
+        prescan = fopen(prescan_path.c_str(), "wb");
+        if (!prescan) {
+            std::cout << "无法写入prescan文件: " << prescan_path << "\n";
             return 1;
         }
-        orig_bytes.assign(resp.data.begin(), resp.data.end());
-        name = basename_from_path_or_url(input);
-    } else {
-        if (!read_bin_file(input, orig_bytes)) {
-            std::cout << "上传失败: could not read file\n";
+    }
+
+    Journal journal;
+    if (!journal_path.empty()) {
+        if (!journal.open(journal_path, json_get_int(cfg_text, "journal_sync_ms", 200))) {
+            std::cout << "无法打开journal: " << journal_path << "\n";
             return 1;
         }
-        name = basename_from_path_or_url(input);
-        content_type = "application/octet-stream";
+        ctx.journal = &journal;
     }
 
-    std::vector<unsigned char> upload_bytes = orig_bytes;
-    std::string mime_type;
-    std::string ext;
+    // Started once nothing above can fail: its threads must be stopped
+    // before main() returns.
+    if (!metrics_start_exporter(metrics_textfile, metrics_interval, metrics_listen)) {
+        std::cout << "metrics_listen 监听失败: " << metrics_listen << "\n";
+    }
 
-    if (enable_webp) {
-        std::vector<unsigned char> wb;
-        int q = (webp_quality <= 0 || webp_quality > 100) ? 95 : webp_quality;
-        if (!run_cwebp(upload_bytes, q, wb)) {
-            std::cout << "上传失败: cwebp failed (install cwebp or set enable_webp=false)\n";
-            return 1;
+    // Explicit inputs, then directory trees, from one producer thread so a
+    // long input list cannot fill the feed before the workers start. Paths
+    // from manifests were already assigned by key and are not re-sharded.
+    InputFeed feed;
+    feed.producers = 1;
+    bool by_path = shard.active() && manifests.empty();
+    std::vector<std::string> dirs;
+    for (const std::string &in : inputs) {
+        std::string p = in;
+        normalize_input_inplace(p);
+        if (!p.empty() && p.rfind("http://", 0) != 0 && p.rfind("https://", 0) != 0 && is_directory(p)) {
+            dirs.push_back(p);
         }
-        upload_bytes.swap(wb);
-        mime_type = "image/webp";
-        ext = "webp";
-    } else {
-        mime_type = content_type.empty() ? "application/octet-stream" : content_type;
-        size_t dot = name.find_last_of('.');
-        if (dot != std::string::npos && dot + 1 < name.size()) ext = name.substr(dot + 1);
-        else ext = "bin";
     }
+    std::thread producer([&]() {
+        for (const std::string &in : inputs) {
+            std::string p = in;
+            normalize_input_inplace(p);
+            if (std::find(dirs.begin(), dirs.end(), p) != dirs.end()) continue;
+            if (by_path && !shard.owns_path(p)) continue;
+            feed.push(in);
+        }
+        for (const std::string &d : dirs) {
+            size_t n = walk_tree(d, walk, [&](const std::string &path) {
+                if (!by_path || shard.owns_path(path)) feed.push(path);
+            });
+            log_line("walk: %zu files under %s", n, d.c_str());
+        }
+        feed.producer_done();
+    });
 
-    std::string md5v = md5_hex(upload_bytes.data(), upload_bytes.size());
-    std::string key = md5v + "." + ext;
+    std::atomic<int> failed{0};
+    std::atomic<size_t> skipped{0};
+    std::mutex out_mu;
 
-    std::string utoken = get_qiniu_upload_token(user_token, qiniu_token_url);
-    if (utoken.empty()) {
-        std::cout << "上传失败: qiniu-token failed\n";
-        return 1;
-    }
+    auto prescan_record = [&](const std::string &input, bool ok, const ItemResult &res) {
+        std::lock_guard<std::mutex> lk(out_mu);
+        if (ok) {
+            fputs(manifest_line(res.key, res.bytes, input).c_str(), prescan);
+        } else {
+            failed.fetch_add(1);
+            std::cout << "扫描失败: " << input << ": " << res.error << "\n";
+        }
+    };
 
-    std::string host = query_upload_host(utoken, bucket);
-    std::string upload_url = "https://" + host;
+    // False for inputs an earlier run already finished.
+    auto admit = [&](const std::string &input) {
+        if (ctx.journal && !input.empty()) {
+            if (journal.done(input)) {
+                skipped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            journal.queued(input);
+        }
+        return true;
+    };
 
-    std::string up_resp;
-    long st = 0;
-    bool ok = upload_once(upload_url, utoken, key, upload_bytes, mime_type, up_resp, st);
-    if (!ok || st < 200 || st >= 300) {
-        if (up_resp.find("no such domain") != std::string::npos) {
-            upload_url = std::string("https://") + DEFAULT_UPLOAD_HOST;
-            ok = upload_once(upload_url, utoken, key, upload_bytes, mime_type, up_resp, st);
+    auto record = [&](const std::string &input, bool ok, const ItemResult &res, double ms) {
+        if (ok) metrics().items_ok.fetch_add(1, std::memory_order_relaxed);
+        else metrics().items_failed.fetch_add(1, std::memory_order_relaxed);
+        if (!ok) failed.fetch_add(1);
+        if (ok && ctx.journal) journal.uploaded(input, res.key);
+
+        std::lock_guard<std::mutex> lk(out_mu);
+        if (input.empty()) {
+            std::cout << "未输入图片地址\n";
+        } else if (!ok) {
+            std::cout << "上传失败: " << res.error << "\n";
+        } else {
+            std::cout << "上传成功\n";
+            std::cout << "response_json:\n";
+            json_pretty_print(res.resp);
         }
-    }
+        if (results) write_result_line(results, input, ok, res, ms);
+    };
 
-    if (!ok || st < 200 || st >= 300) {
-        std::cout << "上传失败: qiniu upload failed: " << st << " " << up_resp << "\n";
-        return 1;
-    }
+    // Uploads one admitted input; returns how long it took in ms.
+    auto upload_one = [&](const std::string &input) {
+        auto t0 = std::chrono::steady_clock::now();
+        ItemResult res;
+        bool ok;
+        if (input.empty()) {
+            res.error = "empty input";
+            ok = false;
+        } else {
+            ok = upload_item(ctx, input, res);
+        }
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - t0;
+        record(input, ok, res, ms.count());
+        return ms.count();
+    };
 
-    std::cout << "上传成功\n";
-    std::cout << "response_json:\n";
-    json_pretty_print(up_resp);
+    auto worker = [&]() {
+        std::string input;
+        long id = 0;
+        while (feed.pop(input, id)) {
+            trace_set_item(id);
+            normalize_input_inplace(input);
+            if (!admit(input)) continue;
+
+            if (prescan) {
+                ItemResult res;
+                prescan_record(input, hash_item(ctx, input, res), res);
+                continue;
+            }
+            upload_one(input);
+        }
+    };
 
+    size_t nthreads = static_cast<size_t>(max_inflight);
+    if (dirs.empty()) nthreads = std::min(nthreads, inputs.size());
+    if (prescan && !ctx.enable_webp) {
+        // Without webp the key is the MD5 of the file itself, so local files
+        // are read in bulk and hashed as their chunks arrive. URLs still go
+        // through hash_item() on this thread.
+        BulkHashOptions bulk;
+        bulk.queue_depth = json_get_int(cfg_text, "prescan_queue_depth", bulk.queue_depth);
+        bulk.chunk_size = static_cast<size_t>(std::max(4, json_get_int(cfg_text, "prescan_chunk_kb", 256))) << 10;
+        bulk.hash_threads = json_get_int(cfg_text, "prescan_hash_threads",
+                                         std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+        bulk.use_io_uring = json_get_bool(cfg_text, "prescan_io_uring", true);
+        auto next = [&](std::string &path) {
+            long id = 0;
+            while (feed.pop(path, id)) {
+                normalize_input_inplace(path);
+                if (!admit(path)) continue;
+                if (!path.empty() && path.rfind("http://", 0) != 0 && path.rfind("https://", 0) != 0) return true;
+                ItemResult res;
+                bool ok = !path.empty() && hash_item(ctx, path, res);
+                if (path.empty()) res.error = "empty input";
+                prescan_record(path, ok, res);
+            }
+            return false;
+        };
+        bulk_hash_files(bulk, next, [&](const BulkHashResult &r) {
+            ItemResult res;
+            res.error = r.error;
+            if (r.ok) {
+                res.key = object_key(r.md5, basename_from_path_or_url(r.path));
+                res.bytes = static_cast<size_t>(r.size);
+                if (ctx.journal) journal.hashed(r.path, res.key);
+            }
+            prescan_record(r.path, r.ok, res);
+        });
+    } else if (!prescan && json_get_string(cfg_text, "schedule", "fifo") == "size") {
+        // Every input is listed and sized before the first upload, then the
+        // large lanes start on the biggest files while the other workers
+        // work up from the smallest.
+        std::vector<SizedItem> items;
+        SizedItem item;
+        while (feed.pop(item.input, item.id)) {
+            normalize_input_inplace(item.input);
+            if (!admit(item.input)) continue;
+            item.id = static_cast<long>(items.size());
+            items.push_back(item);
+        }
+        stat_sizes(items);
+        size_t workers = std::max<size_t>(1, nthreads);
+        int lanes = json_get_int(cfg_text, "schedule_large_lanes", 0);
+        size_t large = lanes > 0 ? std::min(workers, static_cast<size_t>(lanes)) : plan_large_lanes(items, workers);
+        uint64_t total = 0;
+        for (const SizedItem &it : items) total += it.size;
+        log_line("schedule: %zu items, %.1f MiB, %zu of %zu workers start from the largest", items.size(),
+                 total / 1048576.0, large, workers);
+
+        std::vector<double> took(items.size());
+        SizeSchedule order(items);
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<std::thread> pool;
+        for (size_t w = 0; w < workers; w++) {
+            pool.emplace_back([&, w] {
+                SizedItem it;
+                while (order.take(w < large, it)) {
+                    trace_set_item(it.id);
+                    took[static_cast<size_t>(it.id)] = upload_one(it.input);
+                }
+            });
+        }
+        for (std::thread &t : pool) t.join();
+        std::chrono::duration<double> wall = std::chrono::steady_clock::now() - t0;
+
+        // The measured item times replayed both ways, so the two orders are
+        // compared on the same uploads.
+        std::vector<size_t> by_size(items.size());
+        for (size_t i = 0; i < by_size.size(); i++) by_size[i] = i;
+        std::stable_sort(by_size.begin(), by_size.end(), [&](size_t a, size_t b) { return items[a].size > items[b].size; });
+        std::vector<double> sized_ms;
+        for (size_t i : by_size) sized_ms.push_back(took[i]);
+        log_line("schedule: done in %.2f s; replaying item times on %zu workers gives %.2f s by size, %.2f s in input order",
+                 wall.count(), workers, simulate_makespan(sized_ms, workers, large) / 1000,
+                 simulate_makespan(took, workers, workers) / 1000);
+    } else if (nthreads <= 1) {
+        worker();
+    } else if (!prescan && json_get_bool(cfg_text, "staged_pipeline", true)) {
+        // Each stage on the executor that suits it: local reads, webp and
+        // hashing on a CPU pool sized to the cores, downloads and uploads on
+        // max_inflight IO workers. A CPU worker waits when the IO queue is
+        // full, and this thread when the CPU one is, so memory stays bounded
+        // by the queue depths. Downloads hand over to the CPU pool without
+        // waiting: IO workers blocked on CPU workers blocked on IO would
+        // deadlock.
+        size_t cpu_threads = static_cast<size_t>(std::max(
+            1, json_get_int(cfg_text, "cpu_threads", static_cast<int>(std::thread::hardware_concurrency()))));
+        int depth = json_get_int(cfg_text, "stage_queue_depth", 0);
+        Executor cpu("cpu", cpu_threads, depth > 0 ? depth : cpu_threads * 2);
+        Executor io("io", nthreads, depth > 0 ? depth : nthreads * 2);
+
+        std::mutex left_mu;
+        std::condition_variable left_cv;
+        size_t left = 0;
+        auto finish = [&](const std::shared_ptr<StagedJob> &j, bool ok) {
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - j->t0;
+            record(j->input, ok, j->item.res, ms.count());
+            std::lock_guard<std::mutex> lk(left_mu);
+            if (--left == 0) left_cv.notify_all();
+        };
+        auto send = [&](const std::shared_ptr<StagedJob> &j) {
+            trace_set_item(j->id);
+            finish(j, send_item(ctx, j->item));
+        };
+        auto encode = [&](const std::shared_ptr<StagedJob> &j) {
+            trace_set_item(j->id);
+            if (!encode_item(ctx, j->item)) return finish(j, false);
+            io.submit([&send, j] { send(j); });
+        };
+
+        std::string input;
+        long id = 0;
+        while (feed.pop(input, id)) {
+            normalize_input_inplace(input);
+            if (!admit(input)) continue;
+            auto j = std::make_shared<StagedJob>();
+            j->input = input;
+            j->id = id;
+            j->t0 = std::chrono::steady_clock::now();
+            {
+                std::lock_guard<std::mutex> lk(left_mu);
+                left++;
+            }
+            if (input.empty()) {
+                j->item.res.error = "empty input";
+                finish(j, false);
+                continue;
+            }
+            bool url = input.rfind("http://", 0) == 0 || input.rfind("https://", 0) == 0;
+            (url ? io : cpu).submit([&, j, url] {
+                trace_set_item(j->id);
+                if (!fetch_item(ctx, j->input, j->item)) return finish(j, false);
+                if (url) cpu.submit([&encode, j] { encode(j); }, false);
+                else encode(j);
+            });
+        }
+        {
+            std::unique_lock<std::mutex> lk(left_mu);
+            left_cv.wait(lk, [&] { return left == 0; });
+        }
+        cpu.shutdown();
+        io.shutdown();
+        for (const ExecutorStats &es : executor_stats()) {
+            log_line("executor %s: %llu tasks on %zu threads, %llu stolen, peak queue %zu, %llu backpressure waits",
+                     es.name.c_str(), static_cast<unsigned long long>(es.executed), es.threads,
+                     static_cast<unsigned long long>(es.steals), es.peak_queued,
+                     static_cast<unsigned long long>(es.backpressure_waits));
+        }
+    } else {
+        std::vector<std::thread> pool;
+        for (size_t i = 0; i < nthreads; i++) pool.emplace_back(worker);
+        for (std::thread &t : pool) t.join();
+    }
+    producer.join();
+    if (prescan && fclose(prescan) != 0) {
+        std::cout << "写入prescan文件失败: " << prescan_path << "\n";
+        failed.fetch_add(1);
+    }
+    if (ctx.journal) {
+        journal.close();
+        if (skipped.load() > 0) log_line("journal: skipped %zu items finished by an earlier run", skipped.load());
+    }
+
+    if (results) fclose(results);
+    BufferPoolStats pool = buffer_pool_stats();
+    if (pool.acquires > 0) {
+        log_line("buffer pool: %llu buffers, %.1f%% recycled, peak %.1f MiB, %llu payload copies",
+                 static_cast<unsigned long long>(pool.acquires), 100.0 * pool.hits / pool.acquires,
+                 pool.peak_bytes / 1048576.0, static_cast<unsigned long long>(pool.copies));
+    }
+    metrics_stop_exporter();
+    if (!trace_path.empty() && !trace_write(trace_path)) {
+        std::cout << "写入trace失败: " << trace_path << "\n";
+    }
+    http_share_cleanup();
     curl_global_cleanup();
-    return 0;
+    return failed.load() == 0 ? 0 : 1;
 }
@@ -0,0 +1,139 @@
+#include "mapped.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#else
+#include <sys/mount.h>
+#include <sys/param.h>
+#endif
+#endif
+
+#ifndef _WIN32
+// Whether `fd` lives on a filesystem that other machines write to.
+static bool on_network_fs(int fd) {
+#ifdef __linux__
+    struct statfs fs;
+    if (fstatfs(fd, &fs) != 0) return false;
+    switch (static_cast<uint32_t>(fs.f_type)) {
+    case 0x6969u:     // NFS
+    case 0x517Bu:     // SMB
+    case 0xFF534D42u: // CIFS
+    case 0xFE534D42u: // SMB2
+    case 0x65735546u: // FUSE (sshfs, s3fs, ...)
+    case 0x00C36400u: // Ceph
+    case 0x6B414653u: // AFS
+    case 0x47504653u: // GPFS
+    case 0x0BD00BD0u: // Lustre
+        return true;
+    default:
+        return false;
+    }
+#else
+    struct statfs fs;
+    if (fstatfs(fd, &fs) != 0) return false;
+    static const char *const remote[] = {"nfs", "smbfs", "afpfs", "webdav", "macfuse", "osxfuse"};
+    for (const char *name : remote) {
+        if (strcmp(fs.f_fstypename, name) == 0) return true;
+    }
+    return false;
+#endif
+}
+#endif
+
+MappedFile::MappedFile(MappedFile &&o) noexcept { *this = std::move(o); }
+
+MappedFile &MappedFile::operator=(MappedFile &&o) noexcept {
+    if (this != &o) {
+        close();
+        ptr_ = o.ptr_;
+        size_ = o.size_;
+        map_ = o.map_;
+#ifdef _WIN32
+        mapping_ = o.mapping_;
+        o.mapping_ = nullptr;
+#endif
+        buf_.swap(o.buf_);
+        if (!map_) ptr_ = buf_.data();
+        o.ptr_ = nullptr;
+        o.size_ = 0;
+        o.map_ = nullptr;
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() { close(); }
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (map_) UnmapViewOfFile(map_);
+    if (mapping_) CloseHandle(mapping_);
+    mapping_ = nullptr;
+#else
+    if (map_) munmap(map_, size_);
+#endif
+    map_ = nullptr;
+    ptr_ = nullptr;
+    size_ = 0;
+    buf_.reset();
+}
+
+bool MappedFile::open(const std::string &path, bool allow_map) {
+    close();
+#ifdef _WIN32
+    HANDLE h = allow_map ? CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                       FILE_FLAG_SEQUENTIAL_SCAN, nullptr)
+                         : INVALID_HANDLE_VALUE;
+    if (h != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER sz;
+        if (GetFileSizeEx(h, &sz) && sz.QuadPart > 0 && static_cast<uint64_t>(sz.QuadPart) <= SIZE_MAX) {
+            mapping_ = CreateFileMappingA(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_) map_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+            if (map_) {
+                size_ = static_cast<size_t>(sz.QuadPart);
+            } else if (mapping_) {
+                CloseHandle(mapping_);
+                mapping_ = nullptr;
+            }
+        }
+        CloseHandle(h);
+    }
+#else
+    int fd = allow_map ? ::open(path.c_str(), O_RDONLY | O_CLOEXEC) : -1;
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+            static_cast<uint64_t>(st.st_size) <= SIZE_MAX && !on_network_fs(fd)) {
+            void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                map_ = p;
+                size_ = static_cast<size_t>(st.st_size);
+#ifdef MADV_SEQUENTIAL
+                madvise(p, size_, MADV_SEQUENTIAL);
+#endif
+            }
+        }
+        ::close(fd);
+    }
+#endif
+    if (map_) {
+        ptr_ = static_cast<const unsigned char *>(map_);
+        return true;
+    }
+    if (!read_bin_file(path, buf_)) return false;
+    ptr_ = buf_.data();
+    size_ = buf_.size();
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "bufpool.h"
+
+// Read-only view of a whole local file. The file is memory-mapped (with
+// MADV_SEQUENTIAL on POSIX) so a file already in the page cache is hashed
+// and sent without being copied; if mapping is not possible (empty files,
+// pipes) it is read into memory instead. A mapped file that shrinks under
+// the reader raises SIGBUS, so files on network filesystems (NFS, SMB,
+// FUSE and the like), where another machine can do that at any time, are
+// always read, and `allow_map` false reads any file.
+struct MappedFile {
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&o) noexcept;
+    MappedFile &operator=(MappedFile &&o) noexcept;
+    ~MappedFile();
+
+    bool open(const std::string &path, bool allow_map = true);
+    void close();
+
+    const unsigned char *data() const { return ptr_; }
+    size_t size() const { return size_; }
+    ByteView view() const { return ByteView{ptr_, size_}; }
+    bool mapped() const { return map_ != nullptr; }
+
+private:
+    const unsigned char *ptr_ = nullptr;
+    size_t size_ = 0;
+    void *map_ = nullptr;           // mapping base, or null when buffered
+#ifdef _WIN32
+    void *mapping_ = nullptr;       // file mapping handle
+#endif
+    PoolBuffer buf_;                // fallback storage
+};
@@ -0,0 +1,336 @@
+#include "metrics.h"
+
+#include "bufpool.h"
+#include "trace.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+typedef SOCKET sock_t;
+#define SOCK_INVALID INVALID_SOCKET
+#define sock_close closesocket
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int sock_t;
+#define SOCK_INVALID (-1)
+#define sock_close close
+#endif
+
+static const double BUCKET_BOUNDS[HISTOGRAM_BUCKETS] = {
+    0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60
+};
+
+const char *phase_name(Phase p) {
+    switch (p) {
+    case PHASE_DOWNLOAD: return "download";
+    case PHASE_READ: return "read";
+    case PHASE_ENCODE: return "encode";
+    case PHASE_HASH: return "hash";
+    case PHASE_TOKEN: return "token";
+    case PHASE_QUERY: return "query";
+    case PHASE_UPLOAD: return "upload";
+    default: return "unknown";
+    }
+}
+
+void Histogram::observe(double seconds) {
+    int i = 0;
+    while (i < HISTOGRAM_BUCKETS && seconds > BUCKET_BOUNDS[i]) i++;
+    buckets[i].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum_us.fetch_add(static_cast<uint64_t>(seconds * 1e6), std::memory_order_relaxed);
+}
+
+Metrics &metrics() {
+    static Metrics m;
+    return m;
+}
+
+void metrics_http_status(long status) {
+    long cls = status / 100;
+    if (cls < 1 || cls > 6) cls = 0;
+    metrics().http_status[cls].fetch_add(1, std::memory_order_relaxed);
+}
+
+PhaseTimer::PhaseTimer(Phase p)
+    : phase(p), start(std::chrono::steady_clock::now()), trace_start(trace_enabled() ? trace_now_us() : 0) {}
+
+PhaseTimer::~PhaseTimer() {
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    metrics().phase[phase].observe(d.count());
+    if (trace_enabled()) trace_complete(phase_name(phase), trace_start, trace_now_us() - trace_start);
+}
+
+static std::mutex g_collectors_mu;
+static std::vector<std::string (*)()> g_collectors;
+
+void metrics_add_collector(std::string (*fn)()) {
+    std::lock_guard<std::mutex> lk(g_collectors_mu);
+    g_collectors.push_back(fn);
+}
+
+static uint64_t load(const std::atomic<uint64_t> &v) { return v.load(std::memory_order_relaxed); }
+
+static void put_counter(std::ostringstream &os, const char *name, const char *help, uint64_t v) {
+    os << "# HELP " << name << " " << help << "\n";
+    os << "# TYPE " << name << " counter\n";
+    os << name << " " << v << "\n";
+}
+
+static void put_gauge(std::ostringstream &os, const char *name, const char *help, uint64_t v) {
+    os << "# HELP " << name << " " << help << "\n";
+    os << "# TYPE " << name << " gauge\n";
+    os << name << " " << v << "\n";
+}
+
+std::string Metrics::render() const {
+    std::ostringstream os;
+
+    os << "# HELP imgutil_items_total Items processed, by result.\n";
+    os << "# TYPE imgutil_items_total counter\n";
+    os << "imgutil_items_total{result=\"ok\"} " << load(items_ok) << "\n";
+    os << "imgutil_items_total{result=\"failed\"} " << load(items_failed) << "\n";
+
+    put_counter(os, "imgutil_uploaded_bytes_total", "Bytes sent in successful uploads.", load(bytes_uploaded));
+    put_counter(os, "imgutil_dedup_hits_total", "Uploads skipped because the key already existed.", load(dedup_hits));
+    put_counter(os, "imgutil_retries_total", "Request attempts beyond the first.", load(retries));
+    put_counter(os, "imgutil_hedged_uploads_total", "Uploads that started a second host.", load(hedges));
+    put_counter(os, "imgutil_hedge_wins_total", "Hedged uploads won by a later host.", load(hedge_wins));
+    put_counter(os, "imgutil_webp_saved_bytes_total", "Bytes saved by webp re-encoding.", load(webp_bytes_saved));
+    put_counter(os, "imgutil_upload_connections_total", "Connections opened for uploads; with HTTP/2 many uploads share one.",
+                load(upload_connections));
+
+    static const char *classes[7] = {"error", "1xx", "2xx", "3xx", "4xx", "5xx", "6xx"};
+    os << "# HELP imgutil_http_responses_total HTTP responses, by status class.\n";
+    os << "# TYPE imgutil_http_responses_total counter\n";
+    for (int i = 0; i < 7; i++) {
+        os << "imgutil_http_responses_total{class=\"" << classes[i] << "\"} " << load(http_status[i]) << "\n";
+    }
+
+    os << "# HELP imgutil_phase_seconds Time spent per pipeline phase.\n";
+    os << "# TYPE imgutil_phase_seconds histogram\n";
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        const Histogram &h = phase[p];
+        const char *pn = phase_name(static_cast<Phase>(p));
+        uint64_t cum = 0;
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            cum += load(h.buckets[i]);
+            os << "imgutil_phase_seconds_bucket{phase=\"" << pn << "\",le=\"" << BUCKET_BOUNDS[i] << "\"} " << cum << "\n";
+        }
+        cum += load(h.buckets[HISTOGRAM_BUCKETS]);
+        os << "imgutil_phase_seconds_bucket{phase=\"" << pn << "\",le=\"+Inf\"} " << cum << "\n";
+        os << "imgutil_phase_seconds_sum{phase=\"" << pn << "\"} " << static_cast<double>(load(h.sum_us)) / 1e6 << "\n";
+        os << "imgutil_phase_seconds_count{phase=\"" << pn << "\"} " << cum << "\n";
+    }
+
+    BufferPoolStats pool = buffer_pool_stats();
+    put_counter(os, "imgutil_buffer_pool_acquires_total", "Item buffers taken from the pool.", pool.acquires);
+    put_counter(os, "imgutil_buffer_pool_hits_total", "Item buffers served from a recycled block.", pool.hits);
+    put_gauge(os, "imgutil_buffer_pool_in_use_bytes", "Bytes held by live item buffers.", pool.in_use_bytes);
+    put_gauge(os, "imgutil_buffer_pool_peak_bytes", "High-water mark of imgutil_buffer_pool_in_use_bytes.", pool.peak_bytes);
+    put_gauge(os, "imgutil_buffer_pool_cached_bytes", "Idle blocks kept for reuse.", pool.cached_bytes);
+    put_counter(os, "imgutil_payload_copies_total", "Item payloads copied to a second buffer in memory.", pool.copies);
+    put_counter(os, "imgutil_payload_copied_bytes_total", "Bytes in imgutil_payload_copies_total.", pool.copied_bytes);
+
+    os << "# HELP imgutil_last_update_timestamp_seconds When this snapshot was taken.\n";
+    os << "# TYPE imgutil_last_update_timestamp_seconds gauge\n";
+    os << "imgutil_last_update_timestamp_seconds " << static_cast<unsigned long long>(time(nullptr)) << "\n";
+
+    std::lock_guard<std::mutex> lk(g_collectors_mu);
+    for (auto fn : g_collectors) os << fn();
+    return os.str();
+}
+
+bool metrics_write_textfile(const std::string &path) {
+    std::string body = metrics().render();
+    char tmp[1024];
+#ifdef _WIN32
+    snprintf(tmp, sizeof(tmp), "%s.%lu.tmp", path.c_str(), static_cast<unsigned long>(GetCurrentProcessId()));
+#else
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path.c_str(), static_cast<long>(getpid()));
+#endif
+
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return false;
+    bool ok = fwrite(body.data(), 1, body.size(), f) == body.size();
+    ok = fflush(f) == 0 && ok;
+#ifndef _WIN32
+    ok = fsync(fileno(f)) == 0 && ok;
+#endif
+    fclose(f);
+    if (!ok) {
+        remove(tmp);
+        return false;
+    }
+
+#ifdef _WIN32
+    if (!MoveFileExA(tmp, path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+#else
+    if (rename(tmp, path.c_str()) != 0) {
+#endif
+        remove(tmp);
+        return false;
+    }
+    return true;
+}
+
+static std::mutex g_exp_mu;
+static std::condition_variable g_exp_cv;
+static bool g_exp_stop = false;
+static std::thread g_exp_writer;
+static std::thread g_exp_server;
+static std::string g_exp_textfile;
+static sock_t g_exp_sock = SOCK_INVALID;
+
+static sock_t listen_on(const std::string &spec) {
+    std::string host = "127.0.0.1";
+    std::string port = spec;
+    size_t colon = spec.rfind(':');
+    if (colon != std::string::npos) {
+        host = spec.substr(0, colon);
+        port = spec.substr(colon + 1);
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<unsigned short>(atoi(port.c_str())));
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return SOCK_INVALID;
+
+    sock_t s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == SOCK_INVALID) return SOCK_INVALID;
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&one), sizeof(one));
+    if (bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(s, 16) != 0) {
+        sock_close(s);
+        return SOCK_INVALID;
+    }
+    return s;
+}
+
+// Scrapes are served one at a time, so a client that connects and then
+// says nothing may hold the exporter only this long.
+static void set_io_timeout(sock_t c, int ms) {
+#ifdef _WIN32
+    DWORD tv = static_cast<DWORD>(ms);
+#else
+    timeval tv = {ms / 1000, (ms % 1000) * 1000};
+#endif
+    setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&tv), sizeof(tv));
+    setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char *>(&tv), sizeof(tv));
+}
+
+static void serve_one(sock_t c) {
+    set_io_timeout(c, 2000);
+    char req[2048];
+    int n = static_cast<int>(recv(c, req, sizeof(req) - 1, 0));
+    if (n <= 0) return;
+    req[n] = 0;
+
+    std::string head;
+    std::string body;
+    if (strncmp(req, "GET /metrics", 12) == 0 || strncmp(req, "GET / ", 6) == 0) {
+        body = metrics().render();
+        head = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n";
+    } else {
+        body = "not found\n";
+        head = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n";
+    }
+    head += "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    head += body;
+
+    const char *p = head.data();
+    size_t left = head.size();
+    while (left > 0) {
+        int w = static_cast<int>(send(c, p, static_cast<int>(left), 0));
+        if (w <= 0) break;
+        p += w;
+        left -= static_cast<size_t>(w);
+    }
+}
+
+static void server_loop() {
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lk(g_exp_mu);
+            if (g_exp_stop) return;
+        }
+#ifdef _WIN32
+        fd_set rd;
+        FD_ZERO(&rd);
+        FD_SET(g_exp_sock, &rd);
+        timeval tv = {0, 200000};
+        if (select(0, &rd, nullptr, nullptr, &tv) <= 0) continue;
+#else
+        pollfd pfd = {g_exp_sock, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+#endif
+        sock_t c = accept(g_exp_sock, nullptr, nullptr);
+        if (c == SOCK_INVALID) continue;
+        serve_one(c);
+        sock_close(c);
+    }
+}
+
+static void writer_loop(int interval_sec) {
+    std::unique_lock<std::mutex> lk(g_exp_mu);
+    for (;;) {
+        bool stop = g_exp_cv.wait_for(lk, std::chrono::seconds(interval_sec), [] { return g_exp_stop; });
+        lk.unlock();
+        metrics_write_textfile(g_exp_textfile);
+        lk.lock();
+        if (stop) return;
+    }
+}
+
+bool metrics_start_exporter(const std::string &textfile, int interval_sec, const std::string &listen) {
+    g_exp_stop = false;
+    g_exp_textfile = textfile;
+
+    // The textfile does not depend on the listener, so it is written even
+    // when the port cannot be bound.
+    if (!textfile.empty()) {
+        if (interval_sec <= 0) interval_sec = 15;
+        g_exp_writer = std::thread(writer_loop, interval_sec);
+    }
+    if (!listen.empty()) {
+#ifdef _WIN32
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+        g_exp_sock = listen_on(listen);
+        if (g_exp_sock == SOCK_INVALID) return false;
+        g_exp_server = std::thread(server_loop);
+    }
+    return true;
+}
+
+void metrics_stop_exporter() {
+    {
+        std::lock_guard<std::mutex> lk(g_exp_mu);
+        g_exp_stop = true;
+    }
+    g_exp_cv.notify_all();
+    if (g_exp_writer.joinable()) g_exp_writer.join();
+    if (g_exp_server.joinable()) g_exp_server.join();
+    if (g_exp_sock != SOCK_INVALID) {
+        sock_close(g_exp_sock);
+        g_exp_sock = SOCK_INVALID;
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+enum Phase {
+    PHASE_DOWNLOAD,
+    PHASE_READ,
+    PHASE_ENCODE,
+    PHASE_HASH,
+    PHASE_TOKEN,
+    PHASE_QUERY,
+    PHASE_UPLOAD,
+    PHASE_COUNT
+};
+
+const char *phase_name(Phase p);
+
+static const int HISTOGRAM_BUCKETS = 13;
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS + 1] = {};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum_us{0};
+
+    void observe(double seconds);
+};
+
+// Process-wide counters. Everything is a relaxed atomic so the upload path
+// never takes a lock to record a sample.
+struct Metrics {
+    std::atomic<uint64_t> items_ok{0};
+    std::atomic<uint64_t> items_failed{0};
+    std::atomic<uint64_t> bytes_uploaded{0};
+    std::atomic<uint64_t> dedup_hits{0};
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> hedges{0};
+    std::atomic<uint64_t> hedge_wins{0};
+    std::atomic<uint64_t> webp_bytes_saved{0};
+    std::atomic<uint64_t> upload_connections{0}; // new connections opened by uploads
+    // [0] = no response, [1..5] = 1xx..5xx, [6] = Qiniu's own 6xx answers
+    std::atomic<uint64_t> http_status[7] = {};
+    Histogram phase[PHASE_COUNT];
+
+    std::string render() const;
+};
+
+Metrics &metrics();
+
+void metrics_http_status(long status);
+
+// Records the enclosing scope into the phase histogram and, when tracing is
+// on, as a trace span of the same name.
+struct PhaseTimer {
+    explicit PhaseTimer(Phase p);
+    ~PhaseTimer();
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+    uint64_t trace_start;
+};
+
+// Adds a function whose output is appended to every render(), for state
+// that lives outside Metrics (e.g. per-host breakers).
+void metrics_add_collector(std::string (*fn)());
+
+bool metrics_write_textfile(const std::string &path);
+
+// Starts the background exporter: rewrites `textfile` every `interval_sec`
+// and/or serves GET /metrics on `listen` ("port" or "host:port"). False
+// when `listen` cannot be bound; the textfile is written regardless, so
+// metrics_stop_exporter() is due either way.
+bool metrics_start_exporter(const std::string &textfile, int interval_sec, const std::string &listen);
+void metrics_stop_exporter();
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+static constexpr size_t MPMC_CACHE_LINE = 64;
+
+// Bounded multi-producer multi-consumer ring after Dmitry Vyukov's design.
+// Every cell carries a sequence number saying whose turn it is, so a
+// producer or consumer claims a slot with one CAS on its own index and no
+// lock; the two indices and the waiter counts sit on separate cache lines
+// so producers and consumers do not bounce each other's lines. Capacity is
+// rounded up to a power of two.
+//
+// try_push()/try_pop() never block. push()/pop() retry for a while and
+// then park on a condition variable; the mutex is only touched when some
+// thread is actually parked. close(), called after the last push, wakes
+// everyone: push() then fails and pop() fails once the ring is drained.
+template <typename T>
+struct MpmcQueue {
+    explicit MpmcQueue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        mask_ = n - 1;
+        cells_.reset(new Cell[n]);
+        for (size_t i = 0; i < n; i++) cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    MpmcQueue(const MpmcQueue &) = delete;
+    MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Approximate: exact only while no push or pop is in progress.
+    size_t size() const {
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t head = head_.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    // `v` is only moved from when the push succeeds.
+    template <typename U>
+    bool try_push(U &&v) {
+        Cell *c;
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &cells_[pos & mask_];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (dif == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false; // full
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        c->value = std::forward<U>(v);
+        c->seq.store(pos + 1, std::memory_order_release);
+        wake(pop_waiters_, not_empty_);
+        return true;
+    }
+
+    bool try_pop(T &out) {
+        Cell *c;
+        size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            c = &cells_[pos & mask_];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (dif == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false; // empty
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        out = std::move(c->value);
+        c->seq.store(pos + mask_ + 1, std::memory_order_release);
+        wake(push_waiters_, not_full_);
+        return true;
+    }
+
+    // Waits for room; false once closed.
+    template <typename U>
+    bool push(U &&v) {
+        for (int spin = 0;; spin++) {
+            if (closed_.load(std::memory_order_acquire)) return false;
+            if (try_push(std::forward<U>(v))) return true;
+            if (spin < SPINS) {
+                std::this_thread::yield();
+                continue;
+            }
+            park(push_waiters_, not_full_, [&] { return size() < capacity(); });
+            spin = 0;
+        }
+    }
+
+    // Waits for an item; false once closed and drained.
+    bool pop(T &out) {
+        for (int spin = 0;; spin++) {
+            if (try_pop(out)) return true;
+            if (closed_.load(std::memory_order_acquire)) return try_pop(out);
+            if (spin < SPINS) {
+                std::this_thread::yield();
+                continue;
+            }
+            park(pop_waiters_, not_empty_, [&] { return size() > 0; });
+            spin = 0;
+        }
+    }
+
+    void close() {
+        closed_.store(true, std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lk(mu_);
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+    static const int SPINS = 64;
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    // The waiter count goes up before the condition is rechecked under the
+    // lock, and the other side fences before reading it, so either the
+    // parker sees the new state or the waker sees the parker.
+    template <typename Ready>
+    void park(std::atomic<int> &waiters, std::condition_variable &cv, Ready ready) {
+        std::unique_lock<std::mutex> lk(mu_);
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        cv.wait(lk, [&] { return closed_.load(std::memory_order_seq_cst) || ready(); });
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void wake(std::atomic<int> &waiters, std::condition_variable &cv) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) == 0) return;
+        { std::lock_guard<std::mutex> lk(mu_); }
+        cv.notify_one();
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    alignas(MPMC_CACHE_LINE) std::atomic<size_t> head_{0};
+    alignas(MPMC_CACHE_LINE) std::atomic<size_t> tail_{0};
+    alignas(MPMC_CACHE_LINE) std::atomic<int> pop_waiters_{0};
+    std::atomic<int> push_waiters_{0};
+    std::atomic<bool> closed_{false};
+    alignas(MPMC_CACHE_LINE) std::mutex mu_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
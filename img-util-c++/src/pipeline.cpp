@@ -0,0 +1,270 @@
+#include "pipeline.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "metrics.h"
+#include "retry.h"
+#include "util.h"
+#include "webp.h"
+
+static bool fetch_input(UploadContext &ctx,
+                        const std::string &input,
+                        ItemBytes &bytes,
+                        std::string &name,
+                        std::string &content_type,
+                        ItemResult &res) {
+    res.input = input;
+
+    if (input.rfind("http://", 0) == 0 || input.rfind("https://", 0) == 0) {
+        PhaseTimer t(PHASE_DOWNLOAD);
+        long st = 0;
+        if (!http_get_bytes(input, nullptr, bytes.heap, st) || st < 200 || st >= 300) {
+            res.error = "download failed";
+            return false;
+        }
+        bytes.use_heap();
+        name = basename_from_path_or_url(input);
+    } else {
+        PhaseTimer t(PHASE_READ);
+        if (!bytes.file.open(input, ctx.map_files)) {
+            res.error = "could not read file";
+            return false;
+        }
+        bytes.use_file();
+        name = basename_from_path_or_url(input);
+        content_type = "application/octet-stream";
+    }
+    return true;
+}
+
+// Optional webp re-encode, then the content hash that names the object.
+static bool encode_and_hash(UploadContext &ctx,
+                            ItemBytes &bytes,
+                            const std::string &name,
+                            const std::string &content_type,
+                            std::string &mime_type,
+                            ItemResult &res) {
+    std::string ext;
+
+    if (ctx.enable_webp) {
+        PhaseTimer t(PHASE_ENCODE);
+        PoolBuffer wb;
+        int q = (ctx.webp_quality <= 0 || ctx.webp_quality > 100) ? 95 : ctx.webp_quality;
+        if (!run_cwebp(bytes.view, q, wb)) {
+            res.error = "cwebp failed (install cwebp or set enable_webp=false)";
+            return false;
+        }
+        if (wb.size() < bytes.view.size) {
+            metrics().webp_bytes_saved.fetch_add(bytes.view.size - wb.size(), std::memory_order_relaxed);
+        }
+        bytes.heap.swap(wb);
+        bytes.use_heap();
+        mime_type = "image/webp";
+        ext = "webp";
+    } else {
+        mime_type = content_type.empty() ? "application/octet-stream" : content_type;
+    }
+
+    std::string md5v;
+    {
+        PhaseTimer t(PHASE_HASH);
+        md5v = md5_hex(bytes.view.data, bytes.view.size);
+    }
+    res.key = ext.empty() ? object_key(md5v, name) : md5v + "." + ext;
+    res.bytes = bytes.view.size;
+    if (ctx.journal && !res.input.empty()) ctx.journal->hashed(res.input, res.key);
+    return true;
+}
+
+static bool send_encoded(UploadContext &ctx, ItemBytes &bytes, const std::string &mime_type, ItemResult &res);
+
+std::string object_key(const std::string &md5_hex, const std::string &name) {
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot + 1 < name.size()) return md5_hex + "." + name.substr(dot + 1);
+    return md5_hex + ".bin";
+}
+
+bool fetch_item(UploadContext &ctx, const std::string &input, StagedItem &item) {
+    return fetch_input(ctx, input, item.bytes, item.name, item.content_type, item.res);
+}
+
+bool encode_item(UploadContext &ctx, StagedItem &item) {
+    return encode_and_hash(ctx, item.bytes, item.name, item.content_type, item.mime_type, item.res);
+}
+
+bool send_item(UploadContext &ctx, StagedItem &item) { return send_encoded(ctx, item.bytes, item.mime_type, item.res); }
+
+bool upload_item(UploadContext &ctx, const std::string &input, ItemResult &res) {
+    StagedItem item;
+    bool ok = fetch_item(ctx, input, item) && encode_item(ctx, item) && send_item(ctx, item);
+    res = std::move(item.res);
+    return ok;
+}
+
+bool hash_item(UploadContext &ctx, const std::string &input, ItemResult &res) {
+    ItemBytes bytes;
+    std::string name;
+    std::string content_type;
+    std::string mime_type;
+    if (!fetch_input(ctx, input, bytes, name, content_type, res)) return false;
+    return encode_and_hash(ctx, bytes, name, content_type, mime_type, res);
+}
+
+bool upload_bytes(UploadContext &ctx,
+                  PoolBuffer &&bytes,
+                  const std::string &name,
+                  const std::string &content_type,
+                  ItemResult &res) {
+    ItemBytes b;
+    b.heap = std::move(bytes);
+    b.use_heap();
+    std::string mime_type;
+    if (!encode_and_hash(ctx, b, name, content_type, mime_type, res)) return false;
+    return send_encoded(ctx, b, mime_type, res);
+}
+
+bool DedupCache::find(const std::string &key, std::string &resp) {
+    auto it = index_.find(key);
+    if (it == index_.end()) return false;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    resp = it->second->second;
+    return true;
+}
+
+void DedupCache::put(const std::string &key, const std::string &resp) {
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        it->second->second = resp;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return;
+    }
+    entries_.emplace_front(key, resp);
+    index_[key] = entries_.begin();
+    while (index_.size() > std::max<size_t>(1, capacity)) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+}
+
+struct TokenState {
+    std::string utoken;
+    bool stale = true; // missing, or older than token_ttl_sec
+    bool hosts_loaded = false;
+};
+
+static TokenState token_state(UploadContext &ctx) {
+    TokenState t;
+    std::lock_guard<std::mutex> lk(ctx.mu);
+    t.utoken = ctx.utoken;
+    t.stale = ctx.utoken.empty() || (ctx.token_ttl_sec > 0 && std::chrono::steady_clock::now() - ctx.utoken_at >
+                                                                  std::chrono::seconds(ctx.token_ttl_sec));
+    t.hosts_loaded = ctx.hosts_loaded;
+    return t;
+}
+
+// The upload token, fetched when missing or past its TTL, and the host
+// table on first use. One thread fetches at a time and without `ctx.mu`.
+// A token past its TTL is still valid (the TTL is set well inside Qiniu's
+// expiry), so while one thread refreshes it the others carry on with it;
+// only a missing token makes them wait.
+static bool current_token(UploadContext &ctx, std::string &utoken, std::string &error) {
+    TokenState t = token_state(ctx);
+    utoken = t.utoken;
+    if (!t.stale && t.hosts_loaded) return true;
+
+    std::unique_lock<std::mutex> fetch(ctx.fetch_mu, std::defer_lock);
+    if (!t.utoken.empty() && t.hosts_loaded) {
+        if (!fetch.try_lock()) return true;
+    } else {
+        fetch.lock();
+    }
+    t = token_state(ctx); // the previous holder may have fetched already
+    utoken = t.utoken;
+    if (t.stale) {
+        std::string fresh;
+        {
+            PhaseTimer pt(PHASE_TOKEN);
+            fresh = get_qiniu_upload_token(ctx.user_token, ctx.qiniu_token_url);
+        }
+        if (!fresh.empty()) {
+            std::lock_guard<std::mutex> lk(ctx.mu);
+            ctx.utoken = fresh;
+            ctx.utoken_at = std::chrono::steady_clock::now();
+            utoken = fresh;
+        } else if (utoken.empty()) {
+            error = "qiniu-token failed";
+            return false;
+        }
+    }
+    if (!t.hosts_loaded) {
+        PhaseTimer pt(PHASE_QUERY);
+        ctx.hosts.assign(query_upload_hosts(ctx.qiniu_query_url, utoken, ctx.bucket));
+        std::lock_guard<std::mutex> lk(ctx.mu);
+        ctx.hosts_loaded = true;
+    }
+    return true;
+}
+
+bool dedup_hit(UploadContext &ctx, const std::string &key, std::string &resp) {
+    std::lock_guard<std::mutex> lk(ctx.mu);
+    if (!ctx.uploaded.find(key, resp)) return false;
+    metrics().dedup_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool upload_outcome(UploadContext &ctx,
+                    const std::string &utoken,
+                    const std::string &key,
+                    size_t bytes,
+                    bool ok,
+                    long status,
+                    const std::string &resp,
+                    std::string &error) {
+    // 614: the bucket already holds this key, which is as good as uploaded.
+    bool present = ok && status == 614;
+    if (present) metrics().dedup_hits.fetch_add(1, std::memory_order_relaxed);
+
+    if (ok && status == 401) {
+        // Expired or revoked token: make the next item fetch a fresh one.
+        std::lock_guard<std::mutex> lk(ctx.mu);
+        if (ctx.utoken == utoken) ctx.utoken.clear();
+    }
+
+    if (!present && (!ok || status < 200 || status >= 300)) {
+        error = "qiniu upload failed: " + std::to_string(status) + " " + resp;
+        return false;
+    }
+
+    if (!present) metrics().bytes_uploaded.fetch_add(bytes, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lk(ctx.mu);
+    ctx.uploaded.put(key, resp);
+    return true;
+}
+
+static bool send_encoded(UploadContext &ctx, ItemBytes &bytes, const std::string &mime_type, ItemResult &res) {
+    if (dedup_hit(ctx, res.key, res.resp)) return true;
+    std::string utoken;
+    if (!current_token(ctx, utoken, res.error)) return false;
+
+    long st = 0;
+    bool ok;
+    {
+        ctx.limiter.acquire();
+        PhaseTimer t(PHASE_UPLOAD);
+        retry_take_transient();
+        ok = upload_once(ctx.target, utoken, res.key, bytes.view, mime_type, res.resp, st);
+        // Latency per 256 KiB so that big and small files give comparable samples.
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - t.start;
+        double units = std::max(1.0, static_cast<double>(bytes.view.size) / (256.0 * 1024.0));
+        ctx.limiter.release(ms.count() / units, retry_take_transient() > 0);
+    }
+    return upload_outcome(ctx, utoken, res.key, bytes.view.size, ok, st, res.resp, res.error);
+}
+
+
+void write_result_line(FILE *f, const std::string &input, bool ok, const ItemResult &res, double latency_ms) {
+    fprintf(f, "{\"input\":\"%s\",\"ok\":%s,\"key\":\"%s\",\"bytes\":%llu,\"latency_ms\":%.3f}\n",
+            json_escape(input).c_str(), ok ? "true" : "false", json_escape(res.key).c_str(),
+            static_cast<unsigned long long>(res.bytes), latency_ms);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hosts.h"
+#include "journal.h"
+#include "limiter.h"
+#include "mapped.h"
+#include "qiniu.h"
+
+// Keys already uploaded by this process, with the upload response, so a
+// repeat skips the network. Least recently used entries are dropped past
+// `capacity`, which keeps a long-running daemon's memory flat; a dropped
+// key costs one more upload, answered 614 by the bucket. Not thread-safe.
+struct DedupCache {
+    size_t capacity = 65536;
+
+    bool find(const std::string &key, std::string &resp);
+    void put(const std::string &key, const std::string &resp);
+    size_t size() const { return index_.size(); }
+
+private:
+    typedef std::list<std::pair<std::string, std::string>> Entries;
+    Entries entries_; // most recently used first
+    std::unordered_map<std::string, Entries::iterator> index_;
+};
+
+struct UploadContext {
+    std::string user_token;
+    std::string qiniu_token_url;
+    std::string qiniu_query_url;
+    std::string bucket;
+    bool enable_webp = false;
+    int webp_quality = 95;
+    int token_ttl_sec = 1800; // refetch the upload token after this long
+    bool map_files = true;    // false: read local inputs instead of mapping them
+
+    HostTable hosts;
+    UploadTarget target;
+    ConcurrencyLimiter limiter;
+    Journal *journal = nullptr; // optional; gets an H record per hashed item
+
+    // Serialises token and host-table fetches, which run without `mu` so
+    // that dedup lookups and finished uploads never wait on the network.
+    std::mutex fetch_mu;
+    std::mutex mu; // guards everything below
+    std::string utoken;
+    std::chrono::steady_clock::time_point utoken_at;
+    bool hosts_loaded = false;
+    DedupCache uploaded; // key -> response json
+};
+
+struct ItemResult {
+    std::string input;
+    std::string key;
+    std::string resp;
+    std::string error;
+    size_t bytes = 0;
+};
+
+// Bytes of one item, owned exactly once: a mapped local file, or a pooled
+// buffer for downloads, request bodies and webp output. Every stage reads
+// through `view`, which points at whichever owner is live.
+struct ItemBytes {
+    MappedFile file;
+    PoolBuffer heap;
+    ByteView view;
+
+    void use_file() { view = file.view(); }
+    void use_heap() {
+        file.close();
+        view = heap.view();
+    }
+};
+
+// An item between stages, for front-ends that run them on different
+// executors: fetch_item() downloads or maps the input, encode_item() does
+// the optional webp pass and the hash, send_item() dedups and uploads.
+// upload_item() is the three in a row.
+struct StagedItem {
+    ItemBytes bytes;
+    std::string name;
+    std::string content_type;
+    std::string mime_type;
+    ItemResult res;
+};
+
+bool fetch_item(UploadContext &ctx, const std::string &input, StagedItem &item);
+bool encode_item(UploadContext &ctx, StagedItem &item);
+bool send_item(UploadContext &ctx, StagedItem &item);
+
+// Downloads or reads `input` (local path or http(s) URL) and uploads it.
+bool upload_item(UploadContext &ctx, const std::string &input, ItemResult &res);
+
+// Reads and hashes `input` like upload_item() but stops before the upload;
+// only res.key and res.bytes are filled in.
+bool hash_item(UploadContext &ctx, const std::string &input, ItemResult &res);
+
+// Key of an object uploaded without webp: content MD5 plus the extension of
+// `name`, or ".bin" when it has none.
+std::string object_key(const std::string &md5_hex, const std::string &name);
+
+// Looks `key` up in the in-run dedup map; a hit fills `resp` with the
+// earlier answer and is counted as a dedup hit.
+bool dedup_hit(UploadContext &ctx, const std::string &key, std::string &resp);
+// Settles a finished upload of `bytes` bytes under `key`, for every
+// front-end: a 614 (already in the bucket) is a dedup hit, a 401 drops
+// `utoken` so the next item fetches a fresh one, and a success is counted
+// and remembered in the dedup map. Returns false with `error` set otherwise.
+bool upload_outcome(UploadContext &ctx,
+                    const std::string &utoken,
+                    const std::string &key,
+                    size_t bytes,
+                    bool ok,
+                    long status,
+                    const std::string &resp,
+                    std::string &error);
+
+// Uploads bytes that are already in memory; `name` only supplies the file
+// extension used in the key.
+bool upload_bytes(UploadContext &ctx,
+                  PoolBuffer &&bytes,
+                  const std::string &name,
+                  const std::string &content_type,
+                  ItemResult &res);
+
+// One JSON line per item: input, ok, key, bytes, latency_ms.
+void write_result_line(FILE *f, const std::string &input, bool ok, const ItemResult &res, double latency_ms);
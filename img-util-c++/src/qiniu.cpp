@@ -0,0 +1,620 @@
+#include "qiniu.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "breaker.h"
+#include "metrics.h"
+#include "retry.h"
+#include "shaper.h"
+#include "trace.h"
+#include "util.h"
+
+const char *DEFAULT_UPLOAD_HOST = "upload-z2.qiniup.com";
+
+static size_t g_max_download = 0;
+
+static size_t curl_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    auto *b = static_cast<Buffer *>(userdata);
+    b->data.append(ptr, size * nmemb);
+    return size * nmemb;
+}
+
+static size_t pool_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
+    auto *s = static_cast<PoolSink *>(userdata);
+    size_t n = size * nmemb;
+    if (g_max_download && s->buf->size() + n > g_max_download) return 0;
+    if (s->buf->empty()) {
+        curl_off_t len = -1;
+        if (curl_easy_getinfo(s->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len) == CURLE_OK && len > 0) {
+            size_t want = static_cast<size_t>(len);
+            if (g_max_download) want = std::min(want, g_max_download);
+            s->buf->reserve(want);
+        }
+    }
+    s->buf->append(ptr, n);
+    return n;
+}
+
+static CURLSH *g_share = nullptr;
+static std::mutex g_share_mu[CURL_LOCK_DATA_LAST];
+
+static void share_lock(CURL *, curl_lock_data data, curl_lock_access, void *) { g_share_mu[data].lock(); }
+static void share_unlock(CURL *, curl_lock_data data, void *) { g_share_mu[data].unlock(); }
+
+void http_share_init() {
+    if (g_share) return;
+    g_share = curl_share_init();
+    if (!g_share) return;
+    curl_share_setopt(g_share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(g_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+// Multiplexed uploads: one multi handle, driven by its own thread, that
+// takes transfers from any thread. curl only multiplexes transfers that
+// belong to the same multi handle, so per-call multi handles would each
+// open their own connection.
+struct MuxWaiter {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::vector<std::pair<CURL *, CURLcode>> done;
+    int removing = 0;
+};
+
+// A running transfer's waiter, and its body so a paced stream can be
+// resumed once its pause is over.
+struct MuxEntry {
+    MuxWaiter *waiter = nullptr;
+    BodyReader *body = nullptr;
+};
+
+struct MuxDriver {
+    CURLM *multi = nullptr;
+    std::thread th;
+    std::mutex mu;
+    std::vector<std::pair<CURL *, MuxEntry>> adds;
+    std::vector<std::pair<CURL *, MuxWaiter *>> removes;
+    std::map<CURL *, MuxEntry> owners;
+    bool stopping = false;
+
+    void run();
+    int resume_paced();
+};
+
+static MultiplexOptions g_mux_opt;
+static MuxDriver *g_mux = nullptr;
+static std::string g_ca_file;
+
+// Resumes the paced streams whose pause is over and returns how many
+// milliseconds until the next one is due (1000 if none is paused). Only
+// this thread changes `owners`, so it is read here without the lock.
+int MuxDriver::resume_paced() {
+    auto now = std::chrono::steady_clock::now();
+    auto next = now + std::chrono::seconds(1);
+    for (auto &o : owners) {
+        BodyReader *b = o.second.body;
+        if (!b || !b->paused) continue;
+        if (b->resume_at <= now) {
+            b->paused = false;
+            curl_easy_pause(o.first, CURLPAUSE_CONT);
+        }
+        // Resuming may have paused it again, until a later time.
+        if (b->paused) next = std::min(next, b->resume_at);
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+    return static_cast<int>(std::max<long long>(1, ms));
+}
+
+void MuxDriver::run() {
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            for (auto &a : adds) {
+                owners[a.first] = a.second;
+                curl_multi_add_handle(multi, a.first);
+            }
+            adds.clear();
+            for (auto &r : removes) {
+                if (owners.erase(r.first)) curl_multi_remove_handle(multi, r.first);
+                std::lock_guard<std::mutex> wl(r.second->mu);
+                r.second->removing--;
+                r.second->cv.notify_all();
+            }
+            removes.clear();
+            if (stopping && owners.empty()) return;
+        }
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        CURLMsg *msg;
+        int left = 0;
+        while ((msg = curl_multi_info_read(multi, &left)) != nullptr) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            CURL *c = msg->easy_handle;
+            CURLcode rc = msg->data.result;
+            curl_multi_remove_handle(multi, c);
+            MuxWaiter *w = nullptr;
+            {
+                std::lock_guard<std::mutex> lk(mu);
+                auto it = owners.find(c);
+                if (it == owners.end()) continue;
+                w = it->second.waiter;
+                owners.erase(it);
+            }
+            std::lock_guard<std::mutex> wl(w->mu);
+            w->done.emplace_back(c, rc);
+            w->cv.notify_all();
+        }
+        curl_multi_poll(multi, nullptr, 0, resume_paced(), nullptr);
+    }
+}
+
+static void mux_add(CURL *c, MuxWaiter &w, BodyReader &body) {
+    {
+        std::lock_guard<std::mutex> lk(g_mux->mu);
+        g_mux->adds.emplace_back(c, MuxEntry{&w, &body});
+    }
+    curl_multi_wakeup(g_mux->multi);
+}
+
+// Returns once the driver has let go of `c`, finished or not.
+static void mux_remove(CURL *c, MuxWaiter &w) {
+    {
+        std::lock_guard<std::mutex> wl(w.mu);
+        w.removing++;
+    }
+    {
+        std::lock_guard<std::mutex> lk(g_mux->mu);
+        g_mux->removes.emplace_back(c, &w);
+    }
+    curl_multi_wakeup(g_mux->multi);
+    std::unique_lock<std::mutex> wl(w.mu);
+    w.cv.wait(wl, [&] { return w.removing == 0; });
+}
+
+static void mux_stop() {
+    if (!g_mux) return;
+    {
+        std::lock_guard<std::mutex> lk(g_mux->mu);
+        g_mux->stopping = true;
+    }
+    curl_multi_wakeup(g_mux->multi);
+    g_mux->th.join();
+    curl_multi_cleanup(g_mux->multi);
+    delete g_mux;
+    g_mux = nullptr;
+}
+
+UploadHttpVersion upload_http_version_from_string(const std::string &s) {
+    if (s == "2") return UPLOAD_HTTP_2;
+    if (s == "2-prior-knowledge") return UPLOAD_HTTP_2_PRIOR_KNOWLEDGE;
+    if (s == "1.1") return UPLOAD_HTTP_1_1;
+    return UPLOAD_HTTP_DEFAULT;
+}
+
+static bool multiplexing() {
+    return g_mux_opt.version == UPLOAD_HTTP_2 || g_mux_opt.version == UPLOAD_HTTP_2_PRIOR_KNOWLEDGE;
+}
+
+void http_multiplex_setup(CURLM *multi) {
+    if (!multiplexing()) return;
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, std::max(1L, g_mux_opt.streams_per_connection));
+    if (g_mux_opt.max_connections > 0) curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, g_mux_opt.max_connections);
+}
+
+void http_multiplex_configure(const MultiplexOptions &opt) {
+    mux_stop();
+    g_mux_opt = opt;
+    if (!multiplexing()) return;
+    CURLM *multi = curl_multi_init();
+    if (!multi) return;
+    g_mux = new MuxDriver;
+    g_mux->multi = multi;
+    http_multiplex_setup(multi);
+    g_mux->th = std::thread([] { g_mux->run(); });
+}
+
+void http_set_ca_file(const std::string &path) { g_ca_file = path; }
+
+void http_set_max_download(size_t bytes) { g_max_download = bytes; }
+
+void http_share_cleanup() {
+    mux_stop();
+    if (!g_share) return;
+    curl_share_cleanup(g_share);
+    g_share = nullptr;
+}
+
+static void clear_buffer(void *user) { static_cast<Buffer *>(user)->data.clear(); }
+static void clear_pool_sink(void *user) { static_cast<PoolSink *>(user)->buf->clear(); }
+
+static CURL *http_get_handle(const std::string &url, struct curl_slist *headers, curl_write_callback write_cb, void *resp) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return nullptr;
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    if (g_share) curl_easy_setopt(curl, CURLOPT_SHARE, g_share);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, resp);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 60L);
+    if (!g_ca_file.empty()) curl_easy_setopt(curl, CURLOPT_CAINFO, g_ca_file.c_str());
+    if (g_max_download) curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE, static_cast<curl_off_t>(g_max_download));
+    if (headers) curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    return curl;
+}
+
+bool http_get_bytes(const std::string &url, struct curl_slist *headers, Buffer &resp, long &status) {
+    CURL *curl = http_get_handle(url, headers, curl_write_cb, &resp);
+    if (!curl) return false;
+    CURLcode rc = retry_perform(curl, url_host(url), status, clear_buffer, &resp);
+    curl_easy_cleanup(curl);
+    return rc == CURLE_OK;
+}
+
+bool http_get_bytes(const std::string &url, struct curl_slist *headers, PoolBuffer &resp, long &status) {
+    PoolSink sink;
+    sink.buf = &resp;
+    CURL *curl = http_get_handle(url, headers, pool_write_cb, &sink);
+    if (!curl) return false;
+    sink.curl = curl;
+    CURLcode rc = retry_perform(curl, url_host(url), status, clear_pool_sink, &sink);
+    curl_easy_cleanup(curl);
+    return rc == CURLE_OK;
+}
+
+HttpGetXfer::~HttpGetXfer() {
+    if (curl) curl_easy_cleanup(curl);
+    curl_slist_free_all(hdrs);
+}
+
+bool http_get_setup(HttpGetXfer &x, const std::string &url, const std::vector<std::string> &headers, PoolBuffer *pool) {
+    for (const std::string &h : headers) x.hdrs = curl_slist_append(x.hdrs, h.c_str());
+    x.sink.buf = pool;
+    x.curl = pool ? http_get_handle(url, x.hdrs, pool_write_cb, &x.sink) : http_get_handle(url, x.hdrs, curl_write_cb, &x.resp);
+    if (!x.curl) return false;
+    x.sink.curl = x.curl;
+    retry_watch_headers(x.curl, &x.retry_after);
+    return true;
+}
+
+void http_get_reset(HttpGetXfer &x) {
+    x.resp.data.clear();
+    if (x.sink.buf) x.sink.buf->clear();
+    x.retry_after = -1;
+}
+
+std::string get_qiniu_upload_token(const std::string &user_token, const std::string &qiniu_token_url) {
+    struct curl_slist *hdrs = nullptr;
+    std::string tok_hdr = "token: " + user_token;
+    hdrs = curl_slist_append(hdrs, tok_hdr.c_str());
+    hdrs = curl_slist_append(hdrs, "Content-Type: application/json");
+
+    Buffer resp;
+    long st = 0;
+    bool ok = http_get_bytes(qiniu_token_url, hdrs, resp, st);
+    curl_slist_free_all(hdrs);
+
+    if (!ok || st < 200 || st >= 300) return "";
+    return parse_qiniu_token(resp.data);
+}
+
+std::string parse_qiniu_token(const std::string &json) {
+    const char *p = strstr(json.c_str(), "\"code\"");
+    if (!p) return "";
+    p = strchr(p, ':');
+    if (!p) return "";
+    int code = atoi(p + 1);
+    if (code != 1) return "";
+
+    return json_get_string(json, "token", "");
+}
+
+std::string upload_hosts_url(const std::string &query_url, const std::string &upload_token, const std::string &bucket) {
+    std::string ak = upload_token;
+    size_t pos = ak.find(':');
+    if (pos != std::string::npos) ak.resize(pos);
+    return query_url + "?ak=" + ak + "&bucket=" + bucket;
+}
+
+std::vector<std::string> query_upload_hosts(const std::string &query_url,
+                                            const std::string &upload_token,
+                                            const std::string &bucket) {
+    std::string url = upload_hosts_url(query_url, upload_token, bucket);
+
+    std::vector<std::string> hosts;
+    Buffer resp;
+    long st = 0;
+    if (http_get_bytes(url, nullptr, resp, st) && st >= 200 && st < 300) hosts = parse_upload_hosts(resp.data);
+
+    bool has_default = false;
+    for (const std::string &h : hosts) has_default = has_default || h == DEFAULT_UPLOAD_HOST;
+    if (!has_default) hosts.push_back(DEFAULT_UPLOAD_HOST);
+    return hosts;
+}
+
+static size_t body_read(char *buf, size_t size, size_t nitems, void *arg) {
+    auto *b = static_cast<BodyReader *>(arg);
+    auto now = std::chrono::steady_clock::now();
+    if (b->paced && now < b->resume_at) {
+        b->paused = true;
+        return CURL_READFUNC_PAUSE;
+    }
+    size_t n = std::min(size * nitems, b->body.size - b->pos);
+    memcpy(buf, b->body.data + b->pos, n);
+    b->pos += n;
+    if (b->paced && n > 0) {
+        double wait = shaper_charge(static_cast<double>(n));
+        if (wait > 0) {
+            b->resume_at = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                     std::chrono::duration<double>(wait));
+        }
+    }
+    return n;
+}
+
+static int body_seek(void *arg, curl_off_t offset, int origin) {
+    auto *b = static_cast<BodyReader *>(arg);
+    if (origin != SEEK_SET || offset < 0 || static_cast<size_t>(offset) > b->body.size) return CURL_SEEKFUNC_CANTSEEK;
+    b->pos = static_cast<size_t>(offset);
+    return CURL_SEEKFUNC_OK;
+}
+
+UploadXfer::~UploadXfer() {
+    shaper_detach(shape);
+    if (mime) curl_mime_free(mime);
+    if (hdrs) curl_slist_free_all(hdrs);
+    if (curl) curl_easy_cleanup(curl);
+}
+
+bool upload_xfer_setup(UploadXfer &x,
+                       const std::string &upload_url,
+                       const std::string &upload_token,
+                       const std::string &key,
+                       ByteView body,
+                       const std::string &mime_type,
+                       UploadShaping shaping) {
+    CURL *curl = curl_easy_init();
+    if (!curl) return false;
+    x.curl = curl;
+
+    curl_easy_setopt(curl, CURLOPT_URL, upload_url.c_str());
+    if (g_share) curl_easy_setopt(curl, CURLOPT_SHARE, g_share);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &x.resp);
+    curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 120L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 60L);
+    if (!g_ca_file.empty()) curl_easy_setopt(curl, CURLOPT_CAINFO, g_ca_file.c_str());
+    retry_watch_headers(curl, &x.retry_after);
+    if (shaping == SHAPE_STALL) shaper_attach(curl, x.shape);
+    if (g_mux_opt.version == UPLOAD_HTTP_1_1) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+    } else if (multiplexing()) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION,
+                         g_mux_opt.version == UPLOAD_HTTP_2 ? CURL_HTTP_VERSION_2TLS : CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+        // Wait for a connection being set up to carry this stream too,
+        // rather than open another one next to it.
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+
+    x.hdrs = curl_slist_append(x.hdrs, "user-agent: QiniuDart");
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, x.hdrs);
+
+    x.mime = curl_mime_init(curl);
+    curl_mimepart *part;
+
+    part = curl_mime_addpart(x.mime);
+    curl_mime_name(part, "token");
+    curl_mime_data(part, upload_token.c_str(), CURL_ZERO_TERMINATED);
+
+    part = curl_mime_addpart(x.mime);
+    curl_mime_name(part, "key");
+    curl_mime_data(part, key.c_str(), CURL_ZERO_TERMINATED);
+
+    part = curl_mime_addpart(x.mime);
+    curl_mime_name(part, "file");
+    curl_mime_filename(part, key.c_str());
+    curl_mime_type(part, mime_type.c_str());
+    x.body.body = body;
+    x.body.paced = shaping == SHAPE_PACED;
+    curl_mime_data_cb(part, static_cast<curl_off_t>(body.size), body_read, body_seek, nullptr, &x.body);
+
+    curl_easy_setopt(curl, CURLOPT_MIMEPOST, x.mime);
+    return true;
+}
+
+struct RaceResult {
+    CURLcode rc = CURLE_FAILED_INIT;
+    long status = 0;
+    long retry_after = -1;
+    std::string resp;
+    bool rejected = false; // every breaker was open, nothing was sent
+};
+
+bool upload_no_such_domain(const UploadXfer &x) { return x.resp.data.find("no such domain") != std::string::npos; }
+
+// One upload round over the ranked hosts. The first host is tried alone;
+// if it has not connected within hedge_ms a second one is started and the
+// first 2xx wins. A "no such domain" answer moves straight to the next host.
+// Multiplexed uploads run on the shared driver instead of a multi handle of
+// their own, without hedging (the driver thread owns the running handles),
+// and are paced rather than stalled by the byte-rate shaper, since a stall
+// in the progress callback would hold up every stream on the driver.
+static RaceResult upload_race(UploadTarget &t,
+                              const std::string &upload_token,
+                              const std::string &key,
+                              ByteView body,
+                              const std::string &mime_type) {
+    std::vector<std::string> order = t.hosts->ranked();
+    std::vector<std::unique_ptr<UploadXfer>> xfers;
+    size_t next = 0;
+    bool shared = g_mux != nullptr;
+    MuxWaiter mux;
+    CURLM *multi = shared ? nullptr : curl_multi_init();
+    RaceResult out;
+    if (!shared && !multi) return out;
+
+    auto launch = [&]() -> bool {
+        while (next < order.size()) {
+            const std::string &host = order[next++];
+            if (!breaker_allow(host)) continue;
+            std::unique_ptr<UploadXfer> x(new UploadXfer);
+            x->host = host;
+            if (!upload_xfer_setup(*x, t.scheme + "://" + x->host, upload_token, key, body, mime_type,
+                                   shared ? SHAPE_PACED : SHAPE_STALL)) {
+                breaker_abandon(host);
+                continue;
+            }
+            shaper_request();
+            x->t0 = trace_now_us();
+            x->started = std::chrono::steady_clock::now();
+            if (shared) mux_add(x->curl, mux, x->body);
+            else curl_multi_add_handle(multi, x->curl);
+            xfers.push_back(std::move(x));
+            return true;
+        }
+        return false;
+    };
+
+    UploadXfer *winner = nullptr;
+    UploadXfer *last = nullptr;
+    bool hedged = false;
+    if (!launch()) {
+        // Every host's breaker is open: fail fast, without a retry either.
+        out.rc = CURLE_COULDNT_CONNECT;
+        out.rejected = true;
+        out.resp = "all upload hosts unavailable (circuit open)";
+        if (multi) curl_multi_cleanup(multi);
+        return out;
+    }
+
+    std::vector<std::pair<CURL *, CURLcode>> finished;
+    while (!xfers.empty()) {
+        finished.clear();
+        if (shared) {
+            std::lock_guard<std::mutex> lk(mux.mu);
+            finished.swap(mux.done);
+        } else {
+            int running = 0;
+            curl_multi_perform(multi, &running);
+            CURLMsg *msg;
+            int left = 0;
+            while ((msg = curl_multi_info_read(multi, &left)) != nullptr) {
+                if (msg->msg != CURLMSG_DONE) continue;
+                finished.emplace_back(msg->easy_handle, msg->data.result);
+                curl_multi_remove_handle(multi, msg->easy_handle);
+            }
+        }
+
+        for (const auto &f : finished) {
+            UploadXfer *x = nullptr;
+            for (auto &p : xfers) {
+                if (p->curl == f.first) x = p.get();
+            }
+            if (!x) continue;
+
+            x->done = true;
+            x->rc = f.second;
+            curl_easy_getinfo(x->curl, CURLINFO_RESPONSE_CODE, &x->status);
+            trace_curl_parts(x->curl, x->t0);
+            metrics_http_status(x->rc == CURLE_OK ? x->status : 0);
+            long conns = 0;
+            curl_easy_getinfo(x->curl, CURLINFO_NUM_CONNECTS, &conns);
+            metrics().upload_connections.fetch_add(static_cast<uint64_t>(conns), std::memory_order_relaxed);
+
+            curl_off_t conn_us = 0;
+            curl_easy_getinfo(x->curl, CURLINFO_CONNECT_TIME_T, &conn_us);
+            bool host_ok = retry_classify(x->rc, x->status) != RETRY_TRANSIENT && !upload_no_such_domain(*x);
+            t.hosts->record(x->host, host_ok, conn_us > 0 ? static_cast<double>(conn_us) / 1000.0 : -1);
+            breaker_record(x->host, host_ok);
+
+            last = x;
+            if (x->rc == CURLE_OK && x->status >= 200 && x->status < 300 && !winner) winner = x;
+        }
+        if (winner) break;
+
+        bool active = false;
+        for (auto &p : xfers) active = active || !p->done;
+        if (!active) {
+            if (last && upload_no_such_domain(*last) && launch()) continue;
+            break;
+        }
+
+        if (!hedged && t.hedge_ms > 0 && !shared) {
+            UploadXfer &first = *xfers.front();
+            std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - first.started;
+            curl_off_t conn_us = 0;
+            curl_easy_getinfo(first.curl, CURLINFO_CONNECT_TIME_T, &conn_us);
+            if (!first.done && conn_us == 0 && waited.count() >= t.hedge_ms && launch()) {
+                hedged = true;
+                metrics().hedges.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        if (shared) {
+            std::unique_lock<std::mutex> lk(mux.mu);
+            mux.cv.wait_for(lk, std::chrono::milliseconds(50), [&] { return !mux.done.empty(); });
+        } else {
+            curl_multi_poll(multi, nullptr, 0, 50, nullptr);
+        }
+    }
+
+    for (auto &p : xfers) {
+        if (p->done) continue;
+        if (shared) mux_remove(p->curl, mux);
+        else curl_multi_remove_handle(multi, p->curl);
+        curl_off_t conn_us = 0;
+        curl_easy_getinfo(p->curl, CURLINFO_CONNECT_TIME_T, &conn_us);
+        if (conn_us == 0) {
+            std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - p->started;
+            t.hosts->record_slow(p->host, waited.count());
+        }
+        breaker_abandon(p->host);
+    }
+    if (hedged && winner && winner != xfers.front().get()) {
+        metrics().hedge_wins.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    UploadXfer *res = winner ? winner : last;
+    if (res) {
+        out.rc = res->rc;
+        out.status = res->status;
+        out.retry_after = res->retry_after;
+        out.resp.swap(res->resp.data);
+    }
+    xfers.clear();
+    if (multi) curl_multi_cleanup(multi);
+    return out;
+}
+
+bool upload_once(UploadTarget &target,
+                 const std::string &upload_token,
+                 const std::string &key,
+                 ByteView body,
+                 const std::string &mime_type,
+                 std::string &out_resp,
+                 long &out_status) {
+    retry_note_request();
+    RaceResult r;
+    for (int attempt = 1;; attempt++) {
+        r = upload_race(target, upload_token, key, body, mime_type);
+        if (r.rejected || !retry_next(attempt, r.rc, r.status, r.retry_after)) break;
+    }
+    out_resp.swap(r.resp);
+    out_status = r.status;
+    return r.rc == CURLE_OK;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <curl/curl.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "bufpool.h"
+#include "hosts.h"
+#include "shaper.h"
+
+extern const char *DEFAULT_UPLOAD_HOST;
+
+struct Buffer {
+    std::string data;
+};
+
+// Shares the DNS cache, TLS sessions and the connection pool between every
+// transfer in the process, so later requests skip the handshakes.
+void http_share_init();
+void http_share_cleanup(); // also stops the multiplexing driver
+
+// HTTP version of uploads. By default curl picks: HTTP/2 by ALPN over
+// https, one connection per upload in flight. "1.1" forces HTTP/1.1. The
+// HTTP/2 modes multiplex (see http_multiplex_configure); "2" still needs
+// https, while prior knowledge speaks cleartext HTTP/2 (h2c) to an http
+// endpoint known to support it.
+enum UploadHttpVersion { UPLOAD_HTTP_DEFAULT, UPLOAD_HTTP_1_1, UPLOAD_HTTP_2, UPLOAD_HTTP_2_PRIOR_KNOWLEDGE };
+
+// "1.1", "2" or "2-prior-knowledge"; anything else is the default.
+UploadHttpVersion upload_http_version_from_string(const std::string &s);
+
+struct MultiplexOptions {
+    UploadHttpVersion version = UPLOAD_HTTP_DEFAULT;
+    long streams_per_connection = 100; // beyond this curl opens another connection
+    long max_connections = 0;          // per host; 0 = as many as the streams need
+};
+
+// With an HTTP/2 version, uploads from every thread are handed to one
+// process-wide curl multi handle on a thread of its own, so they share a
+// few connections as concurrent streams instead of one connection each.
+void http_multiplex_configure(const MultiplexOptions &opt);
+// Applies the multiplexing options to a caller's own multi handle.
+void http_multiplex_setup(CURLM *multi);
+// CA bundle that https transfers verify against, e.g. a test server's
+// self-signed certificate; "" keeps curl's default.
+void http_set_ca_file(const std::string &path);
+// Largest body a GET may return; longer ones fail, and a larger
+// Content-Length is not trusted for sizing the buffer. 0 means no limit.
+void http_set_max_download(size_t bytes);
+
+bool http_get_bytes(const std::string &url, struct curl_slist *headers, Buffer &resp, long &status);
+// Same, for bodies that can be large (downloads): the body lands in pooled memory.
+bool http_get_bytes(const std::string &url, struct curl_slist *headers, PoolBuffer &resp, long &status);
+
+// Download sink: sized from Content-Length up front, so a large body is
+// written once into one block instead of being regrown as it arrives.
+struct PoolSink {
+    CURL *curl = nullptr;
+    PoolBuffer *buf = nullptr;
+};
+
+// One GET set up by http_get_setup() but not started, for event-driven
+// callers; the body lands in `resp`, or in the pooled buffer when one is
+// given. Reset with http_get_reset() before each retry.
+struct HttpGetXfer {
+    CURL *curl = nullptr;
+    struct curl_slist *hdrs = nullptr;
+    Buffer resp;
+    PoolSink sink;
+    long retry_after = -1;
+
+    ~HttpGetXfer();
+};
+
+bool http_get_setup(HttpGetXfer &x,
+                    const std::string &url,
+                    const std::vector<std::string> &headers,
+                    PoolBuffer *pool = nullptr);
+void http_get_reset(HttpGetXfer &x);
+
+std::string get_qiniu_upload_token(const std::string &user_token, const std::string &qiniu_token_url);
+// The token from a qiniu-token reply, or "" unless it reports code 1.
+std::string parse_qiniu_token(const std::string &json);
+// The /v4/query URL for the bucket, keyed by the token's access key.
+std::string upload_hosts_url(const std::string &query_url, const std::string &upload_token, const std::string &bucket);
+
+// All upload domains for the bucket, best first as listed by Qiniu, with
+// DEFAULT_UPLOAD_HOST appended as the last resort.
+std::vector<std::string> query_upload_hosts(const std::string &query_url,
+                                            const std::string &upload_token,
+                                            const std::string &bucket);
+
+struct UploadTarget {
+    HostTable *hosts = nullptr;
+    std::string scheme = "https";
+    int hedge_ms = 1000; // start a second host if the first has not connected by then; 0 = never
+};
+
+// Streams the file part straight from the caller's memory (often a mapped
+// file); curl_mime_data() would copy the whole body first. Each transfer
+// has its own cursor because a hedged upload sends the same bytes twice.
+// A paced reader charges what it hands out to the byte shaper and, while
+// the bucket is in debt, returns CURL_READFUNC_PAUSE and sets `paused`; the
+// thread driving the transfer resumes it with curl_easy_pause() once
+// `resume_at` has passed.
+struct BodyReader {
+    ByteView body;
+    size_t pos = 0;
+    bool paced = false;
+    bool paused = false;
+    std::chrono::steady_clock::time_point resume_at;
+};
+
+// How an upload is held to the byte-rate limit. STALL sleeps in the
+// progress callback, which suits a transfer with a thread of its own. A
+// transfer that shares its thread or its connection with others is PACED
+// instead, so only it waits.
+enum UploadShaping { SHAPE_STALL, SHAPE_PACED, SHAPE_NONE };
+
+// One multipart upload to one host, set up by upload_xfer_setup() but not
+// started, for callers that run it on their own curl multi handle.
+struct UploadXfer {
+    std::string host;
+    BodyReader body;
+    CURL *curl = nullptr;
+    curl_mime *mime = nullptr;
+    struct curl_slist *hdrs = nullptr;
+    Buffer resp;
+    long retry_after = -1;
+    uint64_t t0 = 0;
+    std::chrono::steady_clock::time_point started;
+    bool done = false;
+    CURLcode rc = CURLE_OK;
+    long status = 0;
+    ShaperXfer shape;
+
+    ~UploadXfer();
+};
+
+bool upload_xfer_setup(UploadXfer &x,
+                       const std::string &upload_url,
+                       const std::string &upload_token,
+                       const std::string &key,
+                       ByteView body,
+                       const std::string &mime_type,
+                       UploadShaping shaping = SHAPE_STALL);
+// Qiniu's answer when the host does not serve the bucket's region.
+bool upload_no_such_domain(const UploadXfer &x);
+
+bool upload_once(UploadTarget &target,
+                 const std::string &upload_token,
+                 const std::string &key,
+                 ByteView body,
+                 const std::string &mime_type,
+                 std::string &out_resp,
+                 long &out_status);
@@ -0,0 +1,206 @@
+#include "retry.h"
+
+#include "breaker.h"
+#include "metrics.h"
+#include "shaper.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <thread>
+
+static RetryPolicy g_policy;
+// Budget is kept in hundredths of a retry so the per-request refill can be
+// a percentage without floating point atomics.
+static std::atomic<long> g_budget{1000};
+// The budget never holds more than budget_min plus what this many requests
+// earn, so a long calm run (a daemon, say) cannot bank a retry storm.
+static constexpr long BUDGET_WINDOW = 1000;
+
+void retry_configure(const RetryPolicy &p) {
+    g_policy = p;
+    if (g_policy.max_attempts < 1) g_policy.max_attempts = 1;
+    if (g_policy.base_ms < 1) g_policy.base_ms = 1;
+    if (g_policy.max_ms < g_policy.base_ms) g_policy.max_ms = g_policy.base_ms;
+    g_budget.store(static_cast<long>(std::max(0, g_policy.budget_min)) * 100);
+}
+
+RetryClass retry_classify(CURLcode rc, long status) {
+    switch (rc) {
+    case CURLE_OK:
+        break;
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_RESOLVE_PROXY:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return RETRY_TRANSIENT;
+    default:
+        return RETRY_FATAL;
+    }
+
+    if (status >= 200 && status < 400) return RETRY_OK;
+    if (status == 408 || status == 425 || status == 429) return RETRY_TRANSIENT;
+    // 5xx covers Qiniu's own 573 (rate limited) and 599 (server error);
+    // 501 and 505 will not change on a retry.
+    if (status >= 500 && status < 600 && status != 501 && status != 505) return RETRY_TRANSIENT;
+    return RETRY_FATAL;
+}
+
+long retry_after_ms(const std::string &value) {
+    const char *p = value.c_str();
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p >= '0' && *p <= '9') return atol(p) * 1000;
+
+    // IMF-fixdate, e.g. "Wed, 21 Oct 2015 07:28:00 GMT".
+    static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                   "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    const char *comma = strchr(p, ',');
+    if (!comma) return -1;
+    int day = 0, year = 0, hh = 0, mm = 0, ss = 0;
+    char mon[4] = {0};
+    if (sscanf(comma + 1, " %d %3s %d %d:%d:%d", &day, mon, &year, &hh, &mm, &ss) != 6) return -1;
+    int m = -1;
+    for (int i = 0; i < 12; i++) {
+        if (strcmp(mon, months[i]) == 0) m = i;
+    }
+    if (m < 0) return -1;
+
+    // Days from civil, so no timegm() is needed.
+    int y = year - (m < 2);
+    long era = (y >= 0 ? y : y - 399) / 400;
+    long yoe = y - era * 400;
+    long mp = (m + 10) % 12; // March-based month, m is 0-based
+    long doy = (153 * mp + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long long days = era * 146097LL + doe - 719468;
+    long long at = days * 86400 + hh * 3600 + mm * 60 + ss;
+    long long delta = at - static_cast<long long>(time(nullptr));
+    return delta > 0 ? static_cast<long>(delta * 1000) : 0;
+}
+
+long retry_backoff_ms(int retry, long retry_after) {
+    static thread_local std::mt19937 rng(std::random_device{}());
+    long cap = g_policy.base_ms;
+    for (int i = 1; i < retry && cap < g_policy.max_ms; i++) cap *= 2;
+    cap = std::min<long>(cap, g_policy.max_ms);
+    long delay = std::uniform_int_distribution<long>(0, cap)(rng);
+    if (retry_after > delay) delay = std::min<long>(retry_after, 60000);
+    return delay;
+}
+
+static bool budget_take() {
+    long cur = g_budget.load(std::memory_order_relaxed);
+    while (cur >= 100) {
+        if (g_budget.compare_exchange_weak(cur, cur - 100, std::memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+static size_t header_cb(char *buf, size_t size, size_t nitems, void *userdata) {
+    size_t n = size * nitems;
+    static const char name[] = "retry-after:";
+    if (n > sizeof(name) - 1) {
+        bool match = true;
+        for (size_t i = 0; i < sizeof(name) - 1 && match; i++) {
+            match = tolower(static_cast<unsigned char>(buf[i])) == name[i];
+        }
+        if (match) {
+            std::string v(buf + sizeof(name) - 1, n - (sizeof(name) - 1));
+            while (!v.empty() && (v.back() == '\r' || v.back() == '\n')) v.pop_back();
+            *static_cast<long *>(userdata) = retry_after_ms(v);
+        }
+    }
+    return n;
+}
+
+static thread_local int t_transient = 0;
+
+int retry_take_transient() {
+    int n = t_transient;
+    t_transient = 0;
+    return n;
+}
+
+void retry_note_request() {
+    long cap = static_cast<long>(std::max(0, g_policy.budget_min)) * 100 +
+               static_cast<long>(std::max(0, g_policy.budget_percent)) * BUDGET_WINDOW;
+    long cur = g_budget.load(std::memory_order_relaxed);
+    while (cur < cap) {
+        long next = std::min(cap, cur + g_policy.budget_percent);
+        if (g_budget.compare_exchange_weak(cur, next, std::memory_order_relaxed)) return;
+    }
+}
+
+bool retry_decide(int attempt, CURLcode rc, long status, long retry_after, long &delay_ms) {
+    if (retry_classify(rc, status) != RETRY_TRANSIENT) return false;
+    t_transient++;
+    if (attempt >= g_policy.max_attempts || !budget_take()) return false;
+
+    metrics().retries.fetch_add(1, std::memory_order_relaxed);
+    delay_ms = retry_backoff_ms(attempt, retry_after);
+    return true;
+}
+
+bool retry_next(int attempt, CURLcode rc, long status, long retry_after) {
+    long delay = 0;
+    if (!retry_decide(attempt, rc, status, retry_after, delay)) return false;
+    uint64_t s0 = trace_now_us();
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    if (trace_enabled()) trace_complete("backoff", s0, trace_now_us() - s0);
+    return true;
+}
+
+void retry_watch_headers(CURL *curl, long *retry_after) {
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, retry_after);
+}
+
+CURLcode retry_perform(CURL *curl, const std::string &host, long &status, void (*reset)(void *), void *user) {
+    long retry_after = -1;
+    retry_watch_headers(curl, &retry_after);
+    retry_note_request();
+
+    CURLcode rc = CURLE_OK;
+    for (int attempt = 1;; attempt++) {
+        if (reset) reset(user);
+        retry_after = -1;
+        status = 0;
+
+        // An open breaker will not close within any backoff the policy
+        // allows, so waiting for it would only spend time and budget.
+        if (!breaker_allow(host)) {
+            rc = CURLE_COULDNT_CONNECT;
+            break;
+        }
+        shaper_request();
+        ShaperXfer shape;
+        shaper_attach(curl, shape);
+        uint64_t t0 = trace_now_us();
+        rc = curl_easy_perform(curl);
+        shaper_detach(shape);
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        trace_curl_parts(curl, t0);
+        metrics_http_status(rc == CURLE_OK ? status : 0);
+        breaker_record(host, retry_classify(rc, status) != RETRY_TRANSIENT);
+
+        if (!retry_next(attempt, rc, status, retry_after)) break;
+    }
+
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, nullptr);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, nullptr);
+    return rc;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <curl/curl.h>
+
+#include <string>
+
+enum RetryClass {
+    RETRY_OK,
+    RETRY_TRANSIENT,
+    RETRY_FATAL
+};
+
+RetryClass retry_classify(CURLcode rc, long status);
+
+struct RetryPolicy {
+    int max_attempts = 4;
+    int base_ms = 200;
+    int max_ms = 10000;
+    int budget_percent = 20; // retries allowed per 100 first attempts in a batch
+    int budget_min = 10;     // retries always allowed, however small the batch
+};
+
+// Installs the policy and resets the batch retry budget.
+void retry_configure(const RetryPolicy &p);
+
+// Parses a Retry-After value (delta-seconds or HTTP-date) into milliseconds;
+// -1 when absent or unparseable.
+long retry_after_ms(const std::string &value);
+
+// Capped exponential backoff with full jitter for the given retry (1-based).
+// A server-supplied Retry-After raises the delay but never lowers it.
+long retry_backoff_ms(int retry, long retry_after);
+
+// Counts a new logical request towards the batch budget, which is capped at
+// budget_min plus budget_percent of 1000 requests.
+void retry_note_request();
+
+// Decides whether attempt number `attempt` (1-based) that ended with
+// `rc`/`status` should be retried. When it returns true the caller must try
+// again: the backoff delay has already been slept and counted.
+bool retry_next(int attempt, CURLcode rc, long status, long retry_after);
+
+// retry_next() without the sleep, for event-driven callers: on true the
+// caller waits `delay_ms` itself before the next attempt.
+bool retry_decide(int attempt, CURLcode rc, long status, long retry_after, long &delay_ms);
+
+// Number of transient failures (429, 5xx, timeouts, resets) the calling
+// thread has seen since the last call; resets the count.
+int retry_take_transient();
+
+// Makes `curl` store any Retry-After response header into `*retry_after`
+// (in ms, -1 when absent). Reset `*retry_after` to -1 before each attempt.
+void retry_watch_headers(CURL *curl, long *retry_after);
+
+// Runs curl_easy_perform() on a fully configured handle until it succeeds,
+// fails with a non-retryable error, runs out of attempts or the batch budget
+// is spent. `reset(user)` is called before each attempt to clear response
+// state. Records metrics and trace spans for every attempt, and feeds the
+// circuit breaker of `host`; while that breaker is open no request is sent.
+CURLcode retry_perform(CURL *curl, const std::string &host, long &status, void (*reset)(void *), void *user);
@@ -0,0 +1,84 @@
+#include "schedule.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+void stat_sizes(std::vector<SizedItem> &items) {
+    for (SizedItem &it : items) {
+        if (it.input.rfind("http://", 0) == 0 || it.input.rfind("https://", 0) == 0) continue;
+        struct stat st;
+        if (stat(it.input.c_str(), &st) == 0) it.size = static_cast<uint64_t>(st.st_size);
+    }
+}
+
+SizeSchedule::SizeSchedule(std::vector<SizedItem> items) {
+    // Stable, so equal sizes (and all the unknown ones) keep input order.
+    std::stable_sort(items.begin(), items.end(), [](const SizedItem &a, const SizedItem &b) { return a.size > b.size; });
+    q_.assign(std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+}
+
+bool SizeSchedule::take(bool large_lane, SizedItem &out) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (q_.empty()) return false;
+    if (large_lane) {
+        out = std::move(q_.front());
+        q_.pop_front();
+    } else {
+        out = std::move(q_.back());
+        q_.pop_back();
+    }
+    return true;
+}
+
+// What one request costs beyond its body, in bytes: connection reuse,
+// the multipart envelope and the server's reply.
+static const double REQUEST_OVERHEAD = 64 * 1024;
+
+size_t plan_large_lanes(const std::vector<SizedItem> &items, size_t workers) {
+    workers = std::max<size_t>(1, workers);
+    std::vector<double> cost;
+    cost.reserve(items.size());
+    for (const SizedItem &it : items) cost.push_back(static_cast<double>(it.size) + REQUEST_OVERHEAD);
+    std::stable_sort(cost.begin(), cost.end(), std::greater<double>());
+    size_t best = 1;
+    double best_span = simulate_makespan(cost, workers, 1);
+    // Every count up to 8, then steps of a quarter, ending on all-large: a
+    // few dozen simulations however many workers there are.
+    for (size_t lanes = 2; lanes <= workers;) {
+        double span = simulate_makespan(cost, workers, lanes);
+        if (span < best_span) {
+            best = lanes;
+            best_span = span;
+        }
+        if (lanes == workers) break;
+        lanes = std::min(workers, lanes + std::max<size_t>(1, lanes / 4));
+    }
+    return best;
+}
+
+double simulate_makespan(const std::vector<double> &ms, size_t workers, size_t large_lanes) {
+    workers = std::max<size_t>(1, workers);
+    large_lanes = std::min(large_lanes, workers);
+    // (time the worker is free, worker index), earliest first; ties go to
+    // the lower index, as every worker starts at once.
+    typedef std::pair<double, size_t> Slot;
+    std::priority_queue<Slot, std::vector<Slot>, std::greater<Slot>> free_at;
+    for (size_t w = 0; w < workers; w++) free_at.push(Slot(0, w));
+    size_t front = 0;
+    size_t back = ms.size();
+    double end = 0;
+    while (front < back) {
+        Slot s = free_at.top();
+        free_at.pop();
+        double d = s.second < large_lanes ? ms[front++] : ms[--back];
+        s.first += d;
+        end = std::max(end, s.first);
+        free_at.push(s);
+    }
+    return end;
+}
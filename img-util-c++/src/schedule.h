@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Size-aware batch order ("schedule": "size"). Every input is known and
+// sized before the first upload starts; a few "large lanes" then take the
+// biggest files first while the other workers take the smallest, so the
+// long uploads start at once instead of trailing at the end of the run,
+// and small files keep finishing throughout it.
+
+struct SizedItem {
+    std::string input;
+    long id = 0;       // position in input order
+    uint64_t size = 0; // 0 for URLs and paths that cannot be stat'ed
+};
+
+// Fills in `size` for local files.
+void stat_sizes(std::vector<SizedItem> &items);
+
+// Items sorted by size, handed out from both ends.
+struct SizeSchedule {
+    explicit SizeSchedule(std::vector<SizedItem> items);
+
+    // Largest remaining for a large lane, smallest for any other; false
+    // once every item has been taken.
+    bool take(bool large_lane, SizedItem &out);
+
+private:
+    std::mutex mu_;
+    std::deque<SizedItem> q_; // largest first
+};
+
+// The number of large lanes, from 1 to `workers`, with the shortest
+// simulated run when each item costs its size plus a fixed per-request
+// overhead; ties go to fewer lanes, which serve small files sooner. With
+// every lane large this is longest-processing-time-first.
+size_t plan_large_lanes(const std::vector<SizedItem> &items, size_t workers);
+
+// Wall time of running jobs lasting `ms` on `workers` threads, each thread
+// taking the next job as soon as it is free: the first `large_lanes`
+// threads from the front of `ms`, the others from the back. With
+// large_lanes == workers this is plain FIFO over `ms`.
+double simulate_makespan(const std::vector<double> &ms, size_t workers, size_t large_lanes);
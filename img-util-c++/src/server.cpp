@@ -0,0 +1,1010 @@
+#include "server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+#include "trace.h"
+#include "util.h"
+
+#ifdef _WIN32
+
+int serve_run(UploadContext &ctx, const ServeOptions &opt) {
+    (void)ctx;
+    (void)opt;
+    std::cout << "--serve 暂不支持 Windows\n";
+    return 1;
+}
+
+#else
+
+#include <arpa/inet.h>
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+static const int EV_IN = 1;
+static const int EV_OUT = 2;
+
+// Thin readiness-notification wrapper: epoll on Linux, poll() elsewhere.
+struct Poller {
+#ifdef __linux__
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+
+    ~Poller() { close(ep); }
+
+    void set(int fd, int ev, bool add) {
+        epoll_event e;
+        memset(&e, 0, sizeof(e));
+        e.events = ((ev & EV_IN) ? uint32_t(EPOLLIN) : 0u) |
+                   ((ev & EV_OUT) ? uint32_t(EPOLLOUT) : 0u);
+        e.data.fd = fd;
+        epoll_ctl(ep, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &e);
+    }
+    void add(int fd, int ev) { set(fd, ev, true); }
+    void mod(int fd, int ev) { set(fd, ev, false); }
+    void del(int fd) { epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr); }
+
+    int wait(std::vector<std::pair<int, int>> &out, int timeout_ms) {
+        epoll_event evs[128];
+        int n = epoll_wait(ep, evs, 128, timeout_ms);
+        out.clear();
+        for (int i = 0; i < n; i++) {
+            int ev = 0;
+            if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ev |= EV_IN;
+            if (evs[i].events & EPOLLOUT) ev |= EV_OUT;
+            int fd = evs[i].data.fd;
+            out.emplace_back(fd, ev);
+        }
+        return n;
+    }
+#else
+    std::map<int, int> fds;
+
+    void add(int fd, int ev) { fds[fd] = ev; }
+    void mod(int fd, int ev) { fds[fd] = ev; }
+    void del(int fd) { fds.erase(fd); }
+
+    int wait(std::vector<std::pair<int, int>> &out, int timeout_ms) {
+        std::vector<pollfd> p;
+        for (const auto &f : fds) {
+            short ev = static_cast<short>(((f.second & EV_IN) ? POLLIN : 0) | ((f.second & EV_OUT) ? POLLOUT : 0));
+            p.push_back(pollfd{f.first, ev, 0});
+        }
+        int n = poll(p.data(), static_cast<nfds_t>(p.size()), timeout_ms);
+        out.clear();
+        for (const pollfd &x : p) {
+            int ev = 0;
+            if (x.revents & (POLLIN | POLLHUP | POLLERR)) ev |= EV_IN;
+            if (x.revents & POLLOUT) ev |= EV_OUT;
+            if (ev) out.emplace_back(x.fd, ev);
+        }
+        return n;
+    }
+#endif
+};
+
+typedef std::chrono::steady_clock Clock;
+
+enum JobClass { CLASS_INTERACTIVE, CLASS_NORMAL, CLASS_BULK, CLASS_COUNT };
+
+static const char *const CLASS_NAMES[CLASS_COUNT] = {"interactive", "normal", "bulk"};
+
+// -1 for an unknown name; "" is normal.
+static int parse_class(const std::string &s) {
+    if (s.empty()) return CLASS_NORMAL;
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        if (strcasecmp(s.c_str(), CLASS_NAMES[i]) == 0) return i;
+    }
+    return -1;
+}
+
+struct Job {
+    uint64_t conn_id = 0;
+    bool keep_alive = true;
+    std::string input;
+    std::string name;
+    std::string content_type;
+    PoolBuffer body;
+    int cls = CLASS_NORMAL;
+    bool fast = false;           // may run on a fast lane
+    size_t cost = 0;             // bytes to send, as far as known up front
+    Clock::time_point queued_at;
+    Clock::time_point deadline;  // epoch: none
+};
+
+struct ClassStats {
+    std::atomic<uint64_t> queued{0};
+    std::atomic<uint64_t> admitted{0};
+    std::atomic<uint64_t> fast{0};
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<uint64_t> wait_us{0};
+    std::atomic<uint64_t> waited{0};
+};
+
+static ClassStats g_class_stats[CLASS_COUNT];
+
+static std::string render_classes() {
+    std::ostringstream os;
+    auto family = [&](const char *name, const char *type, const char *help, const std::atomic<uint64_t> ClassStats::*field) {
+        os << "# HELP " << name << " " << help << "\n";
+        os << "# TYPE " << name << " " << type << "\n";
+        for (int i = 0; i < CLASS_COUNT; i++) {
+            os << name << "{class=\"" << CLASS_NAMES[i] << "\"} " << (g_class_stats[i].*field).load(std::memory_order_relaxed) << "\n";
+        }
+    };
+    family("imgutil_serve_queue_depth", "gauge", "Uploads waiting for a worker.", &ClassStats::queued);
+    family("imgutil_serve_admitted_total", "counter", "Uploads accepted into the queue.", &ClassStats::admitted);
+    family("imgutil_serve_fast_lane_total", "counter", "Uploads run on a fast lane.", &ClassStats::fast);
+    family("imgutil_serve_deadline_drops_total", "counter", "Uploads answered 504 because their deadline could not be met.",
+           &ClassStats::dropped);
+    os << "# HELP imgutil_serve_queue_wait_seconds Time from admission to a worker picking the upload.\n";
+    os << "# TYPE imgutil_serve_queue_wait_seconds summary\n";
+    for (int i = 0; i < CLASS_COUNT; i++) {
+        const ClassStats &c = g_class_stats[i];
+        os << "imgutil_serve_queue_wait_seconds_sum{class=\"" << CLASS_NAMES[i] << "\"} "
+           << static_cast<double>(c.wait_us.load(std::memory_order_relaxed)) / 1e6 << "\n";
+        os << "imgutil_serve_queue_wait_seconds_count{class=\"" << CLASS_NAMES[i] << "\"} "
+           << c.waited.load(std::memory_order_relaxed) << "\n";
+    }
+    return os.str();
+}
+
+// Rough service time of an upload as a fixed per-request cost plus bytes
+// over throughput, both smoothed over recent uploads. Knows nothing until
+// the first uploads finish, and then never drops a job that could start now.
+struct ServiceModel {
+    double overhead_ms = 0;
+    double bytes_per_ms = 0;
+
+    void observe(size_t bytes, double ms) {
+        const double a = 0.2;
+        if (bytes < SMALL) {
+            overhead_ms = overhead_ms == 0 ? ms : overhead_ms + a * (ms - overhead_ms);
+            return;
+        }
+        double rate = static_cast<double>(bytes) / std::max(1.0, ms - overhead_ms);
+        bytes_per_ms = bytes_per_ms == 0 ? rate : bytes_per_ms + a * (rate - bytes_per_ms);
+    }
+
+    double estimate_ms(size_t bytes) const {
+        double ms = overhead_ms;
+        if (bytes_per_ms > 0) ms += static_cast<double>(bytes) / bytes_per_ms;
+        return ms;
+    }
+
+    static constexpr size_t SMALL = 64 * 1024;
+};
+
+// Queued uploads, one FIFO per class. Workers pick by deficit round robin
+// over byte cost: each visit tops a class up by its weight in quanta, and
+// it sends jobs while its deficit covers them, so a class gets bandwidth in
+// proportion to its weight and a 100 MB bulk job costs bulk 100 MB of
+// turns. Fast-lane threads skip the rotation and take the oldest fast job.
+struct JobQueue {
+    std::deque<Job> q[CLASS_COUNT];
+    int64_t deficit[CLASS_COUNT] = {};
+    int weight[CLASS_COUNT] = {1, 1, 1};
+    int turn = 0;
+    bool topped = false; // q[turn] has had its quantum this visit
+    size_t total = 0;
+    size_t fast_waiting = 0;
+    size_t with_deadline = 0;
+
+    static constexpr int64_t QUANTUM = 256 * 1024;
+
+    // Every job counts at least this much, for its request overhead.
+    static int64_t cost(const Job &j) { return static_cast<int64_t>(std::max<size_t>(j.cost, ServiceModel::SMALL)); }
+
+    size_t size() const { return total; }
+
+    void push(Job j) {
+        g_class_stats[j.cls].queued.fetch_add(1, std::memory_order_relaxed);
+        total++;
+        if (j.fast) fast_waiting++;
+        if (j.deadline != Clock::time_point()) with_deadline++;
+        q[j.cls].push_back(std::move(j));
+    }
+
+    bool pop(Job &out) {
+        if (total == 0) return false;
+        for (;;) {
+            std::deque<Job> &d = q[turn];
+            if (d.empty()) {
+                deficit[turn] = 0;
+                next();
+                continue;
+            }
+            if (!topped) {
+                deficit[turn] += QUANTUM * weight[turn];
+                topped = true;
+            }
+            int64_t c = cost(d.front());
+            if (c <= deficit[turn]) {
+                deficit[turn] -= c;
+                take(d, d.begin(), out);
+                return true;
+            }
+            next();
+        }
+    }
+
+    bool pop_fast(Job &out) {
+        if (fast_waiting == 0) return false;
+        std::deque<Job> &d = q[CLASS_INTERACTIVE];
+        for (auto it = d.begin(); it != d.end(); ++it) {
+            if (it->fast) {
+                take(d, it, out);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Moves out every job that cannot finish by its deadline if started now.
+    void expire(Clock::time_point now, const ServiceModel &model, std::vector<Job> &out) {
+        if (with_deadline == 0) return;
+        for (std::deque<Job> &d : q) {
+            for (auto it = d.begin(); it != d.end();) {
+                if (!misses(*it, now, model)) {
+                    ++it;
+                    continue;
+                }
+                out.emplace_back();
+                it = take(d, it, out.back());
+            }
+        }
+    }
+
+    static bool misses(const Job &j, Clock::time_point now, const ServiceModel &model) {
+        if (j.deadline == Clock::time_point()) return false;
+        auto need = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(model.estimate_ms(j.cost)));
+        return now + need > j.deadline;
+    }
+
+private:
+    void next() {
+        turn = (turn + 1) % CLASS_COUNT;
+        topped = false;
+    }
+
+    std::deque<Job>::iterator take(std::deque<Job> &d, std::deque<Job>::iterator it, Job &out) {
+        out = std::move(*it);
+        g_class_stats[out.cls].queued.fetch_sub(1, std::memory_order_relaxed);
+        total--;
+        if (out.fast) fast_waiting--;
+        if (out.deadline != Clock::time_point()) with_deadline--;
+        return d.erase(it);
+    }
+};
+
+struct Conn {
+    int fd = -1;
+    uint64_t id = 0;
+    std::string in;
+    std::string out;
+    size_t out_off = 0;
+    bool busy = false;       // a worker owns the current request
+    bool keep_alive = true;
+    bool close_after = false; // close once `out` is flushed
+    bool sent_continue = false;
+    // An /upload body is received straight into `upload.body`;
+    // `body_left` is how much of it is still to come.
+    bool in_upload = false;
+    size_t body_left = 0;
+    Job upload;
+};
+
+struct Done {
+    uint64_t conn_id = 0;
+    std::string response;
+};
+
+static int g_wake_w = -1;
+static volatile std::sig_atomic_t g_stop = 0;
+
+static void on_stop_signal(int) {
+    g_stop = 1;
+    char b = 0;
+    if (g_wake_w >= 0) (void)!write(g_wake_w, &b, 1);
+}
+
+static void set_nonblock(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static int listen_socket(const std::string &spec) {
+    int s;
+    if (spec.rfind("unix:", 0) == 0) {
+        std::string path = spec.substr(5);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) return -1;
+        memcpy(addr.sun_path, path.c_str(), path.size());
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s < 0) return -1;
+        unlink(path.c_str());
+        if (bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            close(s);
+            return -1;
+        }
+        chmod(path.c_str(), 0660);
+    } else {
+        std::string host = "127.0.0.1";
+        std::string port = spec;
+        size_t colon = spec.rfind(':');
+        if (colon != std::string::npos) {
+            host = spec.substr(0, colon);
+            port = spec.substr(colon + 1);
+        }
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<unsigned short>(atoi(port.c_str())));
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return -1;
+        s = socket(AF_INET, SOCK_STREAM, 0);
+        if (s < 0) return -1;
+        int one = 1;
+        setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            close(s);
+            return -1;
+        }
+    }
+    if (listen(s, 512) != 0) {
+        close(s);
+        return -1;
+    }
+    set_nonblock(s);
+    return s;
+}
+
+static std::string url_decode(const std::string &s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '%' && i + 2 < s.size()) {
+            out += static_cast<char>(strtol(s.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        } else if (s[i] == '+') {
+            out += ' ';
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+static std::string query_param(const std::string &target, const char *name) {
+    size_t q = target.find('?');
+    if (q == std::string::npos) return "";
+    std::string want = std::string(name) + "=";
+    size_t pos = q + 1;
+    while (pos < target.size()) {
+        size_t amp = target.find('&', pos);
+        if (amp == std::string::npos) amp = target.size();
+        if (target.compare(pos, want.size(), want) == 0) {
+            return url_decode(target.substr(pos + want.size(), amp - pos - want.size()));
+        }
+        pos = amp + 1;
+    }
+    return "";
+}
+
+// Case-insensitive header lookup in the raw header block.
+static std::string header_value(const std::string &head, const char *name) {
+    size_t n = strlen(name);
+    size_t pos = head.find("\r\n");
+    while (pos != std::string::npos && pos + 2 < head.size()) {
+        size_t start = pos + 2;
+        size_t end = head.find("\r\n", start);
+        if (end == std::string::npos) end = head.size();
+        if (end - start > n && head[start + n] == ':' && strncasecmp(head.c_str() + start, name, n) == 0) {
+            size_t v = start + n + 1;
+            while (v < end && (head[v] == ' ' || head[v] == '\t')) v++;
+            return head.substr(v, end - v);
+        }
+        pos = end;
+    }
+    return "";
+}
+
+// DNS rebinding guard: a page that gets its own name resolved to 127.0.0.1
+// still sends that name as Host, so only loopback names are served.
+static bool host_is_local(const std::string &hostport) {
+    std::string host = hostport;
+    if (!host.empty() && host[0] == '[') {
+        host = host.substr(0, host.find(']') + 1);
+    } else {
+        size_t colon = host.find(':');
+        if (colon != std::string::npos) host.resize(colon);
+    }
+    return strcasecmp(host.c_str(), "localhost") == 0 || host == "127.0.0.1" || host == "[::1]";
+}
+
+// Browsers send Origin on cross-site requests; only a loopback page may
+// talk to the daemon.
+static bool origin_is_local(const std::string &origin) {
+    size_t sep = origin.find("://");
+    if (sep == std::string::npos) return false;
+    std::string scheme = origin.substr(0, sep);
+    if (scheme != "http" && scheme != "https") return false;
+    return host_is_local(origin.substr(sep + 3));
+}
+
+// Compares in time independent of where the first difference is.
+static bool same_secret(const std::string &a, const std::string &b) {
+    if (a.size() != b.size()) return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < a.size(); i++) diff |= static_cast<unsigned char>(a[i] ^ b[i]);
+    return diff == 0;
+}
+
+static std::string http_response(int code, const char *reason, const char *type, const std::string &body, bool keep_alive) {
+    std::string r = "HTTP/1.1 " + std::to_string(code) + " " + reason + "\r\n";
+    r += std::string("Content-Type: ") + type + "\r\n";
+    r += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    r += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    return r + body;
+}
+
+static std::string json_response(int code, const char *reason, const std::string &body, bool keep_alive) {
+    return http_response(code, reason, "application/json", body, keep_alive);
+}
+
+static std::string deadline_response(bool keep_alive) {
+    return json_response(504, "Gateway Timeout", "{\"ok\":false,\"error\":\"deadline cannot be met\"}\n", keep_alive);
+}
+
+static std::string result_json(bool ok, const ItemResult &res, double ms) {
+    if (!ok) return "{\"ok\":false,\"error\":\"" + json_escape(res.error) + "\"}\n";
+    std::string out = "{\"ok\":true,\"key\":\"" + json_escape(res.key) + "\",\"bytes\":" + std::to_string(res.bytes);
+    char lat[64];
+    snprintf(lat, sizeof(lat), ",\"latency_ms\":%.3f", ms);
+    out += lat;
+    size_t first = res.resp.find_first_not_of(" \t\r\n");
+    if (first != std::string::npos && res.resp[first] == '{') out += ",\"response\":" + res.resp.substr(first);
+    else out += ",\"response\":\"" + json_escape(res.resp) + "\"";
+    return out + "}\n";
+}
+
+struct Server {
+    UploadContext &ctx;
+    ServeOptions opt;
+    Poller poller;
+    int lsock = -1;
+    int wake_r = -1;
+    int wake_w = -1;
+    uint64_t next_id = 1;
+    std::map<int, std::unique_ptr<Conn>> conns;
+    std::map<uint64_t, int> by_id;
+
+    std::mutex mu;
+    std::condition_variable cv;      // general workers
+    std::condition_variable fast_cv; // fast lanes
+    JobQueue jobs;
+    ServiceModel model;
+    std::string input_root; // realpath of opt.input_root; empty: ?input= is refused
+    std::deque<Done> done;
+    bool stopping = false;
+    std::atomic<long> item_seq{0};
+
+    Server(UploadContext &c, const ServeOptions &o) : ctx(c), opt(o) {
+        jobs.weight[CLASS_INTERACTIVE] = std::max(1, opt.weight_interactive);
+        jobs.weight[CLASS_NORMAL] = std::max(1, opt.weight_normal);
+        jobs.weight[CLASS_BULK] = std::max(1, opt.weight_bulk);
+        static bool registered = false;
+        if (!registered) {
+            metrics_add_collector(render_classes);
+            registered = true;
+        }
+    }
+
+    void close_conn(Conn &c) {
+        poller.del(c.fd);
+        close(c.fd);
+        by_id.erase(c.id);
+        conns.erase(c.fd);
+    }
+
+    // Returns false once the connection has been closed.
+    bool reply(Conn &c, const std::string &resp) {
+        c.close_after = !c.keep_alive;
+        c.out += resp;
+        return flush(c);
+    }
+
+    // Reads are only wanted while no worker owns the connection: what a
+    // pipelining client sends meanwhile stays in the socket, instead of
+    // waking the loop over and over for bytes it cannot use yet.
+    void arm(Conn &c) {
+        int ev = c.busy ? 0 : EV_IN;
+        if (c.out_off < c.out.size()) ev |= EV_OUT;
+        poller.mod(c.fd, ev);
+    }
+
+    // Returns false once the connection has been closed.
+    bool flush(Conn &c) {
+        while (c.out_off < c.out.size()) {
+            ssize_t w = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, 0);
+            if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                arm(c);
+                return true;
+            }
+            if (w <= 0) {
+                close_conn(c);
+                return false;
+            }
+            c.out_off += static_cast<size_t>(w);
+        }
+        c.out.clear();
+        c.out_off = 0;
+        if (c.close_after) {
+            close_conn(c);
+            return false;
+        }
+        arm(c);
+        return true;
+    }
+
+    // Parses as many complete requests as `c.in` holds. Requests on one
+    // connection are answered in order, so parsing pauses while a worker
+    // owns the current one.
+    void process(Conn &c) {
+        uint64_t id = c.id;
+        while (!c.busy && c.out.empty()) {
+            if (c.in_upload) {
+                if (c.body_left > 0) return;
+                c.in_upload = false;
+                Job j = std::move(c.upload);
+                c.upload = Job();
+                if (j.input.empty() && j.body.empty()) {
+                    if (!reply(c, json_response(400, "Bad Request", "{\"ok\":false,\"error\":\"empty body and no input\"}\n", c.keep_alive))) return;
+                    continue;
+                }
+                admit(c, std::move(j));
+                if (by_id.find(id) == by_id.end()) return;
+                if (!c.busy) continue;
+                return;
+            }
+            size_t end = c.in.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                if (c.in.size() > 64 * 1024) {
+                    c.keep_alive = false;
+                    reply(c, json_response(431, "Request Header Fields Too Large", "{\"ok\":false,\"error\":\"header too large\"}\n", false));
+                }
+                return;
+            }
+            std::string head = c.in.substr(0, end);
+            size_t sp1 = head.find(' ');
+            size_t sp2 = sp1 == std::string::npos ? std::string::npos : head.find(' ', sp1 + 1);
+            if (sp2 == std::string::npos) {
+                c.keep_alive = false;
+                reply(c, json_response(400, "Bad Request", "{\"ok\":false,\"error\":\"bad request line\"}\n", false));
+                return;
+            }
+            std::string method = head.substr(0, sp1);
+            std::string target = head.substr(sp1 + 1, sp2 - sp1 - 1);
+            std::string path = target.substr(0, target.find('?'));
+            bool http10 = head.compare(sp2 + 1, 8, "HTTP/1.0") == 0;
+            std::string conn_hdr = header_value(head, "Connection");
+            c.keep_alive = http10 ? strcasecmp(conn_hdr.c_str(), "keep-alive") == 0 : strcasecmp(conn_hdr.c_str(), "close") != 0;
+
+            std::string origin = header_value(head, "Origin");
+            bool unix_socket = opt.listen.rfind("unix:", 0) == 0;
+            if ((!unix_socket && !host_is_local(header_value(head, "Host"))) || (!origin.empty() && !origin_is_local(origin))) {
+                c.keep_alive = false;
+                reply(c, json_response(403, "Forbidden", "{\"ok\":false,\"error\":\"host or origin not allowed\"}\n", false));
+                return;
+            }
+
+            if (!header_value(head, "Transfer-Encoding").empty()) {
+                c.keep_alive = false;
+                reply(c, json_response(411, "Length Required", "{\"ok\":false,\"error\":\"chunked bodies are not supported\"}\n", false));
+                return;
+            }
+            size_t len = static_cast<size_t>(strtoull(header_value(head, "Content-Length").c_str(), nullptr, 10));
+            if (len > opt.max_body) {
+                c.keep_alive = false;
+                reply(c, json_response(413, "Payload Too Large", "{\"ok\":false,\"error\":\"body too large\"}\n", false));
+                return;
+            }
+            if (method == "POST" && path == "/upload") {
+                if (!opt.token.empty() && !same_secret(header_value(head, "Authorization"), "Bearer " + opt.token)) {
+                    c.keep_alive = false;
+                    reply(c, json_response(401, "Unauthorized", "{\"ok\":false,\"error\":\"missing or wrong bearer token\"}\n", false));
+                    return;
+                }
+                std::string input = query_param(target, "input");
+                const char *refused = nullptr;
+                if (!input.empty() && input_root.empty()) refused = "input= is disabled";
+                else if (input.rfind("http://", 0) == 0 || input.rfind("https://", 0) == 0) refused = "input= takes a local path";
+                if (refused) {
+                    c.keep_alive = false;
+                    reply(c, json_response(403, "Forbidden", std::string("{\"ok\":false,\"error\":\"") + refused + "\"}\n", false));
+                    return;
+                }
+                // Whatever part of the body came with the head is moved over
+                // once; on_readable() receives the rest in place.
+                Job &j = c.upload;
+                j.conn_id = c.id;
+                j.keep_alive = c.keep_alive;
+                j.input = input;
+                // A client-supplied size for ?input=, which is only looked
+                // at on a worker; without it the job is costed as small.
+                if (!input.empty()) j.cost = static_cast<size_t>(strtoull(query_param(target, "size").c_str(), nullptr, 10));
+                j.name = query_param(target, "name");
+                j.content_type = header_value(head, "Content-Type");
+                std::string prio = query_param(target, "priority");
+                if (prio.empty()) prio = header_value(head, "X-Priority");
+                j.cls = parse_class(prio);
+                if (j.cls < 0) {
+                    c.upload = Job();
+                    c.keep_alive = false;
+                    reply(c, json_response(400, "Bad Request", "{\"ok\":false,\"error\":\"unknown priority\"}\n", false));
+                    return;
+                }
+                std::string dl = query_param(target, "deadline_ms");
+                if (dl.empty()) dl = header_value(head, "X-Deadline-Ms");
+                long deadline_ms = strtol(dl.c_str(), nullptr, 10);
+                if (deadline_ms > 0) j.deadline = Clock::now() + std::chrono::milliseconds(deadline_ms);
+                j.body.reserve(len);
+                size_t have = std::min(len, c.in.size() - (end + 4));
+                if (have > 0) {
+                    j.body.append(c.in.data() + end + 4, have);
+                    buffer_pool_note_copy(have);
+                }
+                c.in.erase(0, end + 4 + have);
+                c.in_upload = true;
+                c.body_left = len - have;
+                if (c.body_left > 0 && strcasecmp(header_value(head, "Expect").c_str(), "100-continue") == 0) {
+                    c.out = "HTTP/1.1 100 Continue\r\n\r\n";
+                    if (!flush(c)) return;
+                }
+                continue;
+            }
+            if (c.in.size() < end + 4 + len) {
+                if (!c.sent_continue && strcasecmp(header_value(head, "Expect").c_str(), "100-continue") == 0) {
+                    c.sent_continue = true;
+                    c.out = "HTTP/1.1 100 Continue\r\n\r\n";
+                    if (!flush(c)) return;
+                }
+                return;
+            }
+            c.sent_continue = false;
+
+            // Consumed before replying, since the reply may close `c`.
+            c.in.erase(0, end + 4 + len);
+            bool open;
+            if (method == "GET" && path == "/healthz") {
+                open = reply(c, json_response(200, "OK", "{\"ok\":true}\n", c.keep_alive));
+            } else if (method == "GET" && path == "/metrics") {
+                open = reply(c, http_response(200, "OK", "text/plain; version=0.0.4", metrics().render(), c.keep_alive));
+            } else {
+                open = reply(c, json_response(404, "Not Found", "{\"ok\":false,\"error\":\"not found\"}\n", c.keep_alive));
+            }
+            if (!open) return;
+        }
+    }
+
+    // Queues a complete upload request, or answers it 504 at once when even
+    // starting it now would miss its deadline.
+    void admit(Conn &c, Job j) {
+        if (!j.body.empty()) j.cost = j.body.size();
+        // An input of unknown size could be anything, so it never gets a lane.
+        j.fast = opt.fast_lanes > 0 && j.cls == CLASS_INTERACTIVE && j.cost > 0 && j.cost <= opt.fast_lane_max;
+        j.queued_at = Clock::now();
+        ClassStats &cs = g_class_stats[j.cls];
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            if (!JobQueue::misses(j, j.queued_at, model)) {
+                cs.admitted.fetch_add(1, std::memory_order_relaxed);
+                bool fast = j.fast;
+                jobs.push(std::move(j));
+                c.busy = true;
+                arm(c);
+                cv.notify_one();
+                if (fast) fast_cv.notify_one();
+                return;
+            }
+        }
+        cs.dropped.fetch_add(1, std::memory_order_relaxed);
+        reply(c, deadline_response(c.keep_alive));
+    }
+
+    // Answers, from the event loop, queued jobs whose deadline has become
+    // unreachable, rather than waiting for a worker to reach them.
+    void expire() {
+        std::vector<Job> late;
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            jobs.expire(Clock::now(), model, late);
+        }
+        for (Job &j : late) {
+            g_class_stats[j.cls].dropped.fetch_add(1, std::memory_order_relaxed);
+            deliver(j.conn_id, deadline_response(j.keep_alive));
+        }
+    }
+
+    // General workers run whatever the fair rotation picks; fast lanes run
+    // only small interactive jobs.
+    void worker(bool fast_lane) {
+        for (;;) {
+            Job j;
+            Clock::time_point picked;
+            bool late;
+            {
+                std::unique_lock<std::mutex> lk(mu);
+                if (fast_lane) {
+                    fast_cv.wait(lk, [&] { return stopping || jobs.fast_waiting > 0; });
+                    if (!jobs.pop_fast(j)) return;
+                } else {
+                    cv.wait(lk, [&] { return stopping || jobs.size() > 0; });
+                    if (!jobs.pop(j)) return;
+                }
+                picked = Clock::now();
+                late = JobQueue::misses(j, picked, model);
+            }
+            ClassStats &cs = g_class_stats[j.cls];
+            cs.wait_us.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(picked - j.queued_at).count()),
+                                 std::memory_order_relaxed);
+            cs.waited.fetch_add(1, std::memory_order_relaxed);
+            if (late) {
+                cs.dropped.fetch_add(1, std::memory_order_relaxed);
+                post(j.conn_id, deadline_response(j.keep_alive));
+                continue;
+            }
+            if (fast_lane) cs.fast.fetch_add(1, std::memory_order_relaxed);
+            trace_set_item(item_seq.fetch_add(1));
+
+            auto t0 = std::chrono::steady_clock::now();
+            ItemResult res;
+            bool ok;
+            if (!j.input.empty()) {
+                std::string input;
+                if (!confine(j.input, input)) {
+                    post(j.conn_id, json_response(403, "Forbidden", "{\"ok\":false,\"error\":\"input is outside serve_input_root\"}\n",
+                                                  j.keep_alive));
+                    continue;
+                }
+                ok = upload_item(ctx, input, res);
+            } else {
+                std::string name = j.name.empty() ? "upload.bin" : j.name;
+                std::string type = j.content_type.empty() ? "application/octet-stream" : j.content_type;
+                ok = upload_bytes(ctx, std::move(j.body), name, type, res);
+            }
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - t0;
+            if (ok) metrics().items_ok.fetch_add(1, std::memory_order_relaxed);
+            else metrics().items_failed.fetch_add(1, std::memory_order_relaxed);
+            if (ok) {
+                std::lock_guard<std::mutex> lk(mu);
+                model.observe(j.cost > 0 ? j.cost : res.bytes, ms.count());
+            }
+
+            post(j.conn_id, ok ? json_response(200, "OK", result_json(true, res, ms.count()), j.keep_alive)
+                               : json_response(502, "Bad Gateway", result_json(false, res, ms.count()), j.keep_alive));
+        }
+    }
+
+    // Resolves an ?input= path, symlinks and all, and accepts it only if it
+    // lies under input_root. Runs on a worker: it touches the filesystem.
+    bool confine(std::string input, std::string &resolved) {
+        normalize_input_inplace(input);
+        char *real = realpath(input.c_str(), nullptr);
+        if (!real) return false;
+        resolved = real;
+        free(real);
+        if (input_root == "/") return true;
+        return resolved.size() > input_root.size() && resolved.compare(0, input_root.size(), input_root) == 0 &&
+               resolved[input_root.size()] == '/';
+    }
+
+    // Hands a response from a worker to the event loop.
+    void post(uint64_t conn_id, std::string response) {
+        Done d;
+        d.conn_id = conn_id;
+        d.response = std::move(response);
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            done.push_back(std::move(d));
+        }
+        char b = 1;
+        (void)!write(wake_w, &b, 1);
+    }
+
+    void accept_all() {
+        for (;;) {
+            int fd = accept(lsock, nullptr, nullptr);
+            if (fd < 0) return;
+            set_nonblock(fd);
+            std::unique_ptr<Conn> c(new Conn);
+            c->fd = fd;
+            c->id = next_id++;
+            by_id[c->id] = fd;
+            poller.add(fd, EV_IN);
+            conns[fd] = std::move(c);
+        }
+    }
+
+    void on_readable(Conn &c) {
+        char buf[64 * 1024];
+        for (;;) {
+            if (c.body_left > 0) {
+                PoolBuffer &b = c.upload.body;
+                ssize_t n = recv(c.fd, reinterpret_cast<char *>(b.data() + b.size()), c.body_left, 0);
+                if (n > 0) {
+                    b.resize(b.size() + static_cast<size_t>(n));
+                    c.body_left -= static_cast<size_t>(n);
+                    continue;
+                }
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                close_conn(c);
+                return;
+            }
+            // While waiting for a head, peek and take only up to its end, so
+            // an upload body stays in the socket until process() has given
+            // it a buffer of its own and is then received straight into it.
+            bool want_head = !c.busy && !c.in_upload;
+            ssize_t n = recv(c.fd, buf, sizeof(buf), want_head ? MSG_PEEK : 0);
+            if (n > 0) {
+                size_t old = c.in.size();
+                c.in.append(buf, static_cast<size_t>(n));
+                if (want_head) {
+                    size_t end = c.in.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+                    size_t take = static_cast<size_t>(n);
+                    if (end != std::string::npos) {
+                        take = end + 4 - old;
+                        c.in.resize(end + 4);
+                    }
+                    (void)!recv(c.fd, buf, take, 0);
+                    if (end != std::string::npos) break;
+                }
+                if (c.in.size() > opt.max_body + 64 * 1024) break;
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            // Peer went away. A running job's answer is dropped when it lands.
+            close_conn(c);
+            return;
+        }
+        process(c);
+    }
+
+    void on_done() {
+        char buf[256];
+        while (read(wake_r, buf, sizeof(buf)) > 0) {}
+        std::deque<Done> ready;
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            ready.swap(done);
+        }
+        for (Done &d : ready) deliver(d.conn_id, d.response);
+    }
+
+    void deliver(uint64_t conn_id, const std::string &response) {
+        auto it = by_id.find(conn_id);
+        if (it == by_id.end()) return;
+        Conn &c = *conns[it->second];
+        c.busy = false;
+        c.close_after = !c.keep_alive;
+        c.out += response;
+        if (flush(c)) process(c);
+    }
+
+    int run() {
+        lsock = listen_socket(opt.listen);
+        if (lsock < 0) {
+            std::cout << "无法监听: " << opt.listen << "\n";
+            return 1;
+        }
+        int p[2];
+        if (pipe(p) != 0) return 1;
+        wake_r = p[0];
+        wake_w = p[1];
+        set_nonblock(wake_r);
+        set_nonblock(wake_w);
+        g_wake_w = wake_w;
+        signal(SIGPIPE, SIG_IGN);
+        signal(SIGINT, on_stop_signal);
+        signal(SIGTERM, on_stop_signal);
+
+        poller.add(lsock, EV_IN);
+        poller.add(wake_r, EV_IN);
+
+        if (!opt.input_root.empty()) {
+            char *real = realpath(opt.input_root.c_str(), nullptr);
+            if (!real) {
+                log_line("serve_input_root %s: %s; ?input= stays disabled", opt.input_root.c_str(), strerror(errno));
+            } else if (opt.token.empty()) {
+                log_line("serve_input_root needs serve_token as well; ?input= stays disabled");
+            } else {
+                input_root = real;
+            }
+            free(real);
+        }
+
+        // The fast lanes get wire slots of their own; sharing the workers'
+        // would leave a sticker waiting for a big upload to finish anyway.
+        ctx.limiter.widen(opt.fast_lanes);
+        std::vector<std::thread> pool;
+        for (int i = 0; i < std::max(1, opt.workers); i++) pool.emplace_back([this] { worker(false); });
+        for (int i = 0; i < opt.fast_lanes; i++) pool.emplace_back([this] { worker(true); });
+        log_line("serving uploads on %s with %d workers and %d fast lanes", opt.listen.c_str(), std::max(1, opt.workers),
+                 std::max(0, opt.fast_lanes));
+
+        std::vector<std::pair<int, int>> ready;
+        while (!g_stop) {
+            // Jobs with deadlines are re-checked often enough to answer them
+            // soon after their deadline becomes unreachable.
+            int timeout = 1000;
+            {
+                std::lock_guard<std::mutex> lk(mu);
+                if (jobs.with_deadline > 0) timeout = 20;
+            }
+            if (poller.wait(ready, timeout) < 0 && errno != EINTR) break;
+            for (const auto &r : ready) {
+                if (r.first == lsock) {
+                    accept_all();
+                } else if (r.first == wake_r) {
+                    on_done();
+                } else {
+                    auto it = conns.find(r.first);
+                    if (it == conns.end()) continue;
+                    Conn &c = *it->second;
+                    if ((r.second & EV_OUT) && !flush(c)) continue;
+                    if (r.second & EV_IN) on_readable(c);
+                    else if (r.second & EV_OUT) process(c);
+                }
+            }
+            expire();
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            log_line("shutting down, finishing %zu queued uploads", jobs.size());
+            stopping = true;
+        }
+        cv.notify_all();
+        fast_cv.notify_all();
+        for (std::thread &t : pool) t.join();
+
+        while (!conns.empty()) close_conn(*conns.begin()->second);
+        close(lsock);
+        if (opt.listen.rfind("unix:", 0) == 0) unlink(opt.listen.c_str() + 5);
+        g_wake_w = -1;
+        close(wake_r);
+        close(wake_w);
+        return 0;
+    }
+};
+
+int serve_run(UploadContext &ctx, const ServeOptions &opt) {
+    Server s(ctx, opt);
+    return s.run();
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "pipeline.h"
+
+struct ServeOptions {
+    std::string listen;             // "unix:/path", "host:port" or "port" (bound to 127.0.0.1)
+    int workers = 4;                // threads running uploads
+    size_t max_body = 64u << 20;    // larger request bodies get 413
+    // Deficit round robin weights of the interactive, normal and bulk
+    // classes, in bytes served per round.
+    int weight_interactive = 8;
+    int weight_normal = 4;
+    int weight_bulk = 1;
+    // Extra threads that only run interactive uploads of up to
+    // `fast_lane_max` bytes, so those never wait behind a big upload.
+    int fast_lanes = 1;
+    size_t fast_lane_max = 1u << 20;
+    // `?input=` is refused unless both are set: it then only reads files
+    // under `input_root`. A non-empty `token` must come as
+    // "Authorization: Bearer <token>" on every upload.
+    std::string input_root;
+    std::string token;
+};
+
+// Runs the upload daemon until SIGINT/SIGTERM and returns the exit code.
+// One event-loop thread owns every client socket (epoll on Linux, poll
+// elsewhere); uploads run on `workers` threads sharing `ctx`, so tokens,
+// host rankings, the dedup index and curl connections stay warm.
+//
+//   POST /upload             body is the file; ?name=x.png sets the extension
+//   POST /upload?input=...   local file under input_root; &size=N is a cost hint
+//   GET  /healthz, /metrics
+//
+// Requests are refused with 403 unless Host names a loopback address (not
+// checked on unix sockets) and any Origin is a loopback page as well.
+//
+// An upload may carry ?priority=interactive|normal|bulk (or X-Priority)
+// and ?deadline_ms=N (or X-Deadline-Ms), N counted from receipt. Queued
+// uploads are picked by weighted fair queueing across the classes; one
+// that can no longer finish before its deadline is answered 504 without
+// being run.
+int serve_run(UploadContext &ctx, const ServeOptions &opt);
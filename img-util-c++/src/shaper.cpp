@@ -0,0 +1,174 @@
+#include "shaper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "metrics.h"
+#include "util.h"
+
+struct TokenBucket {
+    std::mutex mu;
+    double rate = 0;
+    double burst = 0;
+    double tokens = 0;
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+    void set_rate(double r, double b) {
+        std::lock_guard<std::mutex> lk(mu);
+        rate = r;
+        burst = b;
+        tokens = std::min(tokens, burst);
+        last = std::chrono::steady_clock::now();
+    }
+
+    // Takes `n` tokens, going into debt if needed, and returns how long the
+    // caller has to wait for the debt to clear.
+    double take(double n) {
+        std::lock_guard<std::mutex> lk(mu);
+        if (rate <= 0) return 0;
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> dt = now - last;
+        last = now;
+        tokens = std::min(burst, tokens + dt.count() * rate);
+        tokens -= n;
+        return tokens >= 0 ? 0 : -tokens / rate;
+    }
+};
+
+static TokenBucket g_bytes;
+static TokenBucket g_requests;
+static std::mutex g_limits_mu;
+static ShaperLimits g_limits;
+static std::atomic<int> g_active{0};
+static std::atomic<uint64_t> g_wait_us{0};
+
+static std::string g_config_path;
+// Lock-free, so the handler may touch it; exchange() keeps a signal that
+// lands between the check and the reset from being lost.
+static std::atomic<int> g_sighup{0};
+
+static void on_sighup(int) { g_sighup = 1; }
+
+static std::string render_shaper() {
+    ShaperLimits l = shaper_limits();
+    std::ostringstream os;
+    os << "# HELP imgutil_rate_limit_bytes_per_second Configured byte rate (0 = unlimited).\n";
+    os << "# TYPE imgutil_rate_limit_bytes_per_second gauge\n";
+    os << "imgutil_rate_limit_bytes_per_second " << l.bytes_per_sec << "\n";
+    os << "# HELP imgutil_rate_limit_requests_per_second Configured request rate (0 = unlimited).\n";
+    os << "# TYPE imgutil_rate_limit_requests_per_second gauge\n";
+    os << "imgutil_rate_limit_requests_per_second " << l.requests_per_sec << "\n";
+    os << "# HELP imgutil_rate_limit_wait_seconds_total Time transfers spent stalled by the rate limiter.\n";
+    os << "# TYPE imgutil_rate_limit_wait_seconds_total counter\n";
+    os << "imgutil_rate_limit_wait_seconds_total " << static_cast<double>(g_wait_us.load()) / 1e6 << "\n";
+    return os.str();
+}
+
+void shaper_configure(const ShaperLimits &l) {
+    static bool registered = false;
+    {
+        std::lock_guard<std::mutex> lk(g_limits_mu);
+        g_limits = l;
+        if (!registered) {
+            metrics_add_collector(render_shaper);
+            registered = true;
+        }
+    }
+    double bps = static_cast<double>(std::max(0LL, l.bytes_per_sec));
+    g_bytes.set_rate(bps, std::max(bps, 64.0 * 1024.0));
+    double rps = std::max(0.0, l.requests_per_sec);
+    g_requests.set_rate(rps, std::max(rps, 1.0));
+}
+
+ShaperLimits shaper_limits() {
+    std::lock_guard<std::mutex> lk(g_limits_mu);
+    return g_limits;
+}
+
+void shaper_reload_on_sighup(const std::string &config_path) {
+    g_config_path = config_path;
+#ifdef SIGHUP
+    signal(SIGHUP, on_sighup);
+#endif
+}
+
+static void check_reload() {
+    if (!g_sighup.exchange(0)) return;
+    std::string cfg;
+    if (!read_text_file(g_config_path, cfg)) {
+        log_line("rate limits: could not re-read %s", g_config_path.c_str());
+        return;
+    }
+    ShaperLimits l;
+    l.bytes_per_sec = json_get_int(cfg, "rate_limit_bytes_per_sec", 0);
+    l.requests_per_sec = json_get_double(cfg, "rate_limit_requests_per_sec", 0);
+    shaper_configure(l);
+    log_line("rate limits reloaded: %lld bytes/s, %g requests/s", l.bytes_per_sec, l.requests_per_sec);
+}
+
+static double note_wait(double seconds) {
+    if (seconds > 0) g_wait_us.fetch_add(static_cast<uint64_t>(seconds * 1e6), std::memory_order_relaxed);
+    return seconds;
+}
+
+static void sleep_seconds(double seconds) {
+    if (seconds > 0) std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+}
+
+static void stall(double seconds) { sleep_seconds(note_wait(seconds)); }
+
+void shaper_request() { sleep_seconds(shaper_request_wait()); }
+
+double shaper_request_wait() {
+    check_reload();
+    return note_wait(g_requests.take(1));
+}
+
+double shaper_charge(double bytes) {
+    check_reload();
+    return note_wait(g_bytes.take(bytes));
+}
+
+static int xferinfo_cb(void *userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+    (void)dltotal;
+    (void)ultotal;
+    check_reload();
+    auto *x = static_cast<ShaperXfer *>(userdata);
+    curl_off_t now = dlnow + ulnow;
+    if (now > x->seen) {
+        double wait = g_bytes.take(static_cast<double>(now - x->seen));
+        x->seen = now;
+        // Sleep in short slices so the transfer does not hit curl's own
+        // low-speed timeouts on very low limits.
+        stall(std::min(wait, 1.0));
+    }
+    return 0;
+}
+
+void shaper_attach(CURL *curl, ShaperXfer &x) {
+    x.seen = 0;
+    x.attached = true;
+    int active = g_active.fetch_add(1) + 1;
+
+    // The callback is always installed so a SIGHUP reload also reaches
+    // transfers that are already running.
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo_cb);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &x);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+
+    long long bps = shaper_limits().bytes_per_sec;
+    curl_off_t share = bps > 0 ? static_cast<curl_off_t>(std::max(1LL, bps / active)) : 0;
+    curl_easy_setopt(curl, CURLOPT_MAX_SEND_SPEED_LARGE, share);
+    curl_easy_setopt(curl, CURLOPT_MAX_RECV_SPEED_LARGE, share);
+}
+
+void shaper_detach(ShaperXfer &x) {
+    if (!x.attached) return;
+    x.attached = false;
+    g_active.fetch_sub(1);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <curl/curl.h>
+
+#include <string>
+
+// Process-wide token buckets for bytes and requests, shared by uploads and
+// downloads on every thread. 0 means unlimited.
+struct ShaperLimits {
+    long long bytes_per_sec = 0;
+    double requests_per_sec = 0;
+};
+
+void shaper_configure(const ShaperLimits &l);
+ShaperLimits shaper_limits();
+
+// Re-reads the rate_limit_* keys from `config_path` whenever the process
+// gets SIGHUP (checked lazily on the next transfer).
+void shaper_reload_on_sighup(const std::string &config_path);
+
+// Blocks until a request token is available.
+void shaper_request();
+// Takes a request token without blocking and returns how many seconds the
+// caller should wait before sending, for callers that cannot sleep.
+double shaper_request_wait();
+
+// Charges `bytes` already sent against the byte bucket without blocking and
+// returns how many seconds the transfer should pause before sending more.
+// For transfers that pace themselves (see BodyReader) instead of stalling
+// in shaper_attach()'s progress callback.
+double shaper_charge(double bytes);
+
+// Per-transfer state for shaper_attach(); must outlive the transfer.
+struct ShaperXfer {
+    curl_off_t seen = 0;
+    bool attached = false;
+};
+
+// Caps the transfer at its fair share of the byte rate via
+// CURLOPT_MAX_SEND_SPEED_LARGE / CURLOPT_MAX_RECV_SPEED_LARGE and charges
+// every byte against the shared bucket from the progress callback, which
+// stalls the transfer while the bucket is in debt.
+void shaper_attach(CURL *curl, ShaperXfer &x);
+void shaper_detach(ShaperXfer &x);
@@ -0,0 +1,101 @@
+#include "shard.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+
+#include "util.h"
+
+static uint64_t fnv1a(const std::string &s) {
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+bool Shard::owns_path(const std::string &path) const {
+    return !active() || static_cast<int>(fnv1a(path) % static_cast<uint64_t>(count)) == index;
+}
+
+bool Shard::owns_key(const std::string &key) const {
+    if (!active()) return true;
+    // The key starts with the hex MD5, which is already uniform.
+    uint64_t prefix = strtoull(key.substr(0, 12).c_str(), nullptr, 16);
+    return static_cast<int>(prefix % static_cast<uint64_t>(count)) == index;
+}
+
+bool shard_parse(const std::string &spec, Shard &out) {
+    size_t slash = spec.find('/');
+    if (slash == std::string::npos) return false;
+    out.index = atoi(spec.substr(0, slash).c_str());
+    out.count = atoi(spec.substr(slash + 1).c_str());
+    return out.count >= 1 && out.index >= 0 && out.index < out.count;
+}
+
+std::string manifest_line(const std::string &key, size_t bytes, const std::string &input) {
+    return key + "\t" + std::to_string(bytes) + "\t" + input + "\n";
+}
+
+bool manifest_read(const std::string &path, const Shard &shard, std::unordered_set<std::string> &keys,
+                   std::vector<std::string> &out) {
+    std::string text;
+    if (!read_text_file(path, text)) return false;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find('\n', pos);
+        if (nl == std::string::npos) nl = text.size();
+        size_t t1 = text.find('\t', pos);
+        size_t t2 = t1 == std::string::npos ? std::string::npos : text.find('\t', t1 + 1);
+        if (t2 != std::string::npos && t2 < nl) {
+            std::string key = text.substr(pos, t1 - pos);
+            if (shard.owns_key(key) && keys.insert(key).second) out.push_back(text.substr(t2 + 1, nl - t2 - 1));
+        }
+        pos = nl + 1;
+    }
+    return true;
+}
+
+bool merge_results(const std::string &out, const std::vector<std::string> &inputs) {
+    std::unordered_map<std::string, size_t> index; // input -> position in `lines`
+    std::vector<std::string> lines;
+    size_t read = 0;
+    for (const std::string &path : inputs) {
+        std::string text;
+        if (!read_text_file(path, text)) {
+            log_line("merge: cannot read %s", path.c_str());
+            continue;
+        }
+        read++;
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t nl = text.find('\n', pos);
+            if (nl == std::string::npos) nl = text.size();
+            std::string line = text.substr(pos, nl - pos);
+            pos = nl + 1;
+            if (line.empty()) continue;
+            std::string key = json_get_string(line, "input", "");
+            auto it = index.find(key);
+            if (it == index.end()) {
+                index[key] = lines.size();
+                lines.push_back(line);
+            } else if (line.find("\"ok\":true") != std::string::npos) {
+                lines[it->second] = line; // a later success replaces a failure
+            }
+        }
+    }
+    if (read == 0) return false;
+
+    FILE *f = fopen(out.c_str(), "wb");
+    if (!f) return false;
+    size_t ok = 0;
+    for (const std::string &l : lines) {
+        fprintf(f, "%s\n", l.c_str());
+        ok += l.find("\"ok\":true") != std::string::npos;
+    }
+    log_line("merge: %zu items from %zu files (%zu ok, %zu failed)", lines.size(), read, ok, lines.size() - ok);
+    return fclose(f) == 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// --shard=i/N: node i of N. Inputs are split by a hash of their path, so a
+// pre-scan (--prescan) reads every file exactly once across the nodes; the
+// upload phase (--manifest) splits by the leading bits of the MD5 key, so
+// identical content found under different paths is uploaded by one node.
+struct Shard {
+    int index = 0;
+    int count = 1;
+
+    bool active() const { return count > 1; }
+    bool owns_path(const std::string &path) const;
+    bool owns_key(const std::string &key) const;
+};
+
+bool shard_parse(const std::string &spec, Shard &out);
+
+// Prescan manifest line: key, bytes, input (tab separated).
+std::string manifest_line(const std::string &key, size_t bytes, const std::string &input);
+
+// Appends to `out` one input per key in `path` that this shard owns;
+// `keys` collects keys already taken so repeated content is skipped.
+bool manifest_read(const std::string &path, const Shard &shard, std::unordered_set<std::string> &keys,
+                   std::vector<std::string> &out);
+
+// Combines per-node --results files into `out`: one line per input, with a
+// success preferred over a failure. Returns false if nothing could be read.
+bool merge_results(const std::string &out, const std::vector<std::string> &inputs);
@@ -0,0 +1,127 @@
+#include "trace.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct TraceEvent {
+    const char *name;
+    uint64_t ts;
+    uint64_t dur;
+    long item;
+};
+
+struct TraceRing {
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> head{0};
+    int tid = 0;
+};
+
+static std::atomic<bool> g_enabled{false};
+static size_t g_capacity = 0;
+static std::mutex g_rings_mu;
+static std::vector<std::unique_ptr<TraceRing>> g_rings;
+static const auto g_epoch = std::chrono::steady_clock::now();
+
+static thread_local TraceRing *t_ring = nullptr;
+static thread_local long t_item = -1;
+
+void trace_enable(size_t events_per_thread) {
+    g_capacity = events_per_thread > 0 ? events_per_thread : 1;
+    g_enabled.store(true, std::memory_order_release);
+}
+
+bool trace_enabled() { return g_enabled.load(std::memory_order_relaxed); }
+
+uint64_t trace_now_us() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - g_epoch).count());
+}
+
+void trace_set_item(long item) { t_item = item; }
+
+static TraceRing *ring() {
+    if (t_ring) return t_ring;
+    std::unique_ptr<TraceRing> r(new TraceRing);
+    r->events.resize(g_capacity);
+    std::lock_guard<std::mutex> lk(g_rings_mu);
+    r->tid = static_cast<int>(g_rings.size()) + 1;
+    t_ring = r.get();
+    g_rings.push_back(std::move(r));
+    return t_ring;
+}
+
+void trace_complete(const char *name, uint64_t start_us, uint64_t dur_us) {
+    if (!trace_enabled()) return;
+    TraceRing *r = ring();
+    uint64_t h = r->head.load(std::memory_order_relaxed);
+    r->events[h % r->events.size()] = TraceEvent{name, start_us, dur_us, t_item};
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+void trace_curl_parts(void *handle, uint64_t start_us) {
+    if (!trace_enabled()) return;
+    CURL *curl = static_cast<CURL *>(handle);
+    curl_off_t dns = 0, conn = 0, tls = 0, pre = 0, first = 0, total = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &conn);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pre);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+    // Zero means "phase did not happen" (e.g. reused connection), so every
+    // boundary is clamped to the previous one.
+    conn = std::max(conn, dns);
+    tls = std::max(tls, conn);
+    pre = std::max(pre, tls);
+    first = std::max(first, pre);
+    total = std::max(total, first);
+
+    struct Part { const char *name; curl_off_t from, to; };
+    const Part parts[] = {
+        {"dns", 0, dns},
+        {"connect", dns, conn},
+        {"tls", conn, tls},
+        {"send", tls, pre},
+        {"wait", pre, first},
+        {"receive", first, total},
+    };
+    for (const Part &p : parts) {
+        if (p.to > p.from) {
+            trace_complete(p.name, start_us + static_cast<uint64_t>(p.from), static_cast<uint64_t>(p.to - p.from));
+        }
+    }
+}
+
+bool trace_write(const std::string &path) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+    fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"img-util-cpp\"}}", f);
+
+    std::lock_guard<std::mutex> lk(g_rings_mu);
+    for (const auto &r : g_rings) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"worker-%d\"}}",
+                r->tid, r->tid);
+        uint64_t head = r->head.load(std::memory_order_acquire);
+        uint64_t cap = r->events.size();
+        uint64_t first = head > cap ? head - cap : 0;
+        for (uint64_t i = first; i < head; i++) {
+            const TraceEvent &e = r->events[i % cap];
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"imgutil\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                       "\"ts\":%llu,\"dur\":%llu,\"args\":{\"item\":%ld}}",
+                    e.name, r->tid, static_cast<unsigned long long>(e.ts), static_cast<unsigned long long>(e.dur),
+                    e.item);
+        }
+    }
+    fputs("\n]}\n", f);
+    return fclose(f) == 0;
+}
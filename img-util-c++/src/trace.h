@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Chrome trace-event recorder. Each thread appends into its own fixed-size
+// ring, so recording is a couple of stores; the rings are only merged when
+// trace_write() runs at exit. Span names must be string literals.
+
+void trace_enable(size_t events_per_thread);
+bool trace_enabled();
+
+uint64_t trace_now_us();
+
+// Item id attached to spans recorded by the calling thread.
+void trace_set_item(long item);
+
+void trace_complete(const char *name, uint64_t start_us, uint64_t dur_us);
+
+struct TraceSpan {
+    explicit TraceSpan(const char *n) : name(n), start(trace_enabled() ? trace_now_us() : 0) {}
+    ~TraceSpan() {
+        if (trace_enabled()) trace_complete(name, start, trace_now_us() - start);
+    }
+    const char *name;
+    uint64_t start;
+};
+
+// Splits a finished transfer into dns/connect/tls/send/wait/receive sub-spans
+// using curl's timing info. `handle` is a CURL *.
+void trace_curl_parts(void *handle, uint64_t start_us);
+
+bool trace_write(const std::string &path);
@@ -0,0 +1,224 @@
+#include "uploader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "breaker.h"
+#include "metrics.h"
+#include "qiniu.h"
+#include "retry.h"
+#include "shaper.h"
+#include "util.h"
+
+struct UploadTask {
+    uint64_t id = 0;
+    std::string input;
+    bool from_bytes = false;
+    PoolBuffer bytes;
+    std::string content_type;
+    UploadCallback done;
+};
+
+struct Uploader::Impl {
+    UploadContext ctx;
+    int max_inflight = 1;
+
+    std::mutex mu;
+    std::condition_variable cv;      // tasks or stopping
+    std::condition_variable idle_cv; // pending reached 0
+    std::deque<UploadTask> tasks;
+    std::vector<std::thread> workers;
+    uint64_t next_id = 1;
+    size_t pending = 0;
+    bool stopping = false;
+
+    void run(UploadTask &t, UploadResult &r) {
+        auto t0 = std::chrono::steady_clock::now();
+        ItemResult res;
+        if (t.from_bytes) {
+            r.ok = upload_bytes(ctx, std::move(t.bytes), t.input, t.content_type, res);
+        } else {
+            normalize_input_inplace(t.input);
+            if (t.input.empty()) res.error = "empty input";
+            else r.ok = upload_item(ctx, t.input, res);
+        }
+        std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - t0;
+        if (r.ok) metrics().items_ok.fetch_add(1, std::memory_order_relaxed);
+        else metrics().items_failed.fetch_add(1, std::memory_order_relaxed);
+        r.id = t.id;
+        r.input = t.input;
+        r.key = std::move(res.key);
+        r.response = std::move(res.resp);
+        r.error = std::move(res.error);
+        r.bytes = res.bytes;
+        r.latency_ms = ms.count();
+    }
+
+    void worker() {
+        for (;;) {
+            UploadTask t;
+            {
+                std::unique_lock<std::mutex> lk(mu);
+                cv.wait(lk, [&] { return stopping || !tasks.empty(); });
+                if (tasks.empty()) return;
+                t = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            UploadResult r;
+            run(t, r);
+            if (t.done) t.done(r);
+            std::lock_guard<std::mutex> lk(mu);
+            if (--pending == 0) idle_cv.notify_all();
+        }
+    }
+
+    uint64_t enqueue(UploadTask &&t) {
+        std::lock_guard<std::mutex> lk(mu);
+        t.id = next_id++;
+        uint64_t id = t.id;
+        tasks.push_back(std::move(t));
+        pending++;
+        // Workers start on first use and grow up to max_inflight.
+        if (workers.size() < static_cast<size_t>(max_inflight) && workers.size() < pending) {
+            workers.emplace_back([this] { worker(); });
+        }
+        cv.notify_one();
+        return id;
+    }
+};
+
+// The retry, breaker, shaper, buffer pool and multiplex settings are
+// process-wide, so a second uploader would silently retune the first.
+static std::mutex g_owner_mu;
+static const Uploader *g_owner = nullptr;
+
+Uploader::Uploader() : impl_(new Impl) {}
+
+Uploader::~Uploader() {
+    close();
+    std::lock_guard<std::mutex> lk(g_owner_mu);
+    if (g_owner == this) g_owner = nullptr;
+}
+
+bool Uploader::open(const std::string &cfg_text, std::string &error, int max_inflight) {
+    {
+        std::lock_guard<std::mutex> lk(g_owner_mu);
+        if (g_owner) {
+            error = g_owner == this ? "uploader is already open" : "another uploader is open in this process";
+            return false;
+        }
+        g_owner = this;
+    }
+    UploadContext &ctx = impl_->ctx;
+    ctx.user_token = json_get_string(cfg_text, "user_token", "");
+    ctx.enable_webp = json_get_bool(cfg_text, "enable_webp", false);
+    ctx.webp_quality = json_get_int(cfg_text, "webp_quality", 95);
+    ctx.bucket = json_get_string(cfg_text, "bucket", "chat68");
+    ctx.qiniu_token_url = json_get_string(cfg_text, "qiniu_token_url", "https://chat-go.jwzhd.com/v1/misc/qiniu-token");
+    ctx.qiniu_query_url = json_get_string(cfg_text, "qiniu_query_url", "https://api.qiniu.com/v4/query");
+    ctx.target.hosts = &ctx.hosts;
+    ctx.target.scheme = json_get_string(cfg_text, "upload_scheme", "https");
+    ctx.target.hedge_ms = json_get_int(cfg_text, "hedge_ms", ctx.target.hedge_ms);
+    ctx.token_ttl_sec = json_get_int(cfg_text, "token_ttl_sec", ctx.token_ttl_sec);
+    ctx.uploaded.capacity = static_cast<size_t>(std::max(1, json_get_int(cfg_text, "dedup_cache_entries", 65536)));
+    ctx.map_files = json_get_bool(cfg_text, "map_files", true);
+    if (ctx.user_token.empty()) {
+        error = "user_token is empty";
+        std::lock_guard<std::mutex> lk(g_owner_mu);
+        g_owner = nullptr;
+        return false;
+    }
+
+    RetryPolicy retry;
+    retry.max_attempts = json_get_int(cfg_text, "retry_max_attempts", retry.max_attempts);
+    retry.base_ms = json_get_int(cfg_text, "retry_base_ms", retry.base_ms);
+    retry.max_ms = json_get_int(cfg_text, "retry_max_ms", retry.max_ms);
+    retry.budget_percent = json_get_int(cfg_text, "retry_budget_percent", retry.budget_percent);
+    retry.budget_min = json_get_int(cfg_text, "retry_budget_min", retry.budget_min);
+    retry_configure(retry);
+
+    BreakerPolicy breaker;
+    breaker.failure_threshold = json_get_int(cfg_text, "breaker_failures", breaker.failure_threshold);
+    breaker.open_ms = json_get_int(cfg_text, "breaker_open_ms", breaker.open_ms);
+    breaker.half_open_probes = json_get_int(cfg_text, "breaker_half_open_probes", breaker.half_open_probes);
+    breaker_configure(breaker);
+
+    ShaperLimits limits;
+    limits.bytes_per_sec = json_get_int(cfg_text, "rate_limit_bytes_per_sec", 0);
+    limits.requests_per_sec = json_get_double(cfg_text, "rate_limit_requests_per_sec", 0);
+    shaper_configure(limits);
+
+    buffer_pool_configure(static_cast<size_t>(std::max(0, json_get_int(cfg_text, "buffer_pool_max_cached_mb", 256))) << 20);
+
+    int inflight = max_inflight > 0 ? max_inflight : json_get_int(cfg_text, "max_inflight", 1);
+    impl_->max_inflight = std::max(1, inflight);
+    LimiterMode mode = limiter_mode_from_string(json_get_string(cfg_text, "concurrency_mode", "fixed"));
+    ctx.limiter.configure(mode, json_get_int(cfg_text, "min_inflight", 1), impl_->max_inflight,
+                          json_get_int(cfg_text, "initial_inflight", std::min(4, impl_->max_inflight)));
+    limiter_export(&ctx.limiter);
+    http_share_init();
+    http_set_ca_file(json_get_string(cfg_text, "ca_file", ""));
+    http_set_max_download(static_cast<size_t>(std::max(0, json_get_int(cfg_text, "download_max_mb", 512))) << 20);
+    MultiplexOptions mux;
+    mux.version = upload_http_version_from_string(json_get_string(cfg_text, "upload_http_version", ""));
+    mux.streams_per_connection = json_get_int(cfg_text, "http2_streams_per_connection", 100);
+    mux.max_connections = json_get_int(cfg_text, "http2_max_connections", 0);
+    http_multiplex_configure(mux);
+    return true;
+}
+
+uint64_t Uploader::submit(const std::string &input, UploadCallback done) {
+    UploadTask t;
+    t.input = input;
+    t.done = std::move(done);
+    return impl_->enqueue(std::move(t));
+}
+
+uint64_t Uploader::submit_bytes(PoolBuffer &&bytes,
+                                const std::string &name,
+                                const std::string &content_type,
+                                UploadCallback done) {
+    UploadTask t;
+    t.input = name;
+    t.from_bytes = true;
+    t.bytes = std::move(bytes);
+    t.content_type = content_type.empty() ? "application/octet-stream" : content_type;
+    t.done = std::move(done);
+    return impl_->enqueue(std::move(t));
+}
+
+bool Uploader::upload(const std::string &input, UploadResult &res) {
+    UploadTask t;
+    t.input = input;
+    impl_->run(t, res);
+    return res.ok;
+}
+
+void Uploader::wait() {
+    std::unique_lock<std::mutex> lk(impl_->mu);
+    impl_->idle_cv.wait(lk, [&] { return impl_->pending == 0; });
+}
+
+void Uploader::close() {
+    wait();
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lk(impl_->mu);
+        impl_->stopping = true;
+        workers.swap(impl_->workers);
+    }
+    impl_->cv.notify_all();
+    for (std::thread &t : workers) t.join();
+    std::lock_guard<std::mutex> lk(impl_->mu);
+    impl_->stopping = false;
+}
+
+int Uploader::max_inflight() const { return impl_->max_inflight; }
+
+UploadContext &Uploader::context() { return impl_->ctx; }
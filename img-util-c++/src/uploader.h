@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "bufpool.h"
+#include "pipeline.h"
+
+struct UploadResult {
+    uint64_t id = 0;     // as returned by submit()
+    std::string input;   // path or URL, or the name given to submit_bytes()
+    bool ok = false;
+    std::string key;
+    std::string response; // Qiniu's JSON answer
+    std::string error;
+    size_t bytes = 0;
+    double latency_ms = 0;
+};
+
+// Called once per submitted item, on one of the uploader's worker threads.
+using UploadCallback = std::function<void(const UploadResult &)>;
+
+// The upload engine as a long-lived object. It keeps the upload token, the
+// ranked host table and the in-run dedup map across items, and runs
+// submitted items on up to max_inflight worker threads, so a service can
+// link it and feed it for its whole lifetime instead of forking the CLI.
+struct Uploader {
+    Uploader();
+    Uploader(const Uploader &) = delete;
+    Uploader &operator=(const Uploader &) = delete;
+    ~Uploader(); // close()
+
+    // Applies a config.json text: the upload settings, plus the process-wide
+    // retry, breaker, rate limit and buffer pool policies. `max_inflight` > 0
+    // overrides the config's max_inflight. Fails if user_token is empty, or
+    // if an uploader is already open in this process; only one may be open
+    // at a time, until it is destroyed.
+    bool open(const std::string &config_text, std::string &error, int max_inflight = 0);
+
+    // Queues a local path or http(s) URL; returns its id.
+    uint64_t submit(const std::string &input, UploadCallback done);
+    // Queues bytes already in memory; `name` only supplies the key's extension.
+    uint64_t submit_bytes(PoolBuffer &&bytes,
+                          const std::string &name,
+                          const std::string &content_type,
+                          UploadCallback done);
+
+    // Uploads on the calling thread, bypassing the queue.
+    bool upload(const std::string &input, UploadResult &res);
+
+    void wait();  // until every submitted item has called back
+    void close(); // wait(), then stop the workers
+
+    int max_inflight() const;
+    // Shared state for front-ends that drive the pipeline themselves
+    // (batch, --serve, --watch).
+    UploadContext &context();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
@@ -0,0 +1,317 @@
+#include "util.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <sys/stat.h>
+
+static inline uint32_t rol(uint32_t x, uint32_t n) { return (x << n) | (x >> (32 - n)); }
+
+static const uint32_t MD5_R[] = {
+    7,12,17,22, 7,12,17,22, 7,12,17,22, 7,12,17,22,
+    5,9,14,20, 5,9,14,20, 5,9,14,20, 5,9,14,20,
+    4,11,16,23, 4,11,16,23, 4,11,16,23, 4,11,16,23,
+    6,10,15,21, 6,10,15,21, 6,10,15,21, 6,10,15,21
+};
+
+static const uint32_t MD5_K[] = {
+    0xd76aa478,0xe8c7b756,0x242070db,0xc1bdceee,
+    0xf57c0faf,0x4787c62a,0xa8304613,0xfd469501,
+    0x698098d8,0x8b44f7af,0xffff5bb1,0x895cd7be,
+    0x6b901122,0xfd987193,0xa679438e,0x49b40821,
+    0xf61e2562,0xc040b340,0x265e5a51,0xe9b6c7aa,
+    0xd62f105d,0x02441453,0xd8a1e681,0xe7d3fbc8,
+    0x21e1cde6,0xc33707d6,0xf4d50d87,0x455a14ed,
+    0xa9e3e905,0xfcefa3f8,0x676f02d9,0x8d2a4c8a,
+    0xfffa3942,0x8771f681,0x6d9d6122,0xfde5380c,
+    0xa4beea44,0x4bdecfa9,0xf6bb4b60,0xbebfbc70,
+    0x289b7ec6,0xeaa127fa,0xd4ef3085,0x04881d05,
+    0xd9d4d039,0xe6db99e5,0x1fa27cf8,0xc4ac5665,
+    0xf4292244,0x432aff97,0xab9423a7,0xfc93a039,
+    0x655b59c3,0x8f0ccc92,0xffeff47d,0x85845dd1,
+    0x6fa87e4f,0xfe2ce6e0,0xa3014314,0x4e0811a1,
+    0xf7537e82,0xbd3af235,0x2ad7d2bb,0xeb86d391
+};
+
+void Md5::block(const unsigned char *p) {
+    uint32_t w[16];
+    memcpy(w, p, 64); // input may be unaligned (mapped files, network buffers)
+    uint32_t a = h[0];
+    uint32_t b = h[1];
+    uint32_t c = h[2];
+    uint32_t d = h[3];
+
+    for (uint32_t i = 0; i < 64; i++) {
+        uint32_t f, g;
+        if (i < 16) {
+            f = (b & c) | ((~b) & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | ((~d) & c);
+            g = (5 * i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = c ^ (b | (~d));
+            g = (7 * i) % 16;
+        }
+        uint32_t temp = d;
+        d = c;
+        c = b;
+        uint32_t x = a + f + MD5_K[i] + w[g];
+        b = b + rol(x, MD5_R[i]);
+        a = temp;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+}
+
+void Md5::update(const unsigned char *data, size_t len) {
+    total += len;
+    if (buf_len > 0) {
+        size_t take = std::min(len, sizeof(buf) - buf_len);
+        memcpy(buf + buf_len, data, take);
+        buf_len += take;
+        data += take;
+        len -= take;
+        if (buf_len < sizeof(buf)) return;
+        block(buf);
+        buf_len = 0;
+    }
+    for (; len >= 64; data += 64, len -= 64) block(data);
+    memcpy(buf, data, len);
+    buf_len = len;
+}
+
+void Md5::finish(unsigned char digest[16]) {
+    unsigned long long bits_len = static_cast<unsigned long long>(total) * 8;
+    unsigned char pad[72] = {0x80};
+    size_t pad_len = (buf_len < 56 ? 56 : 120) - buf_len;
+    update(pad, pad_len);
+    update(reinterpret_cast<const unsigned char *>(&bits_len), 8);
+    memcpy(digest, h, 16);
+}
+
+void md5(const unsigned char *initial_msg, size_t initial_len, unsigned char digest[16]) {
+    Md5 m;
+    m.update(initial_msg, initial_len);
+    m.finish(digest);
+}
+
+std::string md5_hex(const unsigned char *data, size_t len) {
+    unsigned char dig[16];
+    md5(data, len, dig);
+    static const char *hex = "0123456789abcdef";
+    std::string out;
+    out.resize(32);
+    for (int i = 0; i < 16; i++) {
+        out[i * 2] = hex[(dig[i] >> 4) & 0xF];
+        out[i * 2 + 1] = hex[dig[i] & 0xF];
+    }
+    return out;
+}
+
+// Size via the descriptor rather than ftell(), whose long result caps
+// files at 2 GB on LLP64 and 32-bit platforms.
+static bool file_size(FILE *f, uint64_t &size) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(_fileno(f), &st) != 0) return false;
+#else
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0) return false;
+#endif
+    size = static_cast<uint64_t>(st.st_size);
+    return true;
+}
+
+template <typename Container>
+static bool read_whole_file(const std::string &path, Container &out) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    uint64_t n = 0;
+    if (!file_size(f, n) || n > SIZE_MAX) {
+        fclose(f);
+        return false;
+    }
+    out.resize(static_cast<size_t>(n));
+    size_t r = n > 0 ? fread(&out[0], 1, out.size(), f) : 0;
+    fclose(f);
+    out.resize(r);
+    return true;
+}
+
+bool read_text_file(const std::string &path, std::string &out) { return read_whole_file(path, out); }
+
+bool read_bin_file(const std::string &path, std::vector<unsigned char> &out) { return read_whole_file(path, out); }
+
+bool read_bin_file(const std::string &path, PoolBuffer &out) { return read_whole_file(path, out); }
+
+static const char *json_find_key(const std::string &json, const std::string &key) {
+    std::string pat = "\"" + key + "\"";
+    const char *base = json.c_str();
+    const char *p = strstr(base, pat.c_str());
+    if (!p) return nullptr;
+    p = strchr(p + pat.size(), ':');
+    if (!p) return nullptr;
+    p++;
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++;
+    return p;
+}
+
+bool json_get_bool(const std::string &json, const std::string &key, bool defv) {
+    const char *p = json_find_key(json, key);
+    if (!p) return defv;
+    if (strncmp(p, "true", 4) == 0) return true;
+    if (strncmp(p, "false", 5) == 0) return false;
+    return defv;
+}
+
+int json_get_int(const std::string &json, const std::string &key, int defv) {
+    const char *p = json_find_key(json, key);
+    if (!p) return defv;
+    return atoi(p);
+}
+
+double json_get_double(const std::string &json, const std::string &key, double defv) {
+    const char *p = json_find_key(json, key);
+    if (!p) return defv;
+    return strtod(p, nullptr);
+}
+
+std::string json_get_string(const std::string &json, const std::string &key, const std::string &defv) {
+    const char *p = json_find_key(json, key);
+    if (!p || *p != '"') return defv;
+    p++;
+    const char *e = strchr(p, '"');
+    if (!e) return defv;
+    return std::string(p, static_cast<size_t>(e - p));
+}
+
+std::string json_escape(const std::string &s) {
+    std::string out;
+    out.reserve(s.size() + 2);
+    for (char c : s) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += c;
+            }
+        }
+    }
+    return out;
+}
+
+void json_pretty_print(const std::string &raw, std::ostream &os) {
+    const char *s = raw.c_str();
+    int indent = 0;
+    bool in_str = false;
+    bool esc = false;
+    while (*s) {
+        char c = *s++;
+        if (esc) {
+            os << c;
+            esc = false;
+            continue;
+        }
+        if (in_str && c == '\\') {
+            os << c;
+            esc = true;
+            continue;
+        }
+        if (c == '"') {
+            os << c;
+            in_str = !in_str;
+            continue;
+        }
+        if (in_str) {
+            os << c;
+            continue;
+        }
+        if (c == '{' || c == '[') {
+            os << c << "\n";
+            indent++;
+            for (int i = 0; i < indent; i++) os << "  ";
+        } else if (c == '}' || c == ']') {
+            os << "\n";
+            indent = indent > 0 ? indent - 1 : 0;
+            for (int i = 0; i < indent; i++) os << "  ";
+            os << c;
+        } else if (c == ',') {
+            os << c << "\n";
+            for (int i = 0; i < indent; i++) os << "  ";
+        } else if (c == ':') {
+            os << ": ";
+        } else if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+        } else {
+            os << c;
+        }
+    }
+    os << "\n";
+}
+
+void normalize_input_inplace(std::string &s) {
+    while (!s.empty()) {
+        char c = s.back();
+        if (c == '\n' || c == '\r' || c == '+' || std::isspace(static_cast<unsigned char>(c))) s.pop_back();
+        else break;
+    }
+    size_t start = 0;
+    while (start < s.size() && std::isspace(static_cast<unsigned char>(s[start]))) start++;
+    if (start > 0) s.erase(0, start);
+    if (s.size() >= 2) {
+        if ((s.front() == '"' && s.back() == '"') || (s.front() == '\'' && s.back() == '\'')) {
+            s = s.substr(1, s.size() - 2);
+        }
+    }
+}
+
+std::string basename_from_path_or_url(const std::string &s) {
+    size_t p1 = s.find_last_of("/\\");
+    if (p1 == std::string::npos) return s;
+    return s.substr(p1 + 1);
+}
+
+std::string url_host(const std::string &url) {
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    size_t end = url.find_first_of("/?#", start);
+    std::string host = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    size_t at = host.rfind('@');
+    if (at != std::string::npos) host.erase(0, at + 1);
+    for (char &c : host) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return host;
+}
+
+void log_line(const char *fmt, ...) {
+    static std::mutex mu;
+    char msg[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    time_t now = time(nullptr);
+    char ts[32];
+    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    std::lock_guard<std::mutex> lk(mu);
+    fprintf(stderr, "[%s] %s\n", ts, msg);
+}
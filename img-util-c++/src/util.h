@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bufpool.h"
+
+// Streaming MD5: update() hashes whole 64-byte blocks straight from the
+// caller's memory, so large inputs are never copied.
+struct Md5 {
+    uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+    unsigned char buf[64];
+    size_t buf_len = 0;
+    uint64_t total = 0;
+
+    void update(const unsigned char *data, size_t len);
+    void finish(unsigned char digest[16]);
+
+private:
+    void block(const unsigned char *p);
+};
+
+void md5(const unsigned char *initial_msg, size_t initial_len, unsigned char digest[16]);
+std::string md5_hex(const unsigned char *data, size_t len);
+
+bool read_text_file(const std::string &path, std::string &out);
+bool read_bin_file(const std::string &path, std::vector<unsigned char> &out);
+bool read_bin_file(const std::string &path, PoolBuffer &out);
+
+// Flat key lookups; the first occurrence of "key" anywhere in the text wins.
+bool json_get_bool(const std::string &json, const std::string &key, bool defv);
+int json_get_int(const std::string &json, const std::string &key, int defv);
+double json_get_double(const std::string &json, const std::string &key, double defv);
+std::string json_get_string(const std::string &json, const std::string &key, const std::string &defv);
+std::string json_escape(const std::string &s);
+void json_pretty_print(const std::string &raw, std::ostream &os = std::cout);
+
+// Host (and port) part of a URL, lower-cased; empty if there is none.
+std::string url_host(const std::string &url);
+
+// Timestamped diagnostic line on stderr, kept apart from the result output.
+void log_line(const char *fmt, ...);
+
+void normalize_input_inplace(std::string &s);
+std::string basename_from_path_or_url(const std::string &s);
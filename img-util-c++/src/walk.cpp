@@ -0,0 +1,239 @@
+#include "walk.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <sys/stat.h>
+
+#include "util.h"
+
+#ifdef __linux__
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <filesystem>
+#include <fstream>
+#endif
+
+WalkFilter walk_filter_from_string(const std::string &s) {
+    if (s == "magic") return WALK_MAGIC;
+    if (s == "all") return WALK_ALL;
+    return WALK_EXTENSION;
+}
+
+bool is_directory(const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFMT) == S_IFDIR;
+}
+
+static bool extension_ok(const char *name, const std::vector<std::string> &exts) {
+    const char *dot = strrchr(name, '.');
+    if (!dot || !dot[1]) return false;
+    std::string e(dot + 1);
+    for (char &c : e) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return std::find(exts.begin(), exts.end(), e) != exts.end();
+}
+
+static bool magic_ok(const unsigned char *b, size_t n) {
+    if (n >= 3 && b[0] == 0xFF && b[1] == 0xD8 && b[2] == 0xFF) return true;                       // jpeg
+    if (n >= 8 && memcmp(b, "\x89PNG\r\n\x1a\n", 8) == 0) return true;                              // png
+    if (n >= 6 && (memcmp(b, "GIF87a", 6) == 0 || memcmp(b, "GIF89a", 6) == 0)) return true;        // gif
+    if (n >= 12 && memcmp(b, "RIFF", 4) == 0 && memcmp(b + 8, "WEBP", 4) == 0) return true;         // webp
+    if (n >= 2 && b[0] == 'B' && b[1] == 'M') return true;                                          // bmp
+    if (n >= 12 && memcmp(b + 4, "ftyp", 4) == 0) {                                                 // heif/avif
+        static const char *brands[] = {"heic", "heix", "hevc", "mif1", "msf1", "avif", "avis"};
+        for (const char *br : brands) {
+            if (memcmp(b + 8, br, 4) == 0) return true;
+        }
+    }
+    return false;
+}
+
+#ifdef __linux__
+
+// getdents64 is not wrapped by older glibc.
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+struct DirFd {
+    int fd;
+    explicit DirFd(int f) : fd(f) {}
+    ~DirFd() { close(fd); }
+};
+
+// A directory still to be read, opened relative to its parent so the walk
+// never re-resolves long paths.
+struct DirTask {
+    std::shared_ptr<DirFd> parent;
+    std::string name;
+    std::string path;
+};
+
+struct WalkDeque {
+    std::mutex mu;
+    std::deque<DirTask> tasks;
+};
+
+struct Walker {
+    const WalkOptions &opt;
+    const std::function<void(const std::string &)> &emit;
+    std::vector<std::unique_ptr<WalkDeque>> deques;
+    std::atomic<long> outstanding{0}; // queued + being read
+    std::atomic<size_t> emitted{0};
+
+    Walker(const WalkOptions &o, const std::function<void(const std::string &)> &e) : opt(o), emit(e) {}
+
+    void push(size_t self, DirTask &&t) {
+        outstanding.fetch_add(1);
+        std::lock_guard<std::mutex> lk(deques[self]->mu);
+        deques[self]->tasks.push_back(std::move(t));
+    }
+
+    // Own deque from the back (depth first keeps few directories open),
+    // other deques from the front (their oldest, usually biggest, subtrees).
+    bool pop(size_t self, DirTask &out) {
+        {
+            WalkDeque &d = *deques[self];
+            std::lock_guard<std::mutex> lk(d.mu);
+            if (!d.tasks.empty()) {
+                out = std::move(d.tasks.back());
+                d.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < deques.size(); i++) {
+            WalkDeque &d = *deques[(self + i) % deques.size()];
+            std::lock_guard<std::mutex> lk(d.mu);
+            if (!d.tasks.empty()) {
+                out = std::move(d.tasks.front());
+                d.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool accept(int dfd, const char *name) {
+        if (opt.filter == WALK_ALL) return true;
+        if (opt.filter == WALK_EXTENSION) return extension_ok(name, opt.extensions);
+        int fd = openat(dfd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) return false;
+        unsigned char head[16];
+        ssize_t n = pread(fd, head, sizeof(head), 0);
+        close(fd);
+        return n > 0 && magic_ok(head, static_cast<size_t>(n));
+    }
+
+    void read_dir(size_t self, DirTask &t) {
+        int pfd = t.parent ? t.parent->fd : AT_FDCWD;
+        int fd = openat(pfd, t.name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            log_line("walk: cannot open %s: %s", t.path.c_str(), strerror(errno));
+            return;
+        }
+        std::shared_ptr<DirFd> dir(new DirFd(fd));
+
+        alignas(8) char buf[64 * 1024];
+        for (;;) {
+            long n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+            if (n <= 0) break;
+            for (long off = 0; off < n;) {
+                auto *e = reinterpret_cast<LinuxDirent64 *>(buf + off);
+                off += e->d_reclen;
+                const char *name = e->d_name;
+                if (name[0] == '.') continue; // ".", ".." and hidden entries
+
+                unsigned char type = e->d_type;
+                if (type == DT_UNKNOWN) {
+                    struct stat st;
+                    if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                    if (S_ISDIR(st.st_mode)) type = DT_DIR;
+                    else if (S_ISREG(st.st_mode)) type = DT_REG;
+                }
+                std::string path = t.path + "/" + name;
+                if (type == DT_DIR) {
+                    push(self, DirTask{dir, name, path});
+                } else if (type == DT_REG && accept(fd, name)) {
+                    emitted.fetch_add(1, std::memory_order_relaxed);
+                    emit(path);
+                }
+            }
+        }
+    }
+
+    void run(size_t self) {
+        DirTask t;
+        for (;;) {
+            if (pop(self, t)) {
+                read_dir(self, t);
+                t = DirTask();
+                outstanding.fetch_sub(1);
+            } else if (outstanding.load() == 0) {
+                return;
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+    }
+};
+
+size_t walk_tree(const std::string &root, const WalkOptions &opt, const std::function<void(const std::string &)> &emit) {
+    Walker w(opt, emit);
+    size_t n = static_cast<size_t>(std::max(1, opt.threads));
+    for (size_t i = 0; i < n; i++) w.deques.emplace_back(new WalkDeque);
+
+    std::string path = root;
+    while (path.size() > 1 && path.back() == '/') path.pop_back();
+    w.push(0, DirTask{nullptr, path, path});
+
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < n; i++) pool.emplace_back([&w, i] { w.run(i); });
+    w.run(0);
+    for (std::thread &t : pool) t.join();
+    return w.emitted.load();
+}
+
+#else
+
+size_t walk_tree(const std::string &root, const WalkOptions &opt, const std::function<void(const std::string &)> &emit) {
+    namespace fs = std::filesystem;
+    size_t count = 0;
+    std::error_code ec;
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        std::string name = it->path().filename().string();
+        if (!name.empty() && name[0] == '.') {
+            if (it->is_directory(ec)) it.disable_recursion_pending();
+            continue;
+        }
+        if (it->is_symlink(ec) || !it->is_regular_file(ec)) continue;
+        bool ok = opt.filter == WALK_ALL;
+        if (opt.filter == WALK_EXTENSION) ok = extension_ok(name.c_str(), opt.extensions);
+        if (opt.filter == WALK_MAGIC) {
+            unsigned char head[16];
+            std::ifstream f(it->path(), std::ios::binary);
+            f.read(reinterpret_cast<char *>(head), sizeof(head));
+            ok = f.gcount() > 0 && magic_ok(head, static_cast<size_t>(f.gcount()));
+        }
+        if (!ok) continue;
+        count++;
+        emit(it->path().string());
+    }
+    return count;
+}
+
+#endif
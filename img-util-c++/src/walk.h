@@ -0,0 +1,29 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+enum WalkFilter {
+    WALK_EXTENSION, // name ends in one of `extensions`
+    WALK_MAGIC,     // first bytes look like a known image format
+    WALK_ALL,
+};
+
+struct WalkOptions {
+    int threads = 4;
+    WalkFilter filter = WALK_EXTENSION;
+    std::vector<std::string> extensions = {"jpg", "jpeg", "png", "gif", "webp", "bmp", "heic", "heif", "avif"};
+};
+
+WalkFilter walk_filter_from_string(const std::string &s);
+
+bool is_directory(const std::string &path);
+
+// Recursively lists regular files under `root` and calls `emit` for each
+// match as soon as it is found, from several threads at once; `emit` must be
+// thread-safe. Hidden entries and symlinks are skipped. On Linux the walk
+// uses openat + getdents64 with per-thread deques and work stealing;
+// elsewhere it falls back to a single-threaded std::filesystem walk.
+// Returns the number of files emitted.
+size_t walk_tree(const std::string &root, const WalkOptions &opt, const std::function<void(const std::string &)> &emit);
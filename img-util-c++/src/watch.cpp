@@ -0,0 +1,342 @@
+#include "watch.h"
+
+#include <iostream>
+
+#ifndef __linux__
+
+int watch_run(UploadContext &ctx, const WatchOptions &opt) {
+    (void)ctx;
+    (void)opt;
+    std::cout << "--watch 仅支持 Linux\n";
+    return 1;
+}
+
+#else
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "trace.h"
+#include "util.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static int g_wake_w = -1;
+static volatile std::sig_atomic_t g_stop = 0;
+
+static void on_stop_signal(int) {
+    g_stop = 1;
+    char b = 0;
+    if (g_wake_w >= 0) (void)!write(g_wake_w, &b, 1);
+}
+
+static bool ends_with(const std::string &s, const char *suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// Editors and downloaders write to hidden or suffixed temp files and rename
+// them into place; only the final name is uploaded.
+static bool skip_name(const std::string &name) {
+    return name.empty() || name[0] == '.' || ends_with(name, "~") || ends_with(name, ".tmp") ||
+           ends_with(name, ".part") || ends_with(name, ".crdownload");
+}
+
+struct Pending {
+    Clock::time_point due;
+    long long size = -1;
+};
+
+struct Watcher {
+    UploadContext &ctx;
+    WatchOptions opt;
+
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::string> queue;
+    std::set<std::string> inflight; // queued or uploading
+    bool stopping = false;
+
+    std::map<std::string, Pending> pending; // event-loop thread only
+    time_t drained_at = 0;                   // every event before this was read
+    std::mutex out_mu;
+    std::atomic<long> seq{0};
+
+    Watcher(UploadContext &c, const WatchOptions &o) : ctx(c), opt(o) {}
+
+    static long long file_size(const std::string &path, bool *regular = nullptr) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return -1;
+        if (regular) *regular = S_ISREG(st.st_mode);
+        return static_cast<long long>(st.st_size);
+    }
+
+    void schedule(const std::string &path) {
+        Pending &p = pending[path];
+        p.due = Clock::now() + std::chrono::milliseconds(opt.settle_ms);
+        p.size = file_size(path);
+    }
+
+    void enqueue(const std::string &path) {
+        std::lock_guard<std::mutex> lk(mu);
+        inflight.insert(path);
+        queue.push_back(path);
+        cv.notify_one();
+    }
+
+    bool is_inflight(const std::string &path) {
+        std::lock_guard<std::mutex> lk(mu);
+        return inflight.count(path) != 0;
+    }
+
+    void finish(const std::string &path) {
+        if (opt.on_success == "delete") {
+            if (unlink(path.c_str()) != 0) log_line("watch: could not delete %s: %s", path.c_str(), strerror(errno));
+        } else if (opt.on_success == "move") {
+            std::string to = opt.done_dir + "/" + basename_from_path_or_url(path);
+            if (rename(path.c_str(), to.c_str()) != 0) {
+                log_line("watch: could not move %s to %s: %s", path.c_str(), to.c_str(), strerror(errno));
+            }
+        }
+    }
+
+    void worker() {
+        for (;;) {
+            std::string path;
+            {
+                std::unique_lock<std::mutex> lk(mu);
+                cv.wait(lk, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                path = queue.front();
+                queue.pop_front();
+            }
+            trace_set_item(seq.fetch_add(1));
+
+            auto t0 = Clock::now();
+            ItemResult res;
+            bool ok = upload_item(ctx, path, res);
+            std::chrono::duration<double, std::milli> ms = Clock::now() - t0;
+            if (ok) {
+                metrics().items_ok.fetch_add(1, std::memory_order_relaxed);
+                finish(path);
+            } else {
+                metrics().items_failed.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            {
+                std::lock_guard<std::mutex> lk(out_mu);
+                if (ok) std::cout << "上传成功: " << path << " -> " << res.key << "\n";
+                else std::cout << "上传失败: " << path << ": " << res.error << "\n";
+                std::cout.flush();
+                if (opt.results) {
+                    write_result_line(opt.results, path, ok, res, ms.count());
+                    fflush(opt.results);
+                }
+            }
+
+            std::lock_guard<std::mutex> lk(mu);
+            inflight.erase(path);
+        }
+    }
+
+    // Files already in the directory. Anything touched within the settle
+    // window may still be being written, so it goes through the debounce.
+    // Files already queued or uploading are left to the worker that has them.
+    void scan_backlog() {
+        DIR *d = opendir(opt.dir.c_str());
+        if (!d) return;
+        size_t now_count = 0;
+        time_t cutoff = time(nullptr) - (opt.settle_ms + 999) / 1000;
+        while (dirent *e = readdir(d)) {
+            std::string name = e->d_name;
+            if (skip_name(name)) continue;
+            std::string path = opt.dir + "/" + name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (is_inflight(path)) continue;
+            if (st.st_mtime < cutoff) {
+                enqueue(path);
+                now_count++;
+            } else {
+                schedule(path);
+            }
+        }
+        closedir(d);
+        log_line("watch: %zu files in backlog", now_count + pending.size());
+    }
+
+    // After the kernel queue overflowed, the lost events can only have been
+    // for files written since the queue was last drained. Those go back
+    // through the debounce; older files were already seen and are not resent.
+    void rescan_since(time_t since) {
+        DIR *d = opendir(opt.dir.c_str());
+        if (!d) return;
+        size_t count = 0;
+        while (dirent *e = readdir(d)) {
+            std::string name = e->d_name;
+            if (skip_name(name)) continue;
+            std::string path = opt.dir + "/" + name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (st.st_mtime < since || is_inflight(path)) continue;
+            schedule(path);
+            count++;
+        }
+        closedir(d);
+        log_line("watch: event queue overflowed, rescanned %zu files", count);
+    }
+
+    void handle_events(int fd) {
+        alignas(inotify_event) char buf[16 * 1024];
+        time_t started = time(nullptr);
+        bool overflowed = false;
+        for (;;) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) break;
+            for (char *p = buf; p < buf + n;) {
+                auto *ev = reinterpret_cast<inotify_event *>(p);
+                p += sizeof(inotify_event) + ev->len;
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    overflowed = true;
+                    continue;
+                }
+                if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                    log_line("watch: %s was removed, stopping", opt.dir.c_str());
+                    g_stop = 1;
+                    continue;
+                }
+                if (ev->len == 0 || (ev->mask & IN_ISDIR)) continue;
+                std::string name = ev->name;
+                if (skip_name(name)) continue;
+                std::string path = opt.dir + "/" + name;
+                if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                    schedule(path);
+                } else if ((ev->mask & IN_MODIFY) && pending.count(path)) {
+                    schedule(path); // still being written: push the deadline out
+                }
+            }
+        }
+        // mtime has one-second resolution, so the boundary second is rescanned.
+        if (overflowed) rescan_since(drained_at - 1);
+        drained_at = started;
+    }
+
+    // Hands settled files to the workers and returns the poll timeout until
+    // the next deadline.
+    int dispatch_due() {
+        auto now = Clock::now();
+        Clock::time_point next = now + std::chrono::seconds(1);
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (it->second.due > now) {
+                next = std::min(next, it->second.due);
+                ++it;
+                continue;
+            }
+            bool regular = false;
+            long long size = file_size(it->first, &regular);
+            if (size < 0 || !regular) {
+                it = pending.erase(it);
+            } else if (size != it->second.size || is_inflight(it->first)) {
+                // Grew since the event, or the previous version is still
+                // uploading: wait another settle period.
+                it->second.size = size;
+                it->second.due = now + std::chrono::milliseconds(opt.settle_ms);
+                next = std::min(next, it->second.due);
+                ++it;
+            } else {
+                enqueue(it->first);
+                it = pending.erase(it);
+            }
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+        return static_cast<int>(std::max<long long>(1, ms));
+    }
+
+    int run() {
+        while (opt.dir.size() > 1 && opt.dir.back() == '/') opt.dir.pop_back();
+        if (opt.on_success.empty()) opt.on_success = "keep";
+        if (opt.on_success != "keep" && opt.on_success != "delete" && opt.on_success != "move") {
+            std::cout << "watch_on_success 只能是 keep、delete 或 move\n";
+            return 1;
+        }
+        if (opt.on_success == "move") {
+            if (opt.done_dir.empty()) opt.done_dir = opt.dir + "/done";
+            mkdir(opt.done_dir.c_str(), 0755);
+        }
+
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_DELETE_SELF | IN_MOVE_SELF;
+        if (fd < 0 || inotify_add_watch(fd, opt.dir.c_str(), mask) < 0) {
+            std::cout << "无法监视目录: " << opt.dir << "\n";
+            if (fd >= 0) close(fd);
+            return 1;
+        }
+        int wake[2];
+        if (pipe(wake) != 0) {
+            close(fd);
+            return 1;
+        }
+        fcntl(wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(wake[1], F_SETFL, O_NONBLOCK);
+        g_wake_w = wake[1];
+        signal(SIGINT, on_stop_signal);
+        signal(SIGTERM, on_stop_signal);
+
+        // The watch is in place before the scan, so nothing written in
+        // between is missed; duplicates are filtered by `inflight`.
+        std::vector<std::thread> pool;
+        for (int i = 0; i < std::max(1, opt.workers); i++) pool.emplace_back([this] { worker(); });
+        drained_at = time(nullptr);
+        scan_backlog();
+        log_line("watching %s (settle %d ms, on success: %s)", opt.dir.c_str(), opt.settle_ms, opt.on_success.c_str());
+
+        while (!g_stop) {
+            int timeout = dispatch_due();
+            pollfd p[2] = {{fd, POLLIN, 0}, {wake[0], POLLIN, 0}};
+            if (poll(p, 2, timeout) < 0 && errno != EINTR) break;
+            if (p[0].revents & POLLIN) handle_events(fd);
+        }
+
+        {
+            std::lock_guard<std::mutex> lk(mu);
+            log_line("watch: stopping, finishing %zu queued uploads", queue.size());
+            stopping = true;
+        }
+        cv.notify_all();
+        for (std::thread &t : pool) t.join();
+
+        g_wake_w = -1;
+        close(wake[0]);
+        close(wake[1]);
+        close(fd);
+        return 0;
+    }
+};
+
+int watch_run(UploadContext &ctx, const WatchOptions &opt) {
+    // A producer may truncate or rewrite a file it dropped here while the
+    // upload is still reading it; a mapped read would take SIGBUS for that.
+    ctx.map_files = false;
+    Watcher w(ctx, opt);
+    return w.run();
+}
+
+#endif
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+#include "pipeline.h"
+
+struct WatchOptions {
+    std::string dir;
+    int workers = 4;
+    int settle_ms = 500;        // a file must be quiet this long before upload
+    std::string on_success;     // "keep" (default), "delete" or "move"
+    std::string done_dir;       // target for "move"; default <dir>/done
+    FILE *results = nullptr;    // optional JSONL results, as with --results
+};
+
+// Uploads every file already in `dir` and then every file closed after
+// writing or moved into it, until SIGINT/SIGTERM. Linux only (inotify).
+int watch_run(UploadContext &ctx, const WatchOptions &opt);
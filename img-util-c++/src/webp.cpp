@@ -0,0 +1,67 @@
+#include "webp.h"
+
+#include "util.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#ifdef _WIN32
+#include <process.h>
+#include <windows.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+static std::atomic<unsigned> g_seq{0};
+
+bool run_cwebp(ByteView in, int quality, PoolBuffer &out) {
+    char in_path[512];
+    char out_path[512];
+    unsigned long long t = static_cast<unsigned long long>(time(nullptr));
+    // Several items can be encoded at once, so the name has to be unique per call.
+    unsigned long long id = (static_cast<unsigned long long>(getpid()) << 20) + g_seq.fetch_add(1);
+
+#ifdef _WIN32
+    char tmp[MAX_PATH];
+    GetTempPathA(MAX_PATH, tmp);
+    snprintf(in_path, sizeof(in_path), "%simgutil_%llu_%llu.input", tmp, t, id);
+    snprintf(out_path, sizeof(out_path), "%simgutil_%llu_%llu.webp", tmp, t, id);
+#else
+    snprintf(in_path, sizeof(in_path), "/tmp/imgutil_%llu_%llu.input", t, id);
+    snprintf(out_path, sizeof(out_path), "/tmp/imgutil_%llu_%llu.webp", t, id);
+#endif
+
+    FILE *f = fopen(in_path, "wb");
+    if (!f) return false;
+    bool wrote = fwrite(in.data, 1, in.size, f) == in.size;
+    if (fclose(f) != 0 || !wrote) {
+        remove(in_path);
+        return false;
+    }
+
+    char cmd[1200];
+#ifdef _WIN32
+    snprintf(cmd, sizeof(cmd), "cwebp -q %d \"%s\" -o \"%s\"", quality, in_path, out_path);
+#else
+    snprintf(cmd, sizeof(cmd), "cwebp -q %d '%s' -o '%s'", quality, in_path, out_path);
+#endif
+
+    int rc = system(cmd);
+    remove(in_path);
+    if (rc != 0) {
+        remove(out_path);
+        return false;
+    }
+
+    PoolBuffer wb;
+    if (!read_bin_file(out_path, wb)) {
+        remove(out_path);
+        return false;
+    }
+    remove(out_path);
+    out.swap(wb);
+    return true;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+
+#include "bufpool.h"
+
+// Re-encodes `in` with the external cwebp binary.
+bool run_cwebp(ByteView in, int quality, PoolBuffer &out);
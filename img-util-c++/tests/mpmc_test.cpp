@@ -0,0 +1,144 @@
+// MpmcQueue under contention: every pushed item is popped exactly once for
+// several producer/consumer mixes, with rings small enough that both sides
+// park, and close() lets consumers drain what is left before pop() fails.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "mpmc.h"
+
+static int g_failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            g_failures++;                                                            \
+        }                                                                            \
+    } while (0)
+
+// Items are producer * per_producer + i, so each one has a slot in `seen`.
+static void exactly_once(int producers, int consumers, size_t per_producer, size_t capacity) {
+    MpmcQueue<uint64_t> q(capacity);
+    std::vector<std::atomic<uint32_t>> seen(producers * per_producer);
+    for (auto &s : seen) s.store(0);
+    std::atomic<bool> push_failed{false};
+
+    std::vector<std::thread> pop_threads;
+    for (int c = 0; c < consumers; c++) {
+        pop_threads.emplace_back([&] {
+            uint64_t v;
+            while (q.pop(v)) {
+                if (v < seen.size()) seen[v].fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    std::vector<std::thread> push_threads;
+    for (int p = 0; p < producers; p++) {
+        push_threads.emplace_back([&, p] {
+            for (size_t i = 0; i < per_producer; i++) {
+                if (!q.push(static_cast<uint64_t>(p * per_producer + i))) push_failed = true;
+            }
+        });
+    }
+    for (std::thread &t : push_threads) t.join();
+    q.close();
+    for (std::thread &t : pop_threads) t.join();
+
+    CHECK(!push_failed);
+    size_t lost = 0, duplicated = 0;
+    for (auto &s : seen) {
+        uint32_t n = s.load();
+        if (n == 0) lost++;
+        if (n > 1) duplicated++;
+    }
+    if (lost || duplicated) {
+        fprintf(stderr, "%d producers, %d consumers, capacity %zu: %zu lost, %zu duplicated\n",
+                producers, consumers, capacity, lost, duplicated);
+    }
+    CHECK(lost == 0);
+    CHECK(duplicated == 0);
+    CHECK(q.size() == 0);
+}
+
+// Whatever is in the ring at close() still comes out, once, and then pop()
+// reports the end; push() is refused from then on.
+static void close_drains() {
+    MpmcQueue<uint64_t> q(64);
+    const size_t n = 50;
+    for (uint64_t i = 0; i < n; i++) CHECK(q.try_push(i));
+    q.close();
+    CHECK(q.closed());
+    CHECK(!q.push(uint64_t(999)));
+
+    std::vector<std::atomic<uint32_t>> seen(n);
+    for (auto &s : seen) s.store(0);
+    std::atomic<size_t> popped{0};
+    std::vector<std::thread> threads;
+    for (int c = 0; c < 4; c++) {
+        threads.emplace_back([&] {
+            uint64_t v;
+            while (q.pop(v)) {
+                popped.fetch_add(1);
+                if (v < n) seen[v].fetch_add(1);
+            }
+        });
+    }
+    for (std::thread &t : threads) t.join();
+    CHECK(popped.load() == n);
+    for (auto &s : seen) CHECK(s.load() == 1);
+
+    uint64_t v;
+    CHECK(!q.pop(v));
+}
+
+// Consumers parked on an empty ring are woken by close() and return false.
+static void close_wakes_parked() {
+    MpmcQueue<uint64_t> q(8);
+    std::atomic<int> done{0};
+    std::vector<std::thread> threads;
+    for (int c = 0; c < 3; c++) {
+        threads.emplace_back([&] {
+            uint64_t v;
+            if (!q.pop(v)) done.fetch_add(1);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    q.close();
+    for (std::thread &t : threads) t.join();
+    CHECK(done.load() == 3);
+}
+
+static void bounds_and_move_only() {
+    MpmcQueue<std::unique_ptr<int>> q(3);
+    CHECK(q.capacity() == 4);
+    for (int i = 0; i < 4; i++) CHECK(q.try_push(std::unique_ptr<int>(new int(i))));
+    std::unique_ptr<int> extra(new int(4));
+    CHECK(!q.try_push(std::move(extra)));
+    CHECK(extra && *extra == 4); // a failed push leaves the value alone
+    for (int i = 0; i < 4; i++) {
+        std::unique_ptr<int> p;
+        CHECK(q.try_pop(p) && p && *p == i);
+    }
+    std::unique_ptr<int> p;
+    CHECK(!q.try_pop(p));
+}
+
+int main() {
+    bounds_and_move_only();
+    exactly_once(1, 1, 100000, 16);
+    exactly_once(4, 8, 20000, 64);
+    exactly_once(8, 2, 20000, 4);
+    exactly_once(2, 16, 20000, 2);
+    close_drains();
+    close_wakes_parked();
+
+    if (g_failures) return 1;
+    printf("mpmc: ok\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+// Uploads through the engine to img-util-mock with webp off and checks that
+// no payload was copied on the way: the bytes read (or handed in) are the
+// bytes sent, so imgutil_payload_copies_total stays at 0.
+//
+//   payload_copies_test path/to/img-util-mock
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "metrics.h"
+#include "uploader.h"
+#include "util.h"
+
+static int g_failures = 0;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if (!(cond)) {                                                               \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            g_failures++;                                                            \
+        }                                                                            \
+    } while (0)
+
+// A port nothing is listening on right now.
+static int free_port() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(a);
+    bind(fd, reinterpret_cast<sockaddr *>(&a), sizeof(a));
+    getsockname(fd, reinterpret_cast<sockaddr *>(&a), &len);
+    close(fd);
+    return ntohs(a.sin_port);
+}
+
+static bool wait_listening(int port) {
+    for (int i = 0; i < 100; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in a;
+        memset(&a, 0, sizeof(a));
+        a.sin_family = AF_INET;
+        a.sin_port = htons(static_cast<uint16_t>(port));
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bool ok = connect(fd, reinterpret_cast<sockaddr *>(&a), sizeof(a)) == 0;
+        close(fd);
+        if (ok) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return false;
+}
+
+static bool write_file(const std::string &path, size_t size, unsigned seed) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    srand(seed);
+    for (size_t i = 0; i < size; i++) fputc(rand() & 0xff, f);
+    return fclose(f) == 0;
+}
+
+// Value of one counter in the Prometheus text, or -1 if it is missing.
+static long long metric_value(const std::string &text, const std::string &name) {
+    size_t p = text.find("\n" + name + " ");
+    if (p == std::string::npos) return -1;
+    return atoll(text.c_str() + p + name.size() + 2);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s path/to/img-util-mock\n", argv[0]);
+        return 2;
+    }
+    int port = free_port();
+    std::string port_arg = "--port=" + std::to_string(port);
+    pid_t mock = fork();
+    if (mock == 0) {
+        execl(argv[1], argv[1], port_arg.c_str(), static_cast<char *>(nullptr));
+        _exit(127);
+    }
+    if (mock < 0 || !wait_listening(port)) {
+        fprintf(stderr, "could not start %s\n", argv[1]);
+        if (mock > 0) kill(mock, SIGKILL);
+        return 1;
+    }
+
+    char dir[] = "/tmp/imgutil-copies-XXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    std::string small = std::string(dir) + "/small.bin";
+    std::string large = std::string(dir) + "/large.bin";
+    CHECK(write_file(small, 10000, 1));
+    CHECK(write_file(large, 3 << 20, 2));
+
+    std::string base = "http://127.0.0.1:" + std::to_string(port);
+    std::string cfg = "{\"user_token\":\"test\",\"bucket\":\"mock\",\"enable_webp\":false,"
+                      "\"upload_scheme\":\"http\",\"qiniu_token_url\":\"" + base + "/v1/misc/qiniu-token\","
+                      "\"qiniu_query_url\":\"" + base + "/v4/query\"}";
+    {
+        Uploader up;
+        std::string error;
+        CHECK(up.open(cfg, error, 2));
+
+        UploadResult res;
+        CHECK(up.upload(small, res) && res.ok && res.bytes == 10000);
+        CHECK(up.upload(large, res) && res.ok && res.bytes == size_t(3) << 20);
+
+        PoolBuffer bytes;
+        std::string body(200000, 'x');
+        bytes.append(body.data(), body.size());
+        bool ok = false;
+        up.submit_bytes(std::move(bytes), "mem.bin", "application/octet-stream",
+                        [&](const UploadResult &r) { ok = r.ok && r.bytes == 200000; });
+        up.wait();
+        CHECK(ok);
+    }
+
+    std::string prom = std::string(dir) + "/metrics.prom";
+    std::string text;
+    CHECK(metrics_write_textfile(prom) && read_text_file(prom, text));
+    CHECK(metric_value(text, "imgutil_payload_copies_total") == 0);
+    CHECK(metric_value(text, "imgutil_payload_copied_bytes_total") == 0);
+
+    kill(mock, SIGINT);
+    waitpid(mock, nullptr, 0);
+    unlink(small.c_str());
+    unlink(large.c_str());
+    unlink(prom.c_str());
+    rmdir(dir);
+
+    if (g_failures) return 1;
+    printf("payload copies: ok\n");
+    return 0;
+}
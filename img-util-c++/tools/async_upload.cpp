@@ -0,0 +1,72 @@
+// Uploads every input through the coroutine front-end (src/coro.h) and
+// prints one JSON line per item, like img-util-cpp --results.
+//
+//   img-util-async [--config=config.json] [--loops=1] [--input-list=FILE] inputs...
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../src/coro.h"
+#include "../src/util.h"
+
+int main(int argc, char **argv) {
+    std::string config_path = "config.json";
+    int loops = 1;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a.rfind("--config=", 0) == 0) {
+            config_path = a.substr(9);
+        } else if (a.rfind("--loops=", 0) == 0) {
+            loops = std::atoi(a.c_str() + 8);
+        } else if (a.rfind("--input-list=", 0) == 0) {
+            std::ifstream in(a.substr(13));
+            std::string line;
+            while (std::getline(in, line)) {
+                if (!line.empty()) inputs.push_back(line);
+            }
+        } else {
+            inputs.push_back(a);
+        }
+    }
+
+    std::string cfg;
+    if (!read_text_file(config_path, cfg)) {
+        std::cout << "读取配置失败: " << config_path << "\n";
+        return 1;
+    }
+    AsyncUploader uploader;
+    std::string error;
+    if (!uploader.open(cfg, error, loops)) {
+        std::cout << "配置错误: " << error << "\n";
+        return 1;
+    }
+
+    std::mutex out_mu;
+    std::atomic<size_t> failed{0};
+    auto t0 = std::chrono::steady_clock::now();
+    for (const std::string &in : inputs) {
+        uploader.submit(in, [&](const UploadResult &r) {
+            if (!r.ok) failed.fetch_add(1);
+            ItemResult res;
+            res.key = r.key;
+            res.bytes = r.bytes;
+            std::lock_guard<std::mutex> lk(out_mu);
+            write_result_line(stdout, r.input, r.ok, res, r.latency_ms);
+            if (!r.ok) log_line("%s: %s", r.input.c_str(), r.error.c_str());
+        });
+    }
+    uploader.wait();
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - t0;
+    uploader.close();
+
+    std::cout << "完成: " << inputs.size() - failed.load() << " 成功, " << failed.load() << " 失败, 用时 "
+              << wall.count() << " s\n";
+    return failed.load() ? 1 : 0;
+}
@@ -0,0 +1,256 @@
+// End-to-end load driver: builds a synthetic corpus, points img-util-cpp at
+// a mock server (see mock_qiniu.cpp) and runs the corpus once per
+// concurrency setting, reporting items/s, MB/s and latency percentiles.
+// With --http=1.1,2 every setting is run once per upload HTTP version, to
+// compare a connection per upload with streams multiplexed on a few (the
+// mock must then serve https, see --tls-cert there).
+//
+//   img-util-loadgen --mock=http://127.0.0.1:18080 --items=500 --concurrency=1,4,16,64
+//   img-util-loadgen --mock=https://127.0.0.1:18443 --ca-file=cert.pem --http=1.1,2 --concurrency=64
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/util.h"
+
+namespace fs = std::filesystem;
+
+struct LoadOptions {
+    std::string bin;
+    std::string mock = "http://127.0.0.1:18080";
+    std::string workdir = "imgutil-load";
+    int items = 200;
+    int min_kb = 16;
+    int max_kb = 1024;
+    std::vector<int> concurrency = {1, 4, 16, 64};
+    std::vector<std::string> http = {"1.1"}; // upload_http_version per run
+    int streams = 100;                       // http2_streams_per_connection
+    std::string ca_file;                     // for an https mock's certificate
+    std::string extra_args;
+};
+
+struct RunReport {
+    int concurrency = 0;
+    size_t items = 0;
+    size_t failed = 0;
+    double wall_s = 0;
+    double bytes = 0;
+    std::vector<double> latency_ms;
+};
+
+static std::vector<std::string> split_list(const std::string &v) {
+    std::vector<std::string> out;
+    size_t p = 0;
+    while (p < v.size()) {
+        size_t e = v.find(',', p);
+        if (e == std::string::npos) e = v.size();
+        if (e > p) out.push_back(v.substr(p, e - p));
+        p = e + 1;
+    }
+    return out;
+}
+
+static std::string quote(const std::string &s) {
+#ifdef _WIN32
+    return "\"" + s + "\"";
+#else
+    std::string out = "'";
+    for (char c : s) {
+        if (c == '\'') out += "'\\''";
+        else out += c;
+    }
+    return out + "'";
+#endif
+}
+
+static bool write_file(const fs::path &p, const std::string &data) {
+    FILE *f = fopen(p.string().c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return fclose(f) == 0 && ok;
+}
+
+// Sizes are log-uniform between min_kb and max_kb, which is roughly what a
+// chat image corpus looks like. Every file is distinct so nothing dedups.
+static bool make_corpus(const LoadOptions &o, const fs::path &dir, std::string &list) {
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> u(std::log(static_cast<double>(o.min_kb)),
+                                             std::log(static_cast<double>(std::max(o.min_kb, o.max_kb))));
+    for (int i = 0; i < o.items; i++) {
+        size_t n = static_cast<size_t>(std::exp(u(rng)) * 1024.0);
+        std::string data(n, '\0');
+        uint64_t x = rng();
+        for (size_t j = 0; j < n; j++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            data[j] = static_cast<char>(x);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "item_%06d.png", i);
+        fs::path p = dir / name;
+        if (!write_file(p, data)) return false;
+        list += p.string() + "\n";
+    }
+    return true;
+}
+
+static double percentile(const std::vector<double> &sorted, double q) {
+    if (sorted.empty()) return 0;
+    size_t i = static_cast<size_t>(q * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+static bool run_once(const LoadOptions &o, const fs::path &dir, int c, RunReport &rep) {
+    fs::path results = dir / ("results_c" + std::to_string(c) + ".jsonl");
+    fs::remove(results);
+
+    std::string cmd;
+#ifdef _WIN32
+    cmd = "cd /d " + quote(dir.string()) + " && " + quote(o.bin);
+#else
+    cmd = "cd " + quote(dir.string()) + " && " + quote(o.bin);
+#endif
+    cmd += " --max-inflight=" + std::to_string(c);
+    cmd += " --input-list=list.txt --results=" + quote(results.filename().string());
+    if (!o.extra_args.empty()) cmd += " " + o.extra_args;
+#ifdef _WIN32
+    cmd += " > NUL";
+#else
+    cmd += " > /dev/null";
+#endif
+
+    auto t0 = std::chrono::steady_clock::now();
+    system(cmd.c_str());
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - t0;
+
+    std::string text;
+    if (!read_text_file(results.string(), text)) return false;
+
+    rep.concurrency = c;
+    rep.wall_s = wall.count();
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t nl = text.find('\n', pos);
+        if (nl == std::string::npos) nl = text.size();
+        std::string line = text.substr(pos, nl - pos);
+        pos = nl + 1;
+        if (line.empty()) continue;
+        rep.items++;
+        if (line.find("\"ok\":true") == std::string::npos) {
+            rep.failed++;
+            continue;
+        }
+        const char *b = strstr(line.c_str(), "\"bytes\":");
+        const char *l = strstr(line.c_str(), "\"latency_ms\":");
+        if (b) rep.bytes += strtod(b + 8, nullptr);
+        if (l) rep.latency_ms.push_back(strtod(l + 13, nullptr));
+    }
+    std::sort(rep.latency_ms.begin(), rep.latency_ms.end());
+    return true;
+}
+
+static bool parse_args(int argc, char **argv, LoadOptions &o) {
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *eq = strchr(a, '=');
+        std::string k = eq ? std::string(a, static_cast<size_t>(eq - a)) : std::string(a);
+        std::string v = eq ? eq + 1 : "";
+        if (k == "--bin") o.bin = v;
+        else if (k == "--mock") o.mock = v;
+        else if (k == "--workdir") o.workdir = v;
+        else if (k == "--items") o.items = atoi(v.c_str());
+        else if (k == "--min-kb") o.min_kb = std::max(1, atoi(v.c_str()));
+        else if (k == "--max-kb") o.max_kb = std::max(1, atoi(v.c_str()));
+        else if (k == "--args") o.extra_args = v;
+        else if (k == "--http") o.http = split_list(v);
+        else if (k == "--streams") o.streams = std::max(1, atoi(v.c_str()));
+        else if (k == "--ca-file") o.ca_file = fs::absolute(v).string();
+        else if (k == "--concurrency") {
+            o.concurrency.clear();
+            for (const std::string &c : split_list(v)) {
+                if (atoi(c.c_str()) > 0) o.concurrency.push_back(atoi(c.c_str()));
+            }
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--bin=img-util-cpp] [--mock=http://127.0.0.1:18080] [--workdir=imgutil-load]\n"
+                    "       [--items=200] [--min-kb=16] [--max-kb=1024] [--concurrency=1,4,16,64]\n"
+                    "       [--http=1.1,2,2-prior-knowledge] [--streams=100] [--ca-file=PEM]\n"
+                    "       [--args=\"extra img-util-cpp flags\"]\n",
+                    argv[0]);
+            return false;
+        }
+    }
+    return !o.concurrency.empty() && !o.http.empty();
+}
+
+static bool write_config(const LoadOptions &o, const fs::path &dir, const std::string &http) {
+    std::string scheme = o.mock.rfind("https://", 0) == 0 ? "https" : "http";
+    std::string cfg = "{\n"
+                      "  \"user_token\": \"loadgen\",\n"
+                      "  \"enable_webp\": false,\n"
+                      "  \"bucket\": \"mock\",\n"
+                      "  \"qiniu_token_url\": \"" + o.mock + "/v1/misc/qiniu-token\",\n"
+                      "  \"qiniu_query_url\": \"" + o.mock + "/v4/query\",\n"
+                      "  \"upload_scheme\": \"" + scheme + "\",\n"
+                      "  \"ca_file\": \"" + o.ca_file + "\",\n"
+                      "  \"upload_http_version\": \"" + http + "\",\n"
+                      "  \"http2_streams_per_connection\": " + std::to_string(o.streams) + "\n"
+                      "}\n";
+    return write_file(dir / "config.json", cfg);
+}
+
+int main(int argc, char **argv) {
+    LoadOptions o;
+    if (!parse_args(argc, argv, o)) return 2;
+    if (o.bin.empty()) {
+        fs::path self = fs::absolute(argv[0]);
+#ifdef _WIN32
+        o.bin = (self.parent_path() / "img-util-cpp.exe").string();
+#else
+        o.bin = (self.parent_path() / "img-util-cpp").string();
+#endif
+    }
+    o.bin = fs::absolute(o.bin).string();
+
+    fs::path dir = fs::absolute(o.workdir);
+    fs::create_directories(dir);
+
+    std::string list;
+    fprintf(stderr, "generating %d items in %s\n", o.items, dir.string().c_str());
+    if (!make_corpus(o, dir, list) || !write_file(dir / "list.txt", list)) {
+        fprintf(stderr, "could not write corpus\n");
+        return 1;
+    }
+
+    printf("%17s %11s %7s %7s %8s %9s %8s %9s %9s %9s %9s\n", "http", "concurrency", "items", "failed", "wall_s",
+           "items/s", "MB/s", "p50_ms", "p90_ms", "p99_ms", "max_ms");
+    for (const std::string &http : o.http) {
+        if (!write_config(o, dir, http)) {
+            fprintf(stderr, "could not write config.json\n");
+            return 1;
+        }
+        for (int c : o.concurrency) {
+            RunReport r;
+            if (!run_once(o, dir, c, r)) {
+                fprintf(stderr, "run with concurrency %d produced no results (is %s running?)\n", c, o.mock.c_str());
+                continue;
+            }
+            size_t ok = r.items - r.failed;
+            printf("%17s %11d %7zu %7zu %8.2f %9.1f %8.2f %9.1f %9.1f %9.1f %9.1f\n", http.c_str(), c, r.items,
+                   r.failed, r.wall_s, static_cast<double>(ok) / r.wall_s, r.bytes / (1024.0 * 1024.0) / r.wall_s,
+                   percentile(r.latency_ms, 0.50), percentile(r.latency_ms, 0.90), percentile(r.latency_ms, 0.99),
+                   r.latency_ms.empty() ? 0.0 : r.latency_ms.back());
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
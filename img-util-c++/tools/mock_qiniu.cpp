@@ -0,0 +1,936 @@
+// Local stand-in for the three endpoints img-util-cpp talks to: the
+// qiniu-token endpoint, /v4/query and the form-upload endpoint. Meant for
+// load tests, so latency, bandwidth and failures can be injected. Speaks
+// HTTP/1.1, and HTTP/2 to clients that open with the h2c preface. With a
+// certificate it serves https instead and offers h2 by ALPN (built when
+// OpenSSL is found).
+//
+//   img-util-mock --port=18080 --latency-ms=20 --jitter-ms=10 --bandwidth-kbps=20000 --error-rate=0.01
+//   img-util-mock --port=18443 --tls-cert=cert.pem --tls-key=key.pem
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef MOCK_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
+struct MockOptions {
+    std::string bind = "127.0.0.1";
+    int port = 18080;
+    std::string advertise;      // host[:port][,host[:port]...] returned by /v4/query
+    int latency_ms = 0;         // added before every response
+    int jitter_ms = 0;          // uniform extra latency in [0, jitter_ms]
+    long bandwidth_kbps = 0;    // per-connection body rate, 0 = unlimited
+    double error_rate = 0;      // fraction answered with 503
+    double throttle_rate = 0;   // fraction answered with 429 + Retry-After
+    double reset_rate = 0;      // fraction whose connection is reset
+    bool dedup = false;         // answer 614 for keys seen before
+    std::string tls_cert;       // PEM; serve https when set
+    std::string tls_key;
+};
+
+struct MockStats {
+    std::atomic<uint64_t> token{0};
+    std::atomic<uint64_t> query{0};
+    std::atomic<uint64_t> upload{0};
+    std::atomic<uint64_t> upload_bytes{0};
+    std::atomic<uint64_t> injected_5xx{0};
+    std::atomic<uint64_t> injected_429{0};
+    std::atomic<uint64_t> injected_reset{0};
+    std::atomic<uint64_t> dedup{0};
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> h2_connections{0};
+    std::atomic<uint64_t> h2_streams{0};
+};
+
+static MockOptions g_opt;
+static MockStats g_stats;
+static std::atomic<bool> g_stop{false};
+static std::mutex g_keys_mu;
+static std::set<std::string> g_keys;
+
+static void on_signal(int) { g_stop.store(true); }
+
+static double rand01() {
+    static thread_local std::mt19937_64 rng(std::random_device{}());
+    return std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+}
+
+static void sleep_ms(long ms) {
+    if (ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Paces a transfer of `n` bytes that started at `t0` to the configured rate.
+static void pace(std::chrono::steady_clock::time_point t0, uint64_t n) {
+    if (g_opt.bandwidth_kbps <= 0) return;
+    double due = static_cast<double>(n) / (static_cast<double>(g_opt.bandwidth_kbps) * 1024.0);
+    std::chrono::duration<double> spent = std::chrono::steady_clock::now() - t0;
+    if (due > spent.count()) std::this_thread::sleep_for(std::chrono::duration<double>(due - spent.count()));
+}
+
+#ifdef MOCK_TLS
+static SSL_CTX *g_tls = nullptr;
+#endif
+
+// One client connection, plain or TLS. One thread reads; HTTP/2 answers
+// write from several. A TLS session is not safe for concurrent calls, so
+// those are serialised and the socket goes non-blocking after the
+// handshake: a reader with nothing to read lets go of the session while it
+// waits in poll().
+struct Conn {
+    int fd;
+#ifdef MOCK_TLS
+    SSL *ssl = nullptr;
+    std::mutex tls_mu;
+#endif
+
+    explicit Conn(int f) : fd(f) {}
+    Conn(const Conn &) = delete;
+    Conn &operator=(const Conn &) = delete;
+    ~Conn() {
+#ifdef MOCK_TLS
+        if (ssl) SSL_free(ssl);
+#endif
+        close(fd);
+    }
+
+    // Handshakes when serving TLS; "h2" when ALPN picked HTTP/2.
+    bool open(std::string &alpn) {
+#ifdef MOCK_TLS
+        if (!g_tls) return true;
+        ssl = SSL_new(g_tls);
+        if (!ssl || !SSL_set_fd(ssl, fd) || SSL_accept(ssl) != 1) return false;
+        const unsigned char *proto = nullptr;
+        unsigned int len = 0;
+        SSL_get0_alpn_selected(ssl, &proto, &len);
+        if (proto) alpn.assign(reinterpret_cast<const char *>(proto), len);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#else
+        (void)alpn;
+#endif
+        return true;
+    }
+
+    ssize_t read(char *p, size_t n) {
+#ifdef MOCK_TLS
+        if (ssl) {
+            while (!g_stop.load()) {
+                int err;
+                {
+                    std::lock_guard<std::mutex> lk(tls_mu);
+                    int r = SSL_read(ssl, p, static_cast<int>(std::min<size_t>(n, 1 << 30)));
+                    if (r > 0) return r;
+                    err = SSL_get_error(ssl, r);
+                }
+                if (!wait(err)) return -1;
+            }
+            return -1;
+        }
+#endif
+        return recv(fd, p, n, 0);
+    }
+
+    ssize_t write(const char *p, size_t n) {
+#ifdef MOCK_TLS
+        if (ssl) {
+            std::lock_guard<std::mutex> lk(tls_mu);
+            while (!g_stop.load()) {
+                int r = SSL_write(ssl, p, static_cast<int>(std::min<size_t>(n, 1 << 30)));
+                if (r > 0) return r;
+                if (!wait(SSL_get_error(ssl, r))) return -1;
+            }
+            return -1;
+        }
+#endif
+        return send(fd, p, n, MSG_NOSIGNAL);
+    }
+
+    bool write_all(const char *p, size_t n) {
+        while (n > 0) {
+            ssize_t w = write(p, n);
+            if (w <= 0) return false;
+            p += w;
+            n -= static_cast<size_t>(w);
+        }
+        return true;
+    }
+
+    // Closes with a TCP reset rather than a FIN.
+    void reset() {
+        linger lg = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+
+#ifdef MOCK_TLS
+    bool wait(int err) {
+        short events = err == SSL_ERROR_WANT_READ ? POLLIN : err == SSL_ERROR_WANT_WRITE ? POLLOUT : 0;
+        if (!events) return false;
+        pollfd pfd = {fd, events, 0};
+        poll(&pfd, 1, 200);
+        return true;
+    }
+#endif
+};
+
+static bool send_all(Conn &c, const std::string &s) {
+    const char *p = s.data();
+    size_t left = s.size();
+    auto t0 = std::chrono::steady_clock::now();
+    while (left > 0) {
+        size_t chunk = std::min<size_t>(left, 16384);
+        ssize_t w = c.write(p, chunk);
+        if (w <= 0) return false;
+        p += w;
+        left -= static_cast<size_t>(w);
+        pace(t0, s.size() - left);
+    }
+    return true;
+}
+
+static std::string lower(std::string s) {
+    for (char &c : s) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return s;
+}
+
+struct Request {
+    std::string method;
+    std::string path;
+    std::map<std::string, std::string> headers;
+    std::string body;
+};
+
+// Reads one request from `c`; `buf` carries pipelined bytes between calls.
+static bool read_request(Conn &c, std::string &buf, Request &req) {
+    char tmp[65536];
+    size_t hend;
+    while ((hend = buf.find("\r\n\r\n")) == std::string::npos) {
+        if (buf.size() > (1 << 20)) return false;
+        ssize_t n = c.read(tmp, sizeof(tmp));
+        if (n <= 0) return false;
+        buf.append(tmp, static_cast<size_t>(n));
+    }
+
+    std::string head = buf.substr(0, hend);
+    buf.erase(0, hend + 4);
+
+    size_t eol = head.find("\r\n");
+    std::string line = head.substr(0, eol);
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.find(' ', sp1 + 1);
+    if (sp1 == std::string::npos || sp2 == std::string::npos) return false;
+    req.method = line.substr(0, sp1);
+    req.path = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    req.headers.clear();
+
+    size_t pos = eol == std::string::npos ? head.size() : eol + 2;
+    while (pos < head.size()) {
+        size_t e = head.find("\r\n", pos);
+        if (e == std::string::npos) e = head.size();
+        std::string h = head.substr(pos, e - pos);
+        size_t colon = h.find(':');
+        if (colon != std::string::npos) {
+            size_t v = colon + 1;
+            while (v < h.size() && h[v] == ' ') v++;
+            req.headers[lower(h.substr(0, colon))] = h.substr(v);
+        }
+        pos = e + 2;
+    }
+
+    size_t len = 0;
+    auto cl = req.headers.find("content-length");
+    if (cl != req.headers.end()) len = static_cast<size_t>(strtoull(cl->second.c_str(), nullptr, 10));
+
+    auto ex = req.headers.find("expect");
+    if (ex != req.headers.end() && lower(ex->second) == "100-continue" && buf.size() < len) {
+        if (!send_all(c, "HTTP/1.1 100 Continue\r\n\r\n")) return false;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    while (buf.size() < len) {
+        ssize_t n = c.read(tmp, std::min(sizeof(tmp), len - buf.size()));
+        if (n <= 0) return false;
+        buf.append(tmp, static_cast<size_t>(n));
+        pace(t0, buf.size());
+    }
+    req.body = buf.substr(0, len);
+    buf.erase(0, len);
+    return true;
+}
+
+static std::string response(int status, const char *reason, const std::string &body, const std::string &extra = "") {
+    return "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n"
+           "Content-Type: application/json\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n" + extra + "\r\n" + body;
+}
+
+// Returns the value of form field `name` and, for the file part, its size.
+static bool multipart_field(const Request &req, const char *name, std::string &value, size_t &size) {
+    auto ct = req.headers.find("content-type");
+    if (ct == req.headers.end()) return false;
+    size_t b = ct->second.find("boundary=");
+    if (b == std::string::npos) return false;
+    std::string boundary = "\r\n--" + ct->second.substr(b + 9);
+
+    std::string pat = std::string("name=\"") + name + "\"";
+    size_t p = req.body.find(pat);
+    if (p == std::string::npos) return false;
+    size_t start = req.body.find("\r\n\r\n", p);
+    if (start == std::string::npos) return false;
+    start += 4;
+    size_t end = req.body.find(boundary, start);
+    if (end == std::string::npos) return false;
+    size = end - start;
+    value = req.body.substr(start, std::min<size_t>(size, 256));
+    return true;
+}
+
+static std::string advertise_host() {
+    if (!g_opt.advertise.empty()) return g_opt.advertise;
+    return g_opt.bind + ":" + std::to_string(g_opt.port);
+}
+
+static std::string handle(const Request &req) {
+    if (req.path.find("qiniu-token") != std::string::npos) {
+        g_stats.token++;
+        return response(200, "OK", "{\"code\":1,\"data\":{\"token\":\"mockak:mocksig:eyJzY29wZSI6Im1vY2sifQ==\"},\"msg\":\"success\"}");
+    }
+
+    if (req.path.rfind("/v4/query", 0) == 0) {
+        g_stats.query++;
+        std::string list;
+        std::string h = advertise_host();
+        size_t p = 0;
+        while (p <= h.size()) {
+            size_t e = h.find(',', p);
+            if (e == std::string::npos) e = h.size();
+            if (!list.empty()) list += ",";
+            list += "\"" + h.substr(p, e - p) + "\"";
+            p = e + 1;
+        }
+        return response(200, "OK",
+                        "{\"hosts\":[{\"region\":\"mock\",\"ttl\":86400,\"up\":{\"domains\":[" + list +
+                            "],\"old\":[]}}]}");
+    }
+
+    if (req.method == "POST") {
+        g_stats.upload++;
+        std::string key;
+        std::string file;
+        size_t key_len = 0;
+        size_t fsize = 0;
+        if (!multipart_field(req, "key", key, key_len) || !multipart_field(req, "file", file, fsize)) {
+            return response(400, "Bad Request", "{\"error\":\"invalid multipart body\"}");
+        }
+        g_stats.upload_bytes += fsize;
+        if (g_opt.dedup) {
+            std::lock_guard<std::mutex> lk(g_keys_mu);
+            if (!g_keys.insert(key).second) {
+                g_stats.dedup++;
+                return response(614, "File Exists", "{\"error\":\"file exists\"}");
+            }
+        }
+        return response(200, "OK",
+                        "{\"hash\":\"mock-" + key + "\",\"key\":\"" + key + "\",\"fsize\":" + std::to_string(fsize) +
+                            ",\"bucket\":\"mock\"}");
+    }
+
+    return response(404, "Not Found", "{\"error\":\"no such endpoint\"}");
+}
+
+// HTTP/2 over cleartext with prior knowledge (RFC 9113), enough for curl's
+// uploads: one reader per connection, and each finished request answered
+// from a thread of its own so that the injected latency overlaps across
+// streams as it would on a real server. Request bodies are paced per
+// connection, since every stream shares its bandwidth.
+static const std::string H2_PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+enum { H2_DATA = 0, H2_HEADERS = 1, H2_RST_STREAM = 3, H2_SETTINGS = 4, H2_PING = 6, H2_GOAWAY = 7, H2_WINDOW_UPDATE = 8, H2_CONTINUATION = 9 };
+enum { H2_END_STREAM = 0x1, H2_ACK = 0x1, H2_END_HEADERS = 0x4, H2_PADDED = 0x8, H2_PRIORITY = 0x20 };
+
+// HPACK Huffman code lengths per symbol (RFC 7541 appendix B); the code is
+// canonical, so the codes themselves follow from the lengths.
+static const unsigned char HUFFMAN_BITS[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 30, 28, 28, 28,
+    28, 28, 28, 28, 28, 28, 6,  10, 10, 12, 13, 6,  8,  11, 10, 10, 8,  11, 8,  6,  6,  6,  5,  5,  5,  6,
+    6,  6,  6,  6,  6,  6,  7,  8,  15, 6,  12, 10, 13, 6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+    7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8,  13, 19, 13, 14, 6,  15, 5,  6,  5,  6,  5,  6,  6,
+    6,  5,  7,  7,  6,  6,  6,  5,  6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7,  15, 11, 14, 13, 28, 20, 22,
+    20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23, 24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23,
+    22, 23, 23, 24, 22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23, 21, 21, 22, 21, 23, 22,
+    23, 23, 20, 22, 22, 22, 23, 22, 22, 23, 26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27, 20, 24, 20, 21, 22, 21, 21, 23, 22, 22,
+    25, 25, 24, 24, 26, 23, 26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26, 30};
+
+struct Huffman {
+    uint32_t first[31] = {}; // first code of each length
+    uint32_t count[31] = {};
+    uint32_t offset[31] = {}; // index into `symbols` of that code
+    std::vector<int> symbols; // by (length, symbol)
+
+    Huffman() {
+        for (int s = 0; s < 257; s++) count[HUFFMAN_BITS[s]]++;
+        uint32_t code = 0;
+        uint32_t index = 0;
+        for (int len = 1; len <= 30; len++) {
+            code <<= 1;
+            first[len] = code;
+            offset[len] = index;
+            for (int s = 0; s < 257; s++) {
+                if (HUFFMAN_BITS[s] == len) symbols.push_back(s);
+            }
+            code += count[len];
+            index += count[len];
+        }
+    }
+
+    bool decode(const unsigned char *p, size_t n, std::string &out) const {
+        uint32_t code = 0;
+        int len = 0;
+        for (size_t i = 0; i < n; i++) {
+            for (int b = 7; b >= 0; b--) {
+                code = (code << 1) | ((p[i] >> b) & 1);
+                if (++len > 30) return false;
+                if (code - first[len] < count[len]) {
+                    int sym = symbols[offset[len] + code - first[len]];
+                    if (sym == 256) return false; // EOS inside a string
+                    out += static_cast<char>(sym);
+                    code = 0;
+                    len = 0;
+                }
+            }
+        }
+        // Leftover bits must be a prefix of EOS, i.e. all ones, under a byte.
+        return len < 8 && code == (1u << len) - 1;
+    }
+};
+
+static const char *const HPACK_STATIC[61][2] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"}, {":path", "/index.html"},
+    {":scheme", "http"}, {":scheme", "https"}, {":status", "200"}, {":status", "204"}, {":status", "206"},
+    {":status", "304"}, {":status", "400"}, {":status", "404"}, {":status", "500"}, {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"}, {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""},
+    {"access-control-allow-origin", ""}, {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""}, {"date", ""},
+    {"etag", ""}, {"expect", ""}, {"expires", ""}, {"from", ""}, {"host", ""}, {"if-match", ""},
+    {"if-modified-since", ""}, {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""},
+    {"last-modified", ""}, {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""}, {"retry-after", ""},
+    {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""}, {"transfer-encoding", ""},
+    {"user-agent", ""}, {"vary", ""}, {"via", ""}, {"www-authenticate", ""}};
+
+// HPACK decoder state for one connection (RFC 7541).
+struct HpackDecoder {
+    std::deque<std::pair<std::string, std::string>> dynamic; // newest first
+    size_t size = 0;
+    size_t max_size = 4096;
+
+    static bool integer(const unsigned char *&p, const unsigned char *end, int prefix, uint64_t &v) {
+        if (p >= end) return false;
+        uint64_t limit = (1u << prefix) - 1;
+        v = *p++ & limit;
+        if (v < limit) return true;
+        for (int shift = 0; shift < 56; shift += 7) {
+            if (p >= end) return false;
+            unsigned char b = *p++;
+            v += static_cast<uint64_t>(b & 0x7f) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    static bool string(const unsigned char *&p, const unsigned char *end, std::string &out) {
+        static const Huffman huffman;
+        if (p >= end) return false;
+        bool huff = (*p & 0x80) != 0;
+        uint64_t n;
+        if (!integer(p, end, 7, n) || n > static_cast<uint64_t>(end - p)) return false;
+        out.clear();
+        if (huff) {
+            if (!huffman.decode(p, static_cast<size_t>(n), out)) return false;
+        } else {
+            out.assign(reinterpret_cast<const char *>(p), static_cast<size_t>(n));
+        }
+        p += n;
+        return true;
+    }
+
+    bool entry(uint64_t index, std::string &name, std::string &value) const {
+        if (index == 0) return false;
+        if (index <= 61) {
+            name = HPACK_STATIC[index - 1][0];
+            value = HPACK_STATIC[index - 1][1];
+            return true;
+        }
+        if (index - 62 >= dynamic.size()) return false;
+        name = dynamic[index - 62].first;
+        value = dynamic[index - 62].second;
+        return true;
+    }
+
+    void evict() {
+        while (size > max_size && !dynamic.empty()) {
+            size -= dynamic.back().first.size() + dynamic.back().second.size() + 32;
+            dynamic.pop_back();
+        }
+    }
+
+    bool decode(const std::string &block, std::map<std::string, std::string> &out) {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(block.data());
+        const unsigned char *end = p + block.size();
+        while (p < end) {
+            std::string name;
+            std::string value;
+            uint64_t index;
+            unsigned char b = *p;
+            if (b & 0x80) { // indexed field
+                if (!integer(p, end, 7, index) || !entry(index, name, value)) return false;
+            } else if ((b & 0xe0) == 0x20) { // dynamic table size update
+                if (!integer(p, end, 5, index)) return false;
+                max_size = static_cast<size_t>(index);
+                evict();
+                continue;
+            } else { // literal, with incremental indexing (01) or not (0000 / 0001)
+                bool indexing = (b & 0xc0) == 0x40;
+                if (!integer(p, end, indexing ? 6 : 4, index)) return false;
+                if (index > 0) {
+                    std::string unused;
+                    if (!entry(index, name, unused)) return false;
+                } else if (!string(p, end, name)) {
+                    return false;
+                }
+                if (!string(p, end, value)) return false;
+                if (indexing) {
+                    dynamic.emplace_front(name, value);
+                    size += name.size() + value.size() + 32;
+                    evict();
+                }
+            }
+            out[name] = value;
+        }
+        return true;
+    }
+};
+
+static void hpack_integer(std::string &out, unsigned char first, int prefix, uint64_t v) {
+    uint64_t limit = (1u << prefix) - 1;
+    if (v < limit) {
+        out += static_cast<char>(first | v);
+        return;
+    }
+    out += static_cast<char>(first | limit);
+    v -= limit;
+    while (v >= 0x80) {
+        out += static_cast<char>((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+// A literal field without indexing and with a literal name: no encoder
+// state to keep in step with the client's decoder.
+static void hpack_literal(std::string &out, const std::string &name, const std::string &value) {
+    out += '\0';
+    hpack_integer(out, 0, 7, name.size());
+    out += name;
+    hpack_integer(out, 0, 7, value.size());
+    out += value;
+}
+
+struct H2Conn {
+    std::shared_ptr<Conn> conn;
+    std::mutex write_mu; // keeps each batch of frames contiguous
+
+    explicit H2Conn(std::shared_ptr<Conn> c) : conn(std::move(c)) {}
+
+    static std::string frame(int type, int flags, uint32_t stream, const std::string &payload) {
+        std::string f(9, '\0');
+        size_t n = payload.size();
+        f[0] = static_cast<char>(n >> 16);
+        f[1] = static_cast<char>(n >> 8);
+        f[2] = static_cast<char>(n);
+        f[3] = static_cast<char>(type);
+        f[4] = static_cast<char>(flags);
+        f[5] = static_cast<char>((stream >> 24) & 0x7f);
+        f[6] = static_cast<char>(stream >> 16);
+        f[7] = static_cast<char>(stream >> 8);
+        f[8] = static_cast<char>(stream);
+        return f + payload;
+    }
+
+    static std::string u32(uint32_t v) {
+        std::string s(4, '\0');
+        s[0] = static_cast<char>(v >> 24);
+        s[1] = static_cast<char>(v >> 16);
+        s[2] = static_cast<char>(v >> 8);
+        s[3] = static_cast<char>(v);
+        return s;
+    }
+
+    bool send_frames(const std::string &frames) {
+        std::lock_guard<std::mutex> lk(write_mu);
+        return conn->write_all(frames.data(), frames.size());
+    }
+
+    // Answers with the status, headers and body of an HTTP/1.1 response
+    // from handle().
+    void respond(uint32_t stream, const std::string &http1) {
+        size_t hend = http1.find("\r\n\r\n");
+        std::string head = http1.substr(0, hend);
+        std::string body = hend == std::string::npos ? "" : http1.substr(hend + 4);
+        std::string block;
+        size_t sp = head.find(' ');
+        hpack_literal(block, ":status", head.substr(sp + 1, 3));
+        size_t pos = head.find("\r\n");
+        while (pos != std::string::npos && pos + 2 < head.size()) {
+            size_t e = head.find("\r\n", pos + 2);
+            if (e == std::string::npos) e = head.size();
+            std::string h = head.substr(pos + 2, e - pos - 2);
+            size_t colon = h.find(':');
+            if (colon != std::string::npos) {
+                size_t v = colon + 1;
+                while (v < h.size() && h[v] == ' ') v++;
+                hpack_literal(block, lower(h.substr(0, colon)), h.substr(v));
+            }
+            pos = e;
+        }
+        std::string out = frame(H2_HEADERS, H2_END_HEADERS | (body.empty() ? H2_END_STREAM : 0), stream, block);
+        for (size_t off = 0; off < body.size(); off += 16384) {
+            size_t n = std::min<size_t>(16384, body.size() - off);
+            out += frame(H2_DATA, off + n == body.size() ? H2_END_STREAM : 0, stream, body.substr(off, n));
+        }
+        send_frames(out);
+    }
+};
+
+static void h2_answer(std::shared_ptr<H2Conn> c, uint32_t stream, Request req) {
+    long delay = g_opt.latency_ms;
+    if (g_opt.jitter_ms > 0) delay += static_cast<long>(rand01() * g_opt.jitter_ms);
+    sleep_ms(delay);
+
+    double r = rand01();
+    if (r < g_opt.reset_rate) {
+        g_stats.injected_reset++;
+        c->send_frames(H2Conn::frame(H2_RST_STREAM, 0, stream, H2Conn::u32(2))); // INTERNAL_ERROR
+    } else if (r < g_opt.reset_rate + g_opt.error_rate) {
+        g_stats.injected_5xx++;
+        c->respond(stream, response(503, "Service Unavailable", "{\"error\":\"injected failure\"}"));
+    } else if (r < g_opt.reset_rate + g_opt.error_rate + g_opt.throttle_rate) {
+        g_stats.injected_429++;
+        c->respond(stream, response(429, "Too Many Requests", "{\"error\":\"injected throttle\"}", "Retry-After: 1\r\n"));
+    } else {
+        c->respond(stream, handle(req));
+    }
+}
+
+static void serve_h2(std::shared_ptr<Conn> conn, std::string buf) {
+    g_stats.h2_connections++;
+    std::shared_ptr<H2Conn> c = std::make_shared<H2Conn>(conn);
+    // Large windows, so bodies flow without waiting on WINDOW_UPDATEs.
+    std::string hello = H2Conn::frame(H2_SETTINGS, 0, 0,
+                                      std::string("\0\x03", 2) + H2Conn::u32(1000) + std::string("\0\x04", 2) +
+                                          H2Conn::u32(1u << 24));
+    hello += H2Conn::frame(H2_WINDOW_UPDATE, 0, 0, H2Conn::u32(1u << 30));
+    if (!c->send_frames(hello)) return;
+
+    struct Stream {
+        Request req;
+        std::string block;
+        bool end_stream = false;
+    };
+    std::map<uint32_t, Stream> streams;
+    HpackDecoder hpack;
+    uint32_t continuing = 0; // stream whose header block is still open
+    uint64_t received = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    char tmp[65536];
+    auto need = [&](size_t n) {
+        while (buf.size() < n) {
+            ssize_t got = conn->read(tmp, sizeof(tmp));
+            if (got <= 0 || g_stop.load()) return false;
+            buf.append(tmp, static_cast<size_t>(got));
+            received += static_cast<uint64_t>(got);
+            pace(t0, received);
+        }
+        return true;
+    };
+    auto finish = [&](uint32_t id) {
+        auto it = streams.find(id);
+        g_stats.h2_streams++;
+        std::thread(h2_answer, c, id, std::move(it->second.req)).detach();
+        streams.erase(it);
+    };
+    auto headers_done = [&](uint32_t id) {
+        Stream &s = streams[id];
+        std::map<std::string, std::string> fields;
+        if (!hpack.decode(s.block, fields)) return false;
+        s.block.clear();
+        for (auto &f : fields) {
+            if (f.first == ":method") s.req.method = f.second;
+            else if (f.first == ":path") s.req.path = f.second;
+            else if (f.first[0] != ':') s.req.headers[f.first] = f.second;
+        }
+        if (s.end_stream) finish(id);
+        return true;
+    };
+
+    while (true) {
+        if (streams.empty()) { // pace bodies, not the idle time between them
+            t0 = std::chrono::steady_clock::now();
+            received = buf.size();
+        }
+        if (!need(9)) break;
+        const unsigned char *h = reinterpret_cast<const unsigned char *>(buf.data());
+        size_t len = (static_cast<size_t>(h[0]) << 16) | (static_cast<size_t>(h[1]) << 8) | h[2];
+        int type = h[3];
+        int flags = h[4];
+        uint32_t id = ((static_cast<uint32_t>(h[5]) & 0x7f) << 24) | (static_cast<uint32_t>(h[6]) << 16) |
+                      (static_cast<uint32_t>(h[7]) << 8) | h[8];
+        if (!need(9 + len)) break;
+        std::string payload = buf.substr(9, len);
+        buf.erase(0, 9 + len);
+        if (continuing && (type != H2_CONTINUATION || id != continuing)) break; // protocol error
+
+        if (type == H2_DATA || type == H2_HEADERS) {
+            size_t pad = 0;
+            size_t skip = 0;
+            if (flags & H2_PADDED) {
+                if (payload.empty()) break;
+                pad = static_cast<unsigned char>(payload[0]);
+                skip = 1;
+            }
+            if (type == H2_HEADERS && (flags & H2_PRIORITY)) skip += 5;
+            if (skip + pad > payload.size()) break;
+            std::string data = payload.substr(skip, payload.size() - skip - pad);
+            if (type == H2_HEADERS) {
+                Stream &s = streams[id];
+                s.end_stream = (flags & H2_END_STREAM) != 0;
+                s.block = data;
+                if (!(flags & H2_END_HEADERS)) continuing = id;
+                else if (!headers_done(id)) break;
+            } else {
+                auto it = streams.find(id);
+                if (len > 0) {
+                    std::string credit = H2Conn::frame(H2_WINDOW_UPDATE, 0, 0, H2Conn::u32(static_cast<uint32_t>(len)));
+                    if (!(flags & H2_END_STREAM)) {
+                        credit += H2Conn::frame(H2_WINDOW_UPDATE, 0, id, H2Conn::u32(static_cast<uint32_t>(len)));
+                    }
+                    if (!c->send_frames(credit)) break;
+                }
+                if (it == streams.end()) continue;
+                it->second.req.body += data;
+                if (flags & H2_END_STREAM) finish(id);
+            }
+        } else if (type == H2_CONTINUATION) {
+            streams[id].block += payload;
+            if (flags & H2_END_HEADERS) {
+                continuing = 0;
+                if (!headers_done(id)) break;
+            }
+        } else if (type == H2_SETTINGS) {
+            if (!(flags & H2_ACK) && !c->send_frames(H2Conn::frame(H2_SETTINGS, H2_ACK, 0, ""))) break;
+        } else if (type == H2_PING) {
+            if (!(flags & H2_ACK) && !c->send_frames(H2Conn::frame(H2_PING, H2_ACK, 0, payload))) break;
+        } else if (type == H2_RST_STREAM) {
+            streams.erase(id);
+        } else if (type == H2_GOAWAY) {
+            break;
+        }
+        // PRIORITY and WINDOW_UPDATE: responses are small enough to ignore them.
+    }
+}
+
+static void serve_conn(int fd) {
+    g_stats.connections++;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    std::shared_ptr<Conn> c = std::make_shared<Conn>(fd);
+    std::string alpn;
+    if (!c->open(alpn)) return;
+
+    // HTTP/2 opens with the connection preface, whether ALPN announced it
+    // or the client just knows (h2c).
+    std::string buf;
+    char tmp[64];
+    while (buf.size() < H2_PREFACE.size() && H2_PREFACE.compare(0, buf.size(), buf) == 0) {
+        ssize_t got = c->read(tmp, std::min(sizeof(tmp), H2_PREFACE.size() - buf.size()));
+        if (got <= 0) return;
+        buf.append(tmp, static_cast<size_t>(got));
+    }
+    if (buf == H2_PREFACE) {
+        serve_h2(std::move(c), "");
+        return;
+    }
+    if (alpn == "h2") return;
+
+    Request req;
+    while (!g_stop.load() && read_request(*c, buf, req)) {
+        long delay = g_opt.latency_ms;
+        if (g_opt.jitter_ms > 0) delay += static_cast<long>(rand01() * g_opt.jitter_ms);
+        sleep_ms(delay);
+
+        double r = rand01();
+        std::string out;
+        if (r < g_opt.reset_rate) {
+            g_stats.injected_reset++;
+            c->reset();
+            break;
+        } else if (r < g_opt.reset_rate + g_opt.error_rate) {
+            g_stats.injected_5xx++;
+            out = response(503, "Service Unavailable", "{\"error\":\"injected failure\"}");
+        } else if (r < g_opt.reset_rate + g_opt.error_rate + g_opt.throttle_rate) {
+            g_stats.injected_429++;
+            out = response(429, "Too Many Requests", "{\"error\":\"injected throttle\"}", "Retry-After: 1\r\n");
+        } else {
+            out = handle(req);
+        }
+
+        if (!send_all(*c, out)) break;
+        auto conn = req.headers.find("connection");
+        if (conn != req.headers.end() && lower(conn->second) == "close") break;
+    }
+}
+
+static void print_stats() {
+    fprintf(stderr,
+            "connections=%llu token=%llu query=%llu upload=%llu upload_bytes=%llu "
+            "injected_5xx=%llu injected_429=%llu injected_reset=%llu dedup=%llu h2_connections=%llu h2_streams=%llu\n",
+            (unsigned long long)g_stats.connections.load(), (unsigned long long)g_stats.token.load(),
+            (unsigned long long)g_stats.query.load(), (unsigned long long)g_stats.upload.load(),
+            (unsigned long long)g_stats.upload_bytes.load(), (unsigned long long)g_stats.injected_5xx.load(),
+            (unsigned long long)g_stats.injected_429.load(), (unsigned long long)g_stats.injected_reset.load(),
+            (unsigned long long)g_stats.dedup.load(), (unsigned long long)g_stats.h2_connections.load(),
+            (unsigned long long)g_stats.h2_streams.load());
+}
+
+static bool parse_args(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *eq = strchr(a, '=');
+        std::string k = eq ? std::string(a, static_cast<size_t>(eq - a)) : std::string(a);
+        const char *v = eq ? eq + 1 : "";
+        if (k == "--bind") g_opt.bind = v;
+        else if (k == "--port") g_opt.port = atoi(v);
+        else if (k == "--advertise") g_opt.advertise = v;
+        else if (k == "--latency-ms") g_opt.latency_ms = atoi(v);
+        else if (k == "--jitter-ms") g_opt.jitter_ms = atoi(v);
+        else if (k == "--bandwidth-kbps") g_opt.bandwidth_kbps = atol(v);
+        else if (k == "--error-rate") g_opt.error_rate = atof(v);
+        else if (k == "--throttle-rate") g_opt.throttle_rate = atof(v);
+        else if (k == "--reset-rate") g_opt.reset_rate = atof(v);
+        else if (k == "--dedup") g_opt.dedup = true;
+        else if (k == "--tls-cert") g_opt.tls_cert = v;
+        else if (k == "--tls-key") g_opt.tls_key = v;
+        else {
+            fprintf(stderr,
+                    "usage: %s [--bind=127.0.0.1] [--port=18080] [--advertise=host:port] [--latency-ms=N]\n"
+                    "       [--jitter-ms=N] [--bandwidth-kbps=N] [--error-rate=P] [--throttle-rate=P]\n"
+                    "       [--reset-rate=P] [--dedup] [--tls-cert=PEM --tls-key=PEM]\n",
+                    argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef MOCK_TLS
+// Prefers h2 when the client offers it, as a CDN edge would.
+static int select_alpn(SSL *, const unsigned char **out, unsigned char *outlen, const unsigned char *in,
+                       unsigned int inlen, void *) {
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    unsigned char *sel = nullptr;
+    if (SSL_select_next_proto(&sel, outlen, protos, sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = sel;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+static bool tls_init() {
+    g_tls = SSL_CTX_new(TLS_server_method());
+    if (!g_tls || SSL_CTX_use_certificate_chain_file(g_tls, g_opt.tls_cert.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(g_tls, g_opt.tls_key.c_str(), SSL_FILETYPE_PEM) != 1) {
+        ERR_print_errors_fp(stderr);
+        return false;
+    }
+    SSL_CTX_set_mode(g_tls, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_alpn_select_cb(g_tls, select_alpn, nullptr);
+    return true;
+}
+#endif
+
+int main(int argc, char **argv) {
+    if (!parse_args(argc, argv)) return 2;
+    if (!g_opt.tls_cert.empty()) {
+#ifdef MOCK_TLS
+        if (!tls_init()) return 1;
+#else
+        fprintf(stderr, "built without OpenSSL: --tls-cert is not available\n");
+        return 2;
+#endif
+    }
+    const char *scheme = g_opt.tls_cert.empty() ? "http" : "https";
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<unsigned short>(g_opt.port));
+    if (inet_pton(AF_INET, g_opt.bind.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "bad --bind address: %s\n", g_opt.bind.c_str());
+        return 1;
+    }
+
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (s < 0 || bind(s, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(s, 1024) != 0) {
+        perror("listen");
+        return 1;
+    }
+    fprintf(stderr, "mock qiniu listening on %s:%d\n", g_opt.bind.c_str(), g_opt.port);
+    fprintf(stderr, "  qiniu_token_url = %s://%s:%d/v1/misc/qiniu-token\n", scheme, g_opt.bind.c_str(), g_opt.port);
+    fprintf(stderr, "  qiniu_query_url = %s://%s:%d/v4/query\n", scheme, g_opt.bind.c_str(), g_opt.port);
+    fprintf(stderr, "  upload_scheme   = %s\n", scheme);
+
+    while (!g_stop.load()) {
+        pollfd pfd = {s, POLLIN, 0};
+        if (poll(&pfd, 1, 200) <= 0) continue;
+        int c = accept(s, nullptr, nullptr);
+        if (c < 0) continue;
+        std::thread(serve_conn, c).detach();
+    }
+
+    close(s);
+    print_stats();
+    return 0;
+}